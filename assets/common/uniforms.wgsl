@@ -0,0 +1,46 @@
+// The uniforms of every shader, split by how often they change (the C++ side is in Renderer.h)
+// - group 0, the scene: projection and light, the shadow cascades also follow the camera
+// - group 1, the object drawn: picked with a dynamic offset, the planet also has its vertices there
+// - group 2, the frame: camera and time
+// - group 3, the material: its textures come after the uniforms, from binding 1
+// the shadow pass only has the first 2 groups
+struct SceneUniforms {
+	projectionMatrix: mat4x4f,
+	invProjectionMatrix: mat4x4f,
+	// one per shadow cascade (Renderer::MAX_SHADOW_CASCADES), only the first cascadeCount are used
+	// each one is the matrix its layer of the shadow map was last rendered with
+	lightViewProjMatrices: array<mat4x4f, 4>,
+	lightDirection: vec4f,
+	fov: f32,
+	width: f32,
+	height: f32,
+	cascadeCount: u32,
+	// Renderer::SHADOW_DEPTH_BIAS, the shadow casters are simplified down to it
+	shadowDepthBias: f32,
+};
+
+struct ObjectUniforms {
+	modelMatrix: mat4x4f,
+	// resolution of the planet grid when the vertices are pulled from the storage buffer
+	gridResolution: u32,
+	// radius of the ocean sphere
+	radius: f32,
+};
+
+struct FrameUniforms {
+	viewMatrix: mat4x4f,
+	invViewMatrix: mat4x4f,
+	viewPosition: vec4f,
+	time: f32,
+};
+
+struct MaterialUniforms {
+	color: vec4f,
+	shininess: f32,
+	kSpecular: f32,
+};
+
+@group(0) @binding(0) var<uniform> uScene: SceneUniforms;
+@group(1) @binding(0) var<uniform> uObject: ObjectUniforms;
+@group(2) @binding(0) var<uniform> uFrame: FrameUniforms;
+@group(3) @binding(0) var<uniform> uMaterial: MaterialUniforms;
@@ -0,0 +1,59 @@
+// Upsampling of the ocean when it is shaded at a lower resolution than the screen (see Renderer::onFrame)
+// each pixel blends the 4 closest texels of the ocean, weighted by how close the scene depth they were shaded
+// with is to the depth of the pixel: the coasts stay sharp instead of bleeding over the terrain
+// the ocean color isn't premultiplied, so the texels are also weighted by their alpha
+
+struct VertexOutput {
+	@builtin(position) position: vec4f,
+};
+
+// relative depth difference under which 2 depths are about the same surface
+const DEPTH_EPSILON: f32 = 0.01;
+
+// the uniforms are in common/uniforms.wgsl
+@group(3) @binding(1) var oceanTexture: texture_2d<f32>;
+@group(3) @binding(2) var depthTexture: texture_depth_2d;
+
+@vertex
+fn vs_main(@builtin(vertex_index) vertexIndex: u32) -> VertexOutput {
+	// a single triangle covering the screen
+	let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+	var out: VertexOutput;
+	out.position = vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+	return out;
+}
+
+// distance to the camera plane, from a depth of the depth buffer
+fn viewDepth(depth: f32) -> f32 {
+	let position = uScene.invProjectionMatrix * vec4f(0.0, 0.0, depth, 1.0);
+	return position.z / position.w;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+	let lowSize = vec2i(textureDimensions(oceanTexture));
+	let scale = vec2f(textureDimensions(depthTexture)) / vec2f(lowSize);
+	let pixelDepth = viewDepth(textureLoad(depthTexture, vec2i(in.position.xy), 0));
+
+	// the 4 texels around the pixel, with their bilinear weights
+	let lowPosition = in.position.xy / scale - 0.5;
+	let base = vec2i(floor(lowPosition));
+	let f = lowPosition - floor(lowPosition);
+
+	var color = vec3f(0.0);
+	var alpha = 0.0;
+	var weights = 0.0;
+	for (var i = 0; i < 4; i++) {
+		let offset = vec2i(i & 1, i >> 1u);
+		let texel = clamp(base + offset, vec2i(0), lowSize - 1);
+		let bilinear = select(1.0 - f.x, f.x, offset.x == 1) * select(1.0 - f.y, f.y, offset.y == 1);
+		// the texel was shaded with the scene depth at its center (the ocean samples it without filtering)
+		let texelDepth = viewDepth(textureLoad(depthTexture, vec2i((vec2f(texel) + 0.5) * scale), 0));
+		let weight = bilinear / (DEPTH_EPSILON + abs(texelDepth - pixelDepth) / pixelDepth);
+		let ocean = textureLoad(oceanTexture, texel, 0);
+		color += weight * ocean.a * ocean.rgb;
+		alpha += weight * ocean.a;
+		weights += weight;
+	}
+	return vec4f(color / max(alpha, 1e-6), alpha / weights);
+}
@@ -1,39 +1,13 @@
-/**
- * A structure holding the value of our uniforms
- */
-struct SceneUniforms {
-    projectionMatrix: mat4x4f,
-    invProjectionMatrix: mat4x4f,
-    viewMatrix: mat4x4f,
-	  invViewmatrix: mat4x4f,
-    modelMatrix: mat4x4f,
-    lightViewProjMatrix: mat4x4f,
-    color: vec4f,
-    lightDirection: vec4f,
-    baseColor: vec4f,
-    viewPosition: vec4f,
-    time: f32,
-    fov: f32,
-    terrainShininess: f32,
-    terrainKSpecular: f32,
-    width: f32,
-    height: f32,
-    oceanColor: vec4f,
-    oceanRadius: f32,
-    oceanShininess: f32,
-    oceanKSpecular: f32,
-};
-
 struct VertexOutput {
 	@builtin(position) position: vec4f,
   @location(1) uv: vec2f,
 };
 
 
-@group(0) @binding(0) var<uniform> uSceneUniforms: SceneUniforms;
-@group(0) @binding(1) var textureSampler: sampler;
-@group(0) @binding(2) var depthTexture: texture_depth_2d;
-@group(0) @binding(3) var normalTexture: texture_2d<f32>;
+// the uniforms are in common/uniforms.wgsl
+@group(3) @binding(1) var textureSampler: sampler;
+@group(3) @binding(2) var depthTexture: texture_depth_2d;
+@group(3) @binding(3) var normalTexture: texture_2d<f32>;
 
 @vertex
 fn vs_main(@builtin(vertex_index) VertexIndex : u32) -> VertexOutput {
@@ -82,9 +56,9 @@ fn get_normal(eyePos: vec3f, hit_point: vec3f, spherePos: vec3f) -> vec3f {
     // GPU Gems 3 blend// Triplanar uvs
     // Triplanar blend of the normal map
     let blend = getTriPlanarBlend(hit_point);
-    let uvX = hit_point.zy + uSceneUniforms.time/100.0; // x facing plane
-    let uvY = hit_point.xz + uSceneUniforms.time/100.0; // y facing plane
-    let uvZ = hit_point.xy + uSceneUniforms.time/100.0; // z facing plane// Tangent space normal maps
+    let uvX = hit_point.zy + uFrame.time/100.0; // x facing plane
+    let uvY = hit_point.xz + uFrame.time/100.0; // y facing plane
+    let uvZ = hit_point.xy + uFrame.time/100.0; // z facing plane// Tangent space normal maps
     let tnormalX = unpackNormal(textureSample(normalTexture, textureSampler, uvX));
     let tnormalY = unpackNormal(textureSample(normalTexture, textureSampler, uvY));
     let tnormalZ = unpackNormal(textureSample(normalTexture, textureSampler, uvZ));
@@ -100,23 +74,24 @@ fn get_normal(eyePos: vec3f, hit_point: vec3f, spherePos: vec3f) -> vec3f {
 
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4f {
-  let eyePos: vec3f = uSceneUniforms.viewPosition.xyz;
+  let eyePos: vec3f = uFrame.viewPosition.xyz;
 
   // Build the ray dir: remap fragment position to 0,0, 
   // Good resource here: https://computergraphics.stackexchange.com/questions/8479/how-to-calculate-ray
-  let fov = radians(uSceneUniforms.fov);
+  let fov = radians(uScene.fov);
   let d = 1.0/tan(fov/2.0);
-  let width = uSceneUniforms.width;
-  let height = uSceneUniforms.height;
+  let width = uScene.width;
+  let height = uScene.height;
   let aspect_ratio = width/height;
-  let x = aspect_ratio*(-1.0 + 2.0 * in.position.x/width);
-  let y = -(-1.0 + (2.0*(in.position.y/height)));
+  // from the uv rather than the pixel: the ocean can be shaded at a lower resolution than the screen
+  let x = aspect_ratio*(-1.0 + 2.0 * in.uv.x);
+  let y = -(-1.0 + (2.0*in.uv.y));
   let z = -d;
   var rayDir = vec3f(x, y, z);
-  rayDir = normalize((uSceneUniforms.invViewmatrix * vec4f(rayDir, 0.0)).xyz);
+  rayDir = normalize((uFrame.invViewMatrix * vec4f(rayDir, 0.0)).xyz);
 
   // Calculate the intersection of the ray with the sphere
-  let sphereRadius = uSceneUniforms.oceanRadius;
+  let sphereRadius = uObject.radius;
   let spherePos = vec3f(0.0, 0.0, 0.0);
   let oc: vec3f = eyePos - spherePos;
   let a = 1.0; // works because rayDir is normed
@@ -147,7 +122,7 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4f {
     let ocean_distance = dot(ray, normalize(spherePos-eyePos));
 
     // project the scene depth into camera space
-    let upos: vec4f = uSceneUniforms.invProjectionMatrix * vec4(in.uv * 2.0 - 1.0, scene_depth, 1.0);
+    let upos: vec4f = uScene.invProjectionMatrix * vec4(in.uv * 2.0 - 1.0, scene_depth, 1.0);
 
     // invert z to be the right way
     // this it the actual planet pixel world position
@@ -164,26 +139,26 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4f {
     let alpha = clamp(depth / max_depth, 0.3, 0.8);
 
     // blue ocean color
-    let base_ocean_color = uSceneUniforms.oceanColor.xyz;
+    let base_ocean_color = uMaterial.color.xyz;
 
     // compute the normal of the sphere
     let hit_point = eyePos + ray; // hit point world pos
     let normal: vec3f = get_normal(eyePos, hit_point, spherePos);
 
     // diffuse component
-    let lightDirection = normalize(-uSceneUniforms.lightDirection);
+    let lightDirection = normalize(-uScene.lightDirection);
     let incidence = max(dot(lightDirection, vec4f(normal, 0.0)), 0.0);
     let diffuse = vec4f(base_ocean_color * incidence, 1.0);
 
     // The specular part
     let worldPosition = hit_point;
     let viewDir = normalize(-ray);
-    let reflectDir = reflect(uSceneUniforms.lightDirection.xyz, normal);  
-    let specular: f32 = pow(max(dot(viewDir, reflectDir), 0.0), uSceneUniforms.oceanShininess);
+    let reflectDir = reflect(uScene.lightDirection.xyz, normal);  
+    let specular: f32 = pow(max(dot(viewDir, reflectDir), 0.0), uMaterial.shininess);
     
     // Final output
     // let light_color = vec4f(1.0);
-	  let color: vec4f = diffuse + uSceneUniforms.oceanKSpecular * specular;
+	  let color: vec4f = diffuse + uMaterial.kSpecular * specular;
 
     // gamma correction
     let corrected_color = pow(color.xyz, vec3f(2.2));
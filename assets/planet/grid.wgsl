@@ -0,0 +1,55 @@
+// Vertex pulling for the planet grid, shared by the planet and the shadow shaders
+// the vertices are read from a storage buffer, and the triangle corner is derived from the vertex index
+// so that the planet needs no index buffer
+// the order of the quads must stay the one of FaceGenerator::generateFaceIndices
+const TILE_SIZE: u32 = 32u;
+const CACHE_BAND_WIDTH: u32 = 6u;
+// sizeof(VertexAttributes) / sizeof(f32): position, normal, color, uv, tangent, bitangent
+const FLOATS_PER_VERTEX: u32 = 17u;
+
+// next to the uniforms of the planet object
+@group(1) @binding(1) var<storage, read> planetVertices: array<f32>;
+
+// index of the vertex in the planet vertex buffer
+fn gridVertexId(vertexIndex: u32, resolution: u32) -> u32 {
+	let quadsPerSide = resolution - 1u;
+	let indicesPerFace = quadsPerSide * quadsPerSide * 6u;
+	let face = vertexIndex / indicesPerFace;
+	let quad = (vertexIndex % indicesPerFace) / 6u;
+	let corner = vertexIndex % 6u;
+
+	// row of tiles: they are all TILE_SIZE quads high but the last one
+	let tileY = quad / (TILE_SIZE * quadsPerSide);
+	let tileHeight = min(TILE_SIZE, quadsPerSide - tileY * TILE_SIZE);
+	var rest = quad - tileY * TILE_SIZE * quadsPerSide;
+	// tile in the row
+	let tileX = rest / (TILE_SIZE * tileHeight);
+	let tileWidth = min(TILE_SIZE, quadsPerSide - tileX * TILE_SIZE);
+	rest -= tileX * TILE_SIZE * tileHeight;
+	// band in the tile, then row by row in the band
+	let band = rest / (CACHE_BAND_WIDTH * tileHeight);
+	let bandWidth = min(CACHE_BAND_WIDTH, tileWidth - band * CACHE_BAND_WIDTH);
+	rest -= band * CACHE_BAND_WIDTH * tileHeight;
+	let x = tileX * TILE_SIZE + band * CACHE_BAND_WIDTH + rest % bandWidth;
+	let y = tileY * TILE_SIZE + rest / bandWidth;
+
+	// corners of the 2 triangles (i, i + res + 1, i + res) and (i, i + 1, i + res + 1)
+	// as bit masks: x offsets 0 1 0 0 1 1, y offsets 0 1 1 0 0 1
+	let cornerX = (0x32u >> corner) & 1u;
+	let cornerY = (0x26u >> corner) & 1u;
+	return face * resolution * resolution + (x + cornerX) + (y + cornerY) * resolution;
+}
+
+fn readVec3(offset: u32) -> vec3f {
+	return vec3f(planetVertices[offset], planetVertices[offset + 1u], planetVertices[offset + 2u]);
+}
+
+fn gridVertex(vertexIndex: u32, resolution: u32) -> VertexInput {
+	let offset = gridVertexId(vertexIndex, resolution) * FLOATS_PER_VERTEX;
+	var vertex: VertexInput;
+	vertex.position = readVec3(offset);
+	vertex.normal = readVec3(offset + 3u);
+	vertex.color = readVec3(offset + 6u);
+	vertex.uv = vec2f(planetVertices[offset + 9u], planetVertices[offset + 10u]);
+	return vertex;
+}
@@ -11,67 +11,61 @@ struct VertexOutput {
 	@location(1) normal: vec3f,
 	@location(2) uv: vec2f,
 	@location(3) worldPosition: vec4f,
-	@location(4) shadowPos: vec3f,
 };
 
-/**
- * A structure holding the value of our uniforms
- */
-struct SceneUniforms {
-    projectionMatrix: mat4x4f,
-    invProjectionMatrix: mat4x4f,
-    viewMatrix: mat4x4f,
-	invViewmatrix: mat4x4f,
-    modelMatrix: mat4x4f,
-	lightViewProjMatrix: mat4x4f,
-    color: vec4f,
-	lightDirection: vec4f,
-	baseColor: vec4f,
-	viewPosition: vec4f,
-    time: f32,
-    fov: f32,
-	terrainShininess: f32,
-	terrainKSpecular: f32,
-    width: f32,
-    height: f32,
-    oceanColor: vec4f,
-    oceanRadius: f32,
-    oceanShininess: f32,
-    oceanKSpecular: f32,
-};
-
-@group(0) @binding(0) var<uniform> uSceneUniforms: SceneUniforms;
-@group(0) @binding(1) var shadowSampler: sampler_comparison;
-@group(0) @binding(2) var shadowMap: texture_depth_2d;
+// the uniforms are in common/uniforms.wgsl
+// the terrain material also has the shadow map, a layer per cascade
+@group(3) @binding(1) var shadowSampler: sampler_comparison;
+@group(3) @binding(2) var shadowMap: texture_depth_2d_array;
 
 @vertex
 fn vs_main(in: VertexInput) -> VertexOutput {
+	return transformVertex(in);
+}
+
+// the vertices are pulled from the storage buffer of grid.wgsl, without index buffer
+@vertex
+fn vs_grid(@builtin(vertex_index) vertexIndex: u32) -> VertexOutput {
+	return transformVertex(gridVertex(vertexIndex, uObject.gridResolution));
+}
+
+fn transformVertex(in: VertexInput) -> VertexOutput {
 	var out: VertexOutput;
-	out.position = uSceneUniforms.projectionMatrix * uSceneUniforms.viewMatrix * uSceneUniforms.modelMatrix * vec4f(in.position, 1.0);
+	out.position = uScene.projectionMatrix * uFrame.viewMatrix * uObject.modelMatrix * vec4f(in.position, 1.0);
 
 	// get the normal in world coordinate
 	// note: this actually will not work if there is a scaling change involved
 	// (see the part about the model matrix here: https://learnopengl.com/Lighting/Basic-Lighting)
-    out.normal = (uSceneUniforms.modelMatrix * vec4f(in.normal, 0.0)).xyz;
+    out.normal = (uObject.modelMatrix * vec4f(in.normal, 0.0)).xyz;
 	out.color = in.color;
 	out.uv = in.uv;
-	out.worldPosition = uSceneUniforms.modelMatrix * vec4f(in.position, 1.0);
+	out.worldPosition = uObject.modelMatrix * vec4f(in.position, 1.0);
+	return out;
+}
 
-	  // XY is in (-1, 1) space, Z is in (0, 1) space
-	let posFromLight = uSceneUniforms.lightViewProjMatrix * uSceneUniforms.modelMatrix * vec4(in.position, 1.0);
+// Most of the code for shadow was taken from there: https://webgpu.github.io/webgpu-samples/samples/shadowMapping
+fn shadowCalculation(worldPosition: vec4f) -> f32 {
+	// the finest cascade whose layer covers the fragment, a few texels away from its border
+	// a layer can be older than the view (see Renderer::scheduleShadowCascades), it is read with the matrix
+	// it was rendered with: its box may not cover the fragment anymore, the next cascade takes over
+	// (select only, the texture is sampled in uniform control flow)
+	let inner = 1.0 - 4.0 / f32(textureDimensions(shadowMap).x);
+	var cascade = uScene.cascadeCount - 1u;
+	// XY is in (-1, 1) space, Z is in (0, 1) space
+	var posFromLight = uScene.lightViewProjMatrices[cascade] * worldPosition;
+	for (var i = i32(uScene.cascadeCount) - 2; i >= 0; i--) {
+		let candidate = uScene.lightViewProjMatrices[i] * worldPosition;
+		let inside = all(abs(candidate.xy) < vec2f(inner));
+		cascade = select(cascade, u32(i), inside);
+		posFromLight = select(posFromLight, candidate, inside);
+	}
 
 	// Convert XY to (0, 1) for fetching the texture
 	// Y is flipped because texture coords are Y-down.
-	out.shadowPos = vec3(
+	let shadowPos = vec3(
 		posFromLight.xy * vec2(0.5, -0.5) + vec2(0.5),
 		posFromLight.z
 	);
-	return out;
-}
-
-// Most of the code for shadow was taken from there: https://webgpu.github.io/webgpu-samples/samples/shadowMapping
-fn shadowCalculation(shadowPos: vec3f) -> f32 {
-	let shadowDepthTextureSize: f32 = 1024.0;
 
   	// // Percentage-closer filtering. Sample texels in the region
 	// // to smooth the result.
@@ -92,33 +86,34 @@ fn shadowCalculation(shadowPos: vec3f) -> f32 {
 	// let lightingFactor: f32 = min(ambientFactor + visibility * lambertFactor, 1.0);
 
 	// returns 0 if the texture sample is less than the compare value, 1 if it's higher
+	// (the shadow casters are simplified down to the bias)
 	let visibility = textureSampleCompare(
 		shadowMap, shadowSampler,
-		shadowPos.xy, shadowPos.z - 0.007
+		shadowPos.xy, cascade, shadowPos.z - uScene.shadowDepthBias
 	);
 	return visibility;
 }
 
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4f {
-	let albedo = uSceneUniforms.baseColor;
+	let albedo = uMaterial.color;
 	let normal = normalize(in.normal);
 
 	// diffuse component
-	let lightDirection = normalize(-uSceneUniforms.lightDirection);
+	let lightDirection = normalize(-uScene.lightDirection);
 	let incidence = max(dot(lightDirection, vec4f(normal, 0.0)), 0.0);
 	let diffuse = vec4f(albedo.xyz * incidence, 1.0);
 
 	// // The specular part
-	let viewDir = normalize(uSceneUniforms.viewPosition - in.worldPosition);
-	let reflectDir = reflect(uSceneUniforms.lightDirection.xyz, normal);  
-	let specular = pow(max(dot(viewDir.xyz, reflectDir), 0.0), uSceneUniforms.terrainShininess);
+	let viewDir = normalize(uFrame.viewPosition - in.worldPosition);
+	let reflectDir = reflect(uScene.lightDirection.xyz, normal);  
+	let specular = pow(max(dot(viewDir.xyz, reflectDir), 0.0), uMaterial.shininess);
 
 	// Shadow computation
-	let lightingFactor: f32 = shadowCalculation(in.shadowPos);       
+	let lightingFactor: f32 = shadowCalculation(in.worldPosition);       
 
 	// Final output
-	let color: vec4f = (lightingFactor * (diffuse + uSceneUniforms.terrainKSpecular * specular));
+	let color: vec4f = (lightingFactor * (diffuse + uMaterial.kSpecular * specular));
 
 	// gamma correction
     let corrected_color = pow(color, vec4f(2.2));
@@ -5,36 +5,18 @@ struct VertexInput {
 	@location(3) uv: vec2f,
 };
 
-/**
- * A structure holding the value of our uniforms
- */
-struct SceneUniforms {
-    projectionMatrix: mat4x4f,
-    invProjectionMatrix: mat4x4f,
-    viewMatrix: mat4x4f,
-	invViewmatrix: mat4x4f,
-    modelMatrix: mat4x4f,
-	lightViewProjMatrix: mat4x4f,
-    color: vec4f,
-	lightDirection: vec4f,
-	baseColor: vec4f,
-	viewPosition: vec4f,
-    time: f32,
-    fov: f32,
-	terrainShininess: f32,
-	terrainKSpecular: f32,
-    width: f32,
-    height: f32,
-    oceanColor: vec4f,
-    oceanRadius: f32,
-    oceanShininess: f32,
-    oceanKSpecular: f32,
-};
-
-@group(0) @binding(0) var<uniform> uSceneUniforms: SceneUniforms;
+// the uniforms are in common/uniforms.wgsl, only the scene and the object are bound in the shadow pass
+// the cascade being rendered is given as the instance index
 
 @vertex
-fn vs_main(in: VertexInput) -> @builtin(position) vec4f {
-	return uSceneUniforms.lightViewProjMatrix * uSceneUniforms.modelMatrix * vec4f(in.position, 1.0);
+fn vs_main(in: VertexInput, @builtin(instance_index) cascade: u32) -> @builtin(position) vec4f {
+	return uScene.lightViewProjMatrices[cascade] * uObject.modelMatrix * vec4f(in.position, 1.0);
 }
 
+// the vertices are pulled from the storage buffer of grid.wgsl, the shadow casters are still indexed
+// so the vertex index is the index read from the index buffer
+@vertex
+fn vs_pulled(@builtin(vertex_index) vertexIndex: u32, @builtin(instance_index) cascade: u32) -> @builtin(position) vec4f {
+	let position = readVec3(vertexIndex * FLOATS_PER_VERTEX);
+	return uScene.lightViewProjMatrices[cascade] * uObject.modelMatrix * vec4f(position, 1.0);
+}
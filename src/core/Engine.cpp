@@ -37,6 +37,7 @@
 
 #include <iostream>
 #include <cassert>
+#include <cstdio>
 #include <filesystem>
 #include <sstream>
 #include <string>
@@ -81,6 +82,9 @@ bool Engine::onInit() {
     // setup the ocean
     mRenderer.setOceanPipeline();
 
+    // the planet pipelines are made once, each new planet only changes their buffers
+    mRenderer.setPlanetPipeline();
+
     // Setup GLFW callbacks
     glfwSetWindowUserPointer(mWindow, this);
     glfwSetCursorPosCallback(mWindow, onWindowMouseMove);
@@ -92,23 +96,78 @@ bool Engine::onInit() {
     return true;
 }
 
-void Engine::onFrame() {
-    // if the settings changed, take down the current pipeline and rebuild the planet
-    GUISettings settings = mRenderer.getGUISettings();
-    if (settings.planetSettingsChanged) {
-        mRenderer.terminatePlanetPipeline();
-        std::vector<VertexAttributes> vertexData;
-        std::vector<uint32_t> indices;
-        mPlanetGenerator.generatePlanetData(vertexData, indices, settings);
+bool Engine::renderHeadless(HeadlessSettings const& headless) {
+    // up to the biggest texture the device is asked for
+    uint32_t width = glm::clamp(headless.width, 1u, 4096u);
+    uint32_t height = glm::clamp(headless.height, 1u, 4096u);
+    if (!mRenderer.initHeadless(width, height, headless.softwareAdapter)) return false;
+    mRenderer.setSkyboxPipeline();
+    mRenderer.setOceanPipeline();
+    mRenderer.setPlanetPipeline();
 
-        // TODO: why remake the whole pipeline ? only the data changes
-        mRenderer.setPlanetPipeline(vertexData, indices);
+    mCameraState.angles.x = headless.angles.x;
+    mCameraState.angles.y = glm::clamp(headless.angles.y, -PI / 2 + 1e-5f, PI / 2 - 1e-5f);
+    mCameraState.zoom = glm::clamp(headless.zoom, -4.0f, 2.0f);
+    generatePlanet(mRenderer.getGUISettings());
 
-        // update the view matrix to match the current camera position
+    // a turntable around the planet, each frame is saved while the next ones render
+    // (the shadow cascades and the culling are all done for the first frame)
+    unsigned int frameCount = std::max(headless.frames, 1u);
+    for (unsigned int frame = 0; frame < frameCount; frame++) {
+        mCameraState.angles.x = headless.angles.x + 2.0f * PI * (float)frame / (float)frameCount;
         updateViewMatrix();
+        mRenderer.waitForNextFrame();
+        if (frameCount == 1) {
+            mRenderer.captureFrame(headless.output);
+        } else {
+            // out.png is saved as out_0000.png, out_0001.png...
+            char number[16];
+            std::snprintf(number, sizeof(number), "_%04u", frame);
+            std::filesystem::path path = headless.output;
+            path.replace_filename(headless.output.stem().string() + number + headless.output.extension().string());
+            mRenderer.captureFrame(path);
+        }
+        mRenderer.onFrame();
     }
+    uint32_t savedCount = mRenderer.finishCaptures();
+    std::cout << "Saved " << savedCount << " of " << frameCount << " frames" << std::endl;
+    mRenderer.terminate();
+    return savedCount == frameCount;
+}
+
+// rebuild the planet and upload it in the existing pipeline
+void Engine::generatePlanet(GUISettings const& settings) {
+    mRenderer.beginPlanetUpdate();
+    mPlanetGenerator.setShadowMapSize(mRenderer.getShadowMapSize());
+    mPlanetGenerator.generatePlanetData(mVertexData, mIndices, settings);
+
+    StageTimer uploadTimer;
+    mRenderer.setTerrainBounds(mPlanetGenerator.getBounds());
+    mRenderer.setTerrainClusters(mPlanetGenerator.getClusters());
+    mRenderer.setShadowIndices(mPlanetGenerator.getShadowIndices());
+    mRenderer.setShadowLevels(mPlanetGenerator.getShadowLevels());
+    // only the full cube grid can be drawn without the index buffer
+    mRenderer.setPlanetData(mVertexData, mIndices, mPlanetGenerator.getGridResolution());
+    mPlanetGenerator.setUploadTime(uploadTimer.elapsedMs());
+    mRenderer.setGenerationStats(mPlanetGenerator.getStats());
+
+    // update the view matrix to match the current camera position
+    updateViewMatrix();
+}
 
+void Engine::onFrame() {
+    // if the settings changed, rebuild the planet
+    GUISettings settings = mRenderer.getGUISettings();
+    if (settings.planetSettingsChanged) {
+        generatePlanet(settings);
+    }
+
+    // as late as possible before the inputs are read, for the lowest latency
+    mRenderer.waitForNextFrame();
     glfwPollEvents();
+    if (mSculpting) {
+        sculptUnderCursor(settings);
+    }
     updateDragInertia();
     mRenderer.onFrame();
 }
@@ -132,6 +191,7 @@ void Engine::onMouseMove(double xpos, double ypos) {
         // Clamp to avoid going too far when orbitting up/down
         mCameraState.angles.y = glm::clamp(mCameraState.angles.y, -PI / 2 + 1e-5f, PI / 2 - 1e-5f);
         updateViewMatrix();
+        mRenderer.markInput();
 
         // Inertia
         mDragState.velocity = delta - mDragState.previousDelta;
@@ -141,6 +201,10 @@ void Engine::onMouseMove(double xpos, double ypos) {
 }
 
 void Engine::onMouseButton(int button, int action, [[maybe_unused]] int modifiers) {
+    // stop sculpting even if the button is released above the GUI
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE) {
+        mSculpting = false;
+    }
     ImGuiIO& io = ImGui::GetIO();
     if (io.WantCaptureMouse) {
         // Don't rotate the camera if the mouse is already captured by an ImGui
@@ -148,7 +212,14 @@ void Engine::onMouseButton(int button, int action, [[maybe_unused]] int modifier
         return;
     }
 
-    if (button == GLFW_MOUSE_BUTTON_LEFT) {
+    // with a brush selected, the left button sculpts and the right one orbits the camera
+    bool brushActive = mRenderer.getGUISettings().brushMode != BrushMode::Off;
+    if (button == GLFW_MOUSE_BUTTON_LEFT && brushActive) {
+        mSculpting = action == GLFW_PRESS;
+        return;
+    }
+
+    if (button == (brushActive ? GLFW_MOUSE_BUTTON_RIGHT : GLFW_MOUSE_BUTTON_LEFT)) {
         switch (action) {
             case GLFW_PRESS:
                 mDragState.active = true;
@@ -168,6 +239,34 @@ void Engine::onScroll([[maybe_unused]] double xoffset, double yoffset) {
     mCameraState.zoom += mDragState.scrollSensitivity * (float)yoffset;
     mCameraState.zoom = glm::clamp(mCameraState.zoom, -4.0f, 2.0f);
     updateViewMatrix();
+    mRenderer.markInput();
+}
+
+// apply the brush where the cursor hits the terrain, and only upload the vertices that moved
+void Engine::sculptUnderCursor(GUISettings const& settings) {
+    if (settings.brushMode == BrushMode::Off) {
+        mSculpting = false;
+        return;
+    }
+    double xpos, ypos;
+    glfwGetCursorPos(mWindow, &xpos, &ypos);
+    int width, height;
+    glfwGetWindowSize(mWindow, &width, &height);
+    glm::vec2 ndc = glm::vec2(2.0f * (float)xpos / (float)width - 1.0f, 1.0f - 2.0f * (float)ypos / (float)height);
+
+    glm::vec3 origin, direction, hit;
+    mRenderer.getCameraRay(ndc, origin, direction);
+    if (!mPlanetGenerator.raycast(mVertexData, origin, direction, hit)) return;
+
+    std::vector<VertexRange> dirtyRanges;
+    if (mPlanetGenerator.sculpt(mVertexData, mIndices, glm::normalize(hit), settings, dirtyRanges)) {
+        mRenderer.updatePlanetVertices(mVertexData, dirtyRanges);
+        mRenderer.setTerrainBounds(mPlanetGenerator.getBounds());
+        mRenderer.setTerrainClusters(mPlanetGenerator.getClusters());
+        mRenderer.updateShadowIndices(mPlanetGenerator.getShadowIndices());
+        mRenderer.setShadowLevels(mPlanetGenerator.getShadowLevels());
+        mRenderer.setGenerationStats(mPlanetGenerator.getStats());
+    }
 }
 
 void Engine::updateViewMatrix() {
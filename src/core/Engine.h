@@ -31,6 +31,8 @@
 #include "core/Renderer.h"
 #include "procgen/PlanetGenerator.h"
 
+#include <filesystem>
+
 // Forward declare
 struct GLFWwindow;
 
@@ -43,6 +45,25 @@ class Engine {
     // A function called only once at the beginning. Returns false is init failed.
     bool onInit();
 
+    /**
+     * What renderHeadless draws: the planet with the default settings, seen from
+     * the camera (in the units of CameraState), at the given size
+     * with several frames, the camera turns around the planet and each one gets its file
+     */
+    struct HeadlessSettings {
+        std::filesystem::path output;
+        uint32_t width = 512;
+        uint32_t height = 512;
+        glm::vec2 angles = {0.0f, 0.0f};
+        float zoom = -4.0f;
+        unsigned int frames = 1;
+        // the software adapter of the backend, for the machines without a GPU
+        bool softwareAdapter = false;
+    };
+
+    // Instead of onInit and the frames: no window, the frames saved as PNG. Returns false if one failed.
+    bool renderHeadless(HeadlessSettings const& settings);
+
     // A function called at each frame, guaranteed never to be called before `onInit`.
     void onFrame();
 
@@ -61,8 +82,10 @@ class Engine {
     void onScroll(double xoffset, double yoffset);
 
    private:
+    void generatePlanet(GUISettings const& settings);
     void updateViewMatrix();
     void updateDragInertia();
+    void sculptUnderCursor(GUISettings const& settings);
 
     void initGui();                                      // called in onInit
     void updateGui(wgpu::RenderPassEncoder renderPass);  // called in onFrame
@@ -113,4 +136,9 @@ class Engine {
     DragState mDragState;
 
     PlanetGenerator mPlanetGenerator;
+    // kept on the CPU side for the sculpting
+    std::vector<VertexAttributes> mVertexData;
+    std::vector<uint32_t> mIndices;
+    // whether the left button is held with a brush selected
+    bool mSculpting = false;
 };
\ No newline at end of file
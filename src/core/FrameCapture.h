@@ -0,0 +1,198 @@
+#pragma once
+
+#include "resource/ResourceManager.h"
+
+#include <webgpu/webgpu.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Frames of a texture saved as PNG files, without stalling the rendering on each of them
+// a capture is copied in the next buffer of a ring, by the command encoder of its frame, and mapped once the GPU is
+// done with it: the next frames keep rendering meanwhile, and the ring only waits for a buffer when it is full
+// the mapped pixels are packed and handed to worker threads which encode and write the files
+// (the map callbacks are called by the polls of the device, on the rendering thread)
+class FrameCapture {
+   public:
+    static constexpr unsigned int DEFAULT_RING_SIZE = 4;
+    // files waiting for a worker per worker, more and the captures wait for them
+    static constexpr unsigned int MAX_QUEUED_FILES_PER_WORKER = 2;
+
+    // the texture must have the CopySrc usage, in a 4 bytes per texel format
+    void init(wgpu::Device device, wgpu::Texture texture, uint32_t width, uint32_t height, unsigned int ringSize, unsigned int workerCount) {
+        mTexture = texture;
+        mWidth = width;
+        mHeight = height;
+        // the rows of a copy from a texture to a buffer are aligned on 256 bytes
+        mBytesPerRow = (4 * width + 255) / 256 * 256;
+
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "Capture readback";
+        bufferDesc.size = bufferSize();
+        bufferDesc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+        bufferDesc.mappedAtCreation = false;
+        mSlots = std::vector<Slot>(std::max(ringSize, 1u));
+        for (Slot& slot : mSlots) {
+            slot.buffer = device.createBuffer(bufferDesc);
+        }
+
+        mMaxQueuedFiles = MAX_QUEUED_FILES_PER_WORKER * std::max(workerCount, 1u);
+        mStopping = false;
+        for (unsigned int i = 0; i < std::max(workerCount, 1u); i++) {
+            mWorkers.emplace_back([this]() { writeFiles(); });
+        }
+    }
+
+    // before the copy: the next buffer of the ring has been mapped, and the workers are not too far behind
+    void waitForSlot(std::function<void()> const& pollDevice) {
+        while (mSlots[mNext].pending || queuedFileCount() >= mMaxQueuedFiles) {
+            pollDevice();
+            std::this_thread::yield();
+        }
+    }
+
+    // copy the texture in the next buffer, after the passes of the frame that draw it
+    void copy(wgpu::CommandEncoder encoder, std::filesystem::path const& path) {
+        Slot& slot = mSlots[mNext];
+        wgpu::ImageCopyTexture source;
+        source.texture = mTexture;
+        source.mipLevel = 0;
+        source.origin = {0, 0, 0};
+        source.aspect = wgpu::TextureAspect::All;
+        wgpu::ImageCopyBuffer destination;
+        destination.buffer = slot.buffer;
+        destination.layout.offset = 0;
+        destination.layout.bytesPerRow = mBytesPerRow;
+        destination.layout.rowsPerImage = mHeight;
+        encoder.copyTextureToBuffer(source, destination, {mWidth, mHeight, 1});
+        slot.path = path;
+        slot.copied = true;
+    }
+
+    // after the submit: map the buffer copied by this frame, its pixels go to the workers once the GPU is done with it
+    void readback() {
+        Slot& slot = mSlots[mNext];
+        if (!slot.copied) return;
+        slot.copied = false;
+        slot.pending = true;
+        mNext = (mNext + 1) % (unsigned int)mSlots.size();
+        slot.mapCallback = slot.buffer.mapAsync(wgpu::MapMode::Read, 0, bufferSize(), [this, &slot](wgpu::BufferMapAsyncStatus status) {
+            if (status == wgpu::BufferMapAsyncStatus::Success) {
+                // packed rows, so that the buffer is given back to the ring right away
+                File file{slot.path, std::vector<uint8_t>((size_t)4 * mWidth * mHeight)};
+                uint8_t const* data = static_cast<uint8_t const*>(slot.buffer.getConstMappedRange(0, bufferSize()));
+                for (uint32_t row = 0; row < mHeight; row++) {
+                    std::memcpy(&file.pixels[(size_t)4 * mWidth * row], data + (size_t)mBytesPerRow * row, (size_t)4 * mWidth);
+                }
+                slot.buffer.unmap();
+                {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    mFiles.push_back(std::move(file));
+                }
+                mFilesChanged.notify_one();
+            } else {
+                std::cerr << "Could not map the capture of " << slot.path << std::endl;
+                mFailedCount++;
+            }
+            slot.pending = false;
+        });
+    }
+
+    // wait for all the captures to be mapped and written, then stop the workers
+    void finish(std::function<void()> const& pollDevice) {
+        for (Slot& slot : mSlots) {
+            while (slot.pending) {
+                pollDevice();
+                std::this_thread::yield();
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mFilesChanged.notify_all();
+        for (std::thread& worker : mWorkers) {
+            worker.join();
+        }
+        mWorkers.clear();
+    }
+
+    // after finish
+    void release() {
+        for (Slot& slot : mSlots) {
+            slot.mapCallback.reset();
+            slot.buffer.destroy();
+            slot.buffer.release();
+        }
+        mSlots.clear();
+    }
+
+    uint32_t getSavedCount() const { return mSavedCount; }
+    uint32_t getFailedCount() const { return mFailedCount; }
+
+   private:
+    struct Slot {
+        wgpu::Buffer buffer = nullptr;
+        std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+        std::filesystem::path path;
+        bool copied = false;   // by the frame being recorded
+        bool pending = false;  // until it is mapped and read
+    };
+
+    struct File {
+        std::filesystem::path path;
+        std::vector<uint8_t> pixels;
+    };
+
+    uint64_t bufferSize() const { return (uint64_t)mBytesPerRow * mHeight; }
+
+    size_t queuedFileCount() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mFiles.size();
+    }
+
+    // the loop of a worker, until it is stopped and there is nothing left to write
+    void writeFiles() {
+        while (true) {
+            File file;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mFilesChanged.wait(lock, [this]() { return mStopping || !mFiles.empty(); });
+                if (mFiles.empty()) return;
+                file = std::move(mFiles.front());
+                mFiles.pop_front();
+            }
+            if (ResourceManager::writePng(file.path, mWidth, mHeight, file.pixels.data())) {
+                mSavedCount++;
+            } else {
+                mFailedCount++;
+            }
+        }
+    }
+
+    wgpu::Texture mTexture = nullptr;
+    uint32_t mWidth = 0;
+    uint32_t mHeight = 0;
+    uint32_t mBytesPerRow = 0;
+    std::vector<Slot> mSlots;
+    unsigned int mNext = 0;
+
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mFilesChanged;
+    std::deque<File> mFiles;  // mapped, waiting for a worker
+    bool mStopping = false;
+    size_t mMaxQueuedFiles = 0;
+    std::atomic<uint32_t> mSavedCount{0};
+    std::atomic<uint32_t> mFailedCount{0};
+};
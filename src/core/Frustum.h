@@ -0,0 +1,111 @@
+#pragma once
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_LEFT_HANDED
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cmath>
+
+// The 6 planes of a view frustum, pointing inside, extracted from a view projection matrix
+// (Gribb & Hartmann, with the 0 to 1 depth range of WebGPU)
+struct Frustum {
+    std::array<glm::vec4, 6> planes;
+
+    explicit Frustum(glm::mat4x4 const& viewProjection) {
+        glm::mat4x4 m = glm::transpose(viewProjection);
+        planes[0] = m[3] + m[0];  // left
+        planes[1] = m[3] - m[0];  // right
+        planes[2] = m[3] + m[1];  // bottom
+        planes[3] = m[3] - m[1];  // top
+        planes[4] = m[2];         // near
+        planes[5] = m[3] - m[2];  // far
+        for (auto& plane : planes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+    }
+
+    // test the corner of the box the furthest along each plane normal
+    bool intersectsBox(glm::vec3 min, glm::vec3 max) const {
+        for (auto const& plane : planes) {
+            glm::vec3 corner = glm::vec3(
+                plane.x >= 0.0f ? max.x : min.x,
+                plane.y >= 0.0f ? max.y : min.y,
+                plane.z >= 0.0f ? max.z : min.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) return false;
+        }
+        return true;
+    }
+
+    bool intersectsSphere(glm::vec3 center, float radius) const {
+        for (auto const& plane : planes) {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) return false;
+        }
+        return true;
+    }
+};
+
+// A sphere centered on the origin that hides what is behind it, seen from the camera
+// the planet with its lowest terrain radius: nothing of the terrain is inside of it
+struct HorizonOccluder {
+    glm::vec3 cameraPosition;
+    float cameraDistance;
+    // half angle of the cone from the camera tangent to the occluder
+    float coneAngle;
+    // distance from the camera to the horizon, where the cone touches the occluder
+    float horizonDistance;
+    bool active;
+
+    HorizonOccluder(glm::vec3 camera, float radius) {
+        cameraPosition = camera;
+        cameraDistance = glm::length(camera);
+        active = radius > 0.0f && cameraDistance > radius;
+        coneAngle = active ? std::asin(radius / cameraDistance) : 0.0f;
+        horizonDistance = active ? std::sqrt(cameraDistance * cameraDistance - radius * radius) : 0.0f;
+    }
+
+    // true if the sphere is entirely inside the cone and further than the horizon:
+    // every ray from the camera to it goes through the occluder first
+    bool hides(glm::vec3 center, float radius) const {
+        if (!active) return false;
+        glm::vec3 toCenter = center - cameraPosition;
+        float distance = glm::length(toCenter);
+        if (distance - radius < horizonDistance) return false;
+        // angle between the direction of the sphere and the direction of the planet center,
+        // plus the angle the sphere covers, must stay in the cone
+        float cosAngle = -glm::dot(toCenter, cameraPosition) / (distance * cameraDistance);
+        float angle = std::acos(glm::clamp(cosAngle, -1.0f, 1.0f)) + std::asin(radius / distance);
+        return angle <= coneAngle;
+    }
+};
+
+// Rectangle of the screen covered by a sphere, in normalized device coordinates (y up)
+// on each axis, from the 2 planes through the camera tangent to the sphere (Mara & McGuire): exact for a
+// perspective projection, and the whole screen when the sphere crosses the near plane
+struct SphereScreenBounds {
+    glm::vec2 min = glm::vec2(-1.0f);
+    glm::vec2 max = glm::vec2(1.0f);
+    bool visible = true;
+
+    SphereScreenBounds(glm::mat4x4 const& view, glm::mat4x4 const& projection, glm::vec3 center, float radius) {
+        glm::vec3 c = glm::vec3(view * glm::vec4(center, 1.0f));
+        // distance of the near plane, from the 0 to 1 depth of the projection
+        float near = -projection[3][2] / projection[2][2];
+        if (c.z + radius <= near) {
+            visible = false;
+            return;
+        }
+        if (c.z - radius <= near) return;
+
+        // slopes x/z (then y/z) of the 2 tangent planes, the roots of a quadratic
+        float denominator = c.z * c.z - radius * radius;
+        for (int axis = 0; axis < 2; axis++) {
+            float offset = radius * std::sqrt(c[axis] * c[axis] + denominator);
+            float low = (c[axis] * c.z - offset) / denominator;
+            float high = (c[axis] * c.z + offset) / denominator;
+            min[axis] = glm::clamp(projection[axis][axis] * low + projection[2][axis], -1.0f, 1.0f);
+            max[axis] = glm::clamp(projection[axis][axis] * high + projection[2][axis], -1.0f, 1.0f);
+        }
+        visible = min.x < max.x && min.y < max.y;
+    }
+};
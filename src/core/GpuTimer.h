@@ -0,0 +1,213 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// GPU duration of a few kinds of passes, from timestamp queries written at their beginning and at their end
+// the timestamps are read back a few frames later without waiting for the GPU: each frame in flight has its
+// own range of queries and its own readback buffer, a frame is not measured while its buffer is still mapped
+// a kind of pass can be measured several times in a frame (a pass per shadow cascade), the durations are summed
+// (the timestamps are taken as nanoseconds)
+class GpuTimer {
+   public:
+    static constexpr unsigned int FRAME_COUNT = 3;
+    // measured passes per frame, the next ones are not measured
+    static constexpr unsigned int MAX_MEASURES = 16;
+    // weight of the previous durations in the smoothed ones
+    static constexpr double SMOOTHING = 0.9;
+    // frames kept for the graphs and the CSV export
+    static constexpr unsigned int HISTORY_SIZE = 240;
+
+    // does nothing if the device doesn't have the timestamp queries
+    void init(wgpu::Device device, uint32_t passCount) {
+        mPassCount = passCount;
+        mPassMs.assign(passCount, -1.0);
+        mHistory.assign(passCount, std::vector<float>(HISTORY_SIZE, 0.0f));
+        mHistoryFrames.assign(HISTORY_SIZE, 0);
+        mWrites.assign(2 * MAX_MEASURES, {});
+        if (!device.hasFeature(wgpu::FeatureName::TimestampQuery)) return;
+
+        wgpu::QuerySetDescriptor querySetDesc;
+        querySetDesc.label = "Timestamps";
+        querySetDesc.type = wgpu::QueryType::Timestamp;
+        querySetDesc.count = 2 * MAX_MEASURES * FRAME_COUNT;
+        mQuerySet = device.createQuerySet(querySetDesc);
+
+        // the queries of a frame are resolved at an offset aligned on 256 bytes
+        mFrameStride = (frameSize() + 255) / 256 * 256;
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "Timestamps resolve";
+        bufferDesc.size = mFrameStride * FRAME_COUNT;
+        bufferDesc.usage = wgpu::BufferUsage::QueryResolve | wgpu::BufferUsage::CopySrc;
+        bufferDesc.mappedAtCreation = false;
+        mResolveBuffer = device.createBuffer(bufferDesc);
+
+        bufferDesc.label = "Timestamps readback";
+        bufferDesc.size = frameSize();
+        bufferDesc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+        for (Frame& frame : mFrames) {
+            frame.readbackBuffer = device.createBuffer(bufferDesc);
+        }
+    }
+
+    // destroying a buffer aborts its pending map, whose callback is only freed once the polls have called it
+    void release(std::function<void()> const& pollDevice) {
+        if (mQuerySet == nullptr) return;
+        for (Frame& frame : mFrames) {
+            frame.readbackBuffer.destroy();
+        }
+        for (Frame& frame : mFrames) {
+            while (frame.pending) {
+                pollDevice();
+            }
+            frame.mapCallback.reset();
+            frame.readbackBuffer.release();
+        }
+        mResolveBuffer.destroy();
+        mResolveBuffer.release();
+        mQuerySet.destroy();
+        mQuerySet.release();
+        mQuerySet = nullptr;
+    }
+
+    // the adapter has the timestamp queries
+    bool isAvailable() const { return mQuerySet != nullptr; }
+    // and they are written, the passes are only measured then
+    bool isEnabled() const { return isAvailable() && mEnabled; }
+    void setEnabled(bool enabled) { mEnabled = enabled; }
+
+    // start a new frame, false if it can't be measured (disabled, or its readback is still pending)
+    bool beginFrame() {
+        mFrameNumber++;
+        mFrame = (mFrame + 1) % FRAME_COUNT;
+        mMeasuring = isEnabled() && !mFrames[mFrame].pending;
+        if (mMeasuring) mFrames[mFrame].measures.clear();
+        return mMeasuring;
+    }
+
+    // give the timestamp writes of a pass to its descriptor, nothing if the frame isn't measured
+    // (the writes are kept by the timer until the pass begins)
+    void measurePass(wgpu::RenderPassDescriptor& passDesc, uint32_t pass) {
+        if (!mMeasuring) return;
+        std::vector<uint32_t>& measures = mFrames[mFrame].measures;
+        if (measures.size() == MAX_MEASURES) return;
+        uint32_t measure = (uint32_t)measures.size();
+        uint32_t first = queryIndex(measure);
+        wgpu::RenderPassTimestampWrite* writes = &mWrites[2 * measure];
+        writes[0].querySet = mQuerySet;
+        writes[0].queryIndex = first;
+        writes[0].location = wgpu::RenderPassTimestampLocation::Beginning;
+        writes[1].querySet = mQuerySet;
+        writes[1].queryIndex = first + 1;
+        writes[1].location = wgpu::RenderPassTimestampLocation::End;
+        passDesc.timestampWriteCount = 2;
+        passDesc.timestampWrites = (WGPURenderPassTimestampWrite const*)writes;
+        measures.push_back(pass);
+    }
+
+    // after the last measured pass, copy the timestamps of the frame to its readback buffer
+    void resolve(wgpu::CommandEncoder encoder) {
+        if (!mMeasuring || mFrames[mFrame].measures.empty()) return;
+        uint32_t queryCount = 2 * (uint32_t)mFrames[mFrame].measures.size();
+        uint64_t offset = mFrameStride * mFrame;
+        encoder.resolveQuerySet(mQuerySet, queryIndex(0), queryCount, mResolveBuffer, offset);
+        encoder.copyBufferToBuffer(mResolveBuffer, offset, mFrames[mFrame].readbackBuffer, 0, queryCount * sizeof(uint64_t));
+    }
+
+    // after the submit: the durations are updated once the GPU is done with the frame
+    void readback() {
+        if (!mMeasuring || mFrames[mFrame].measures.empty()) return;
+        Frame& frame = mFrames[mFrame];
+        frame.pending = true;
+        uint64_t frameNumber = mFrameNumber;
+        size_t size = 2 * frame.measures.size() * sizeof(uint64_t);
+        frame.mapCallback = frame.readbackBuffer.mapAsync(wgpu::MapMode::Read, 0, size, [this, &frame, frameNumber, size](wgpu::BufferMapAsyncStatus status) {
+            if (status == wgpu::BufferMapAsyncStatus::Success) {
+                std::vector<uint64_t> timestamps(2 * frame.measures.size());
+                std::memcpy(timestamps.data(), frame.readbackBuffer.getConstMappedRange(0, size), size);
+                frame.readbackBuffer.unmap();
+                addFrame(frameNumber, frame.measures, timestamps);
+            }
+            frame.pending = false;
+        });
+    }
+
+    // smoothed duration of a pass, negative until it is measured
+    double getPassMs(uint32_t pass) const { return mPassMs[pass]; }
+    // forget the durations of a pass, when what it does changes
+    void resetPass(uint32_t pass) { mPassMs[pass] = -1.0; }
+
+    // duration of a pass in the last HISTORY_SIZE measured frames, the oldest one at getHistoryOffset()
+    // (0 in the frames that didn't have the pass)
+    float const* getHistory(uint32_t pass) const { return mHistory[pass].data(); }
+    unsigned int getHistoryOffset() const { return mHistoryNext; }
+
+    // a line per measured frame, from the oldest one: the frame number then the duration of each pass in ms
+    void writeCsv(std::ostream& out, std::vector<std::string> const& passNames) const {
+        out << "frame";
+        for (std::string const& name : passNames) {
+            out << "," << name;
+        }
+        out << "\n";
+        for (unsigned int i = 0; i < HISTORY_SIZE; i++) {
+            unsigned int row = (mHistoryNext + i) % HISTORY_SIZE;
+            if (mHistoryFrames[row] == 0) continue;
+            out << mHistoryFrames[row];
+            for (uint32_t pass = 0; pass < mPassCount; pass++) {
+                out << "," << mHistory[pass][row];
+            }
+            out << "\n";
+        }
+    }
+
+   private:
+    struct Frame {
+        wgpu::Buffer readbackBuffer = nullptr;
+        std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+        bool pending = false;
+        std::vector<uint32_t> measures;  // the pass of each pair of queries
+    };
+
+    uint64_t frameSize() const { return 2 * MAX_MEASURES * sizeof(uint64_t); }
+    uint32_t queryIndex(uint32_t measure) const { return 2 * (mFrame * MAX_MEASURES + measure); }
+
+    void addFrame(uint64_t frameNumber, std::vector<uint32_t> const& measures, std::vector<uint64_t> const& timestamps) {
+        std::vector<double> frameMs(mPassCount, 0.0);
+        std::vector<bool> measured(mPassCount, false);
+        for (size_t i = 0; i < measures.size(); i++) {
+            if (timestamps[2 * i + 1] < timestamps[2 * i]) continue;
+            frameMs[measures[i]] += double(timestamps[2 * i + 1] - timestamps[2 * i]) * 1e-6;
+            measured[measures[i]] = true;
+        }
+        for (uint32_t pass = 0; pass < mPassCount; pass++) {
+            mHistory[pass][mHistoryNext] = (float)frameMs[pass];
+            if (!measured[pass]) continue;
+            mPassMs[pass] = mPassMs[pass] < 0.0 ? frameMs[pass] : SMOOTHING * mPassMs[pass] + (1.0 - SMOOTHING) * frameMs[pass];
+        }
+        mHistoryFrames[mHistoryNext] = frameNumber;
+        mHistoryNext = (mHistoryNext + 1) % HISTORY_SIZE;
+    }
+
+    wgpu::QuerySet mQuerySet = nullptr;
+    wgpu::Buffer mResolveBuffer = nullptr;
+    uint64_t mFrameStride = 0;
+    Frame mFrames[FRAME_COUNT];
+    uint32_t mPassCount = 0;
+    unsigned int mFrame = 0;
+    uint64_t mFrameNumber = 0;
+    bool mEnabled = true;
+    bool mMeasuring = false;
+    std::vector<wgpu::RenderPassTimestampWrite> mWrites;
+    std::vector<double> mPassMs;
+    // a ring of HISTORY_SIZE frames
+    std::vector<std::vector<float>> mHistory;
+    std::vector<uint64_t> mHistoryFrames;  // 0 for the rows not written yet
+    unsigned int mHistoryNext = 0;
+};
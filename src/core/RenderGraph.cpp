@@ -0,0 +1,424 @@
+#include "core/RenderGraph.h"
+
+using namespace wgpu;
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::clearColor(Resource texture, Color value) {
+    Attachment attachment{texture, Access::Clear};
+    attachment.clearColor = value;
+    mGraph.mPasses[mPass].colors.push_back(attachment);
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::writeColor(Resource texture) {
+    mGraph.mPasses[mPass].colors.push_back({texture, Access::Keep});
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::clearDepth(Resource texture, float value) {
+    Pass& pass = mGraph.mPasses[mPass];
+    pass.hasDepth = true;
+    pass.depth = {texture, Access::Clear};
+    pass.depth.clearDepth = value;
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::writeDepth(Resource texture) {
+    Pass& pass = mGraph.mPasses[mPass];
+    pass.hasDepth = true;
+    pass.depth = {texture, Access::Keep};
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::scratchDepth(Resource texture) {
+    Pass& pass = mGraph.mPasses[mPass];
+    pass.hasDepth = true;
+    pass.depth = {texture, Access::Scratch};
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(Resource texture) {
+    mGraph.mPasses[mPass].reads.push_back(texture);
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::measure(uint32_t timedPass) {
+    mGraph.mPasses[mPass].timedPass = (int)timedPass;
+    return *this;
+}
+
+void RenderGraph::reset() {
+    mPasses.clear();
+    mResources.clear();
+    mGroups.clear();
+    mCulledCount = 0;
+}
+
+RenderGraph::Resource RenderGraph::importTexture(std::string const& name, TextureView view, uint32_t width, uint32_t height, bool initialized, bool retained) {
+    ResourceInfo resource;
+    resource.name = name;
+    resource.view = view;
+    resource.width = width;
+    resource.height = height;
+    resource.initialized = initialized;
+    resource.retained = retained;
+    mResources.push_back(resource);
+    return (Resource)mResources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::createTexture(TextureDesc const& desc) {
+    ResourceInfo resource;
+    resource.name = desc.label;
+    resource.width = desc.width;
+    resource.height = desc.height;
+    resource.initialized = false;
+    resource.retained = false;
+    resource.transient = true;
+    resource.desc = desc;
+    mResources.push_back(resource);
+    return (Resource)mResources.size() - 1;
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(std::string const& name, Execute execute) {
+    Pass pass;
+    pass.name = name;
+    pass.execute = std::move(execute);
+    mPasses.push_back(std::move(pass));
+    return PassBuilder(*this, (uint32_t)mPasses.size() - 1);
+}
+
+void RenderGraph::compile(Device device, GpuTimer const& timer) {
+    cullPasses();
+    mergePasses(timer.isEnabled());
+    computeOps();
+    allocateTransients(device);
+}
+
+// from the last pass to the first, keeping track of the textures whose content is still needed
+// a pass is kept if it writes one of them: a retained texture, or one that a kept pass reads or draws over
+void RenderGraph::cullPasses() {
+    std::vector<bool> needed(mResources.size());
+    for (size_t i = 0; i < mResources.size(); i++) {
+        needed[i] = mResources[i].retained;
+    }
+
+    for (size_t i = mPasses.size(); i-- > 0;) {
+        Pass& pass = mPasses[i];
+        std::vector<Attachment> attachments = pass.colors;
+        if (pass.hasDepth) attachments.push_back(pass.depth);
+
+        pass.culled = true;
+        for (Attachment const& attachment : attachments) {
+            if (attachment.access != Access::Scratch && needed[attachment.texture]) pass.culled = false;
+        }
+        if (pass.culled) {
+            mCulledCount++;
+            continue;
+        }
+        for (Attachment const& attachment : attachments) {
+            if (attachment.access != Access::Scratch) needed[attachment.texture] = attachment.access == Access::Keep;
+        }
+        for (Resource texture : pass.reads) {
+            needed[texture] = true;
+        }
+    }
+}
+
+// the passes left, in order, each one merged with the previous render pass when it can be
+void RenderGraph::mergePasses(bool measuring) {
+    for (uint32_t i = 0; i < mPasses.size(); i++) {
+        Pass const& pass = mPasses[i];
+        if (pass.culled) continue;
+        if (!mGroups.empty() && canMerge(mGroups.back(), pass, measuring)) {
+            mGroups.back().passes.push_back(i);
+            mGroups.back().label += " + " + pass.name;
+        } else {
+            Group group;
+            group.passes.push_back(i);
+            group.label = pass.name;
+            mGroups.push_back(group);
+        }
+    }
+}
+
+// the same attachments, none of them cleared or sampled by the pass, and no GPU time to measure on its own
+bool RenderGraph::canMerge(Group const& group, Pass const& pass, bool measuring) const {
+    Pass const& first = mPasses[group.passes[0]];
+    if (measuring) {
+        if (pass.timedPass >= 0) return false;
+        for (uint32_t i : group.passes) {
+            if (mPasses[i].timedPass >= 0) return false;
+        }
+    }
+
+    if (pass.colors.size() != first.colors.size() || pass.hasDepth != first.hasDepth) return false;
+    std::vector<Resource> attachments;
+    for (size_t i = 0; i < pass.colors.size(); i++) {
+        if (pass.colors[i].texture != first.colors[i].texture || pass.colors[i].access == Access::Clear) return false;
+        attachments.push_back(pass.colors[i].texture);
+    }
+    if (pass.hasDepth) {
+        if (pass.depth.texture != first.depth.texture || pass.depth.access == Access::Clear) return false;
+        attachments.push_back(pass.depth.texture);
+    }
+    for (Resource texture : pass.reads) {
+        if (std::find(attachments.begin(), attachments.end(), texture) != attachments.end()) return false;
+    }
+    return true;
+}
+
+// the attachments of a render pass are the ones of its first pass:
+// - loaded if that pass draws over them and they have a content, cleared otherwise
+// - stored if a later render pass needs their content, or if they are retained
+void RenderGraph::computeOps() {
+    std::vector<bool> needed(mResources.size());
+    for (size_t i = 0; i < mResources.size(); i++) {
+        needed[i] = mResources[i].retained;
+    }
+    for (size_t g = mGroups.size(); g-- > 0;) {
+        Group& group = mGroups[g];
+        Pass const& first = mPasses[group.passes[0]];
+        group.colorStoreOps.clear();
+        for (Attachment const& attachment : first.colors) {
+            group.colorStoreOps.push_back(needed[attachment.texture] ? StoreOp::Store : StoreOp::Discard);
+        }
+        if (first.hasDepth) {
+            group.depthStoreOp = needed[first.depth.texture] ? StoreOp::Store : StoreOp::Discard;
+        }
+
+        for (size_t i = group.passes.size(); i-- > 0;) {
+            Pass const& pass = mPasses[group.passes[i]];
+            std::vector<Attachment> attachments = pass.colors;
+            if (pass.hasDepth) attachments.push_back(pass.depth);
+            for (Attachment const& attachment : attachments) {
+                if (attachment.access != Access::Scratch) needed[attachment.texture] = attachment.access == Access::Keep;
+            }
+            for (Resource texture : pass.reads) {
+                needed[texture] = true;
+            }
+        }
+    }
+
+    std::vector<bool> hasContent(mResources.size());
+    for (size_t i = 0; i < mResources.size(); i++) {
+        hasContent[i] = mResources[i].initialized;
+    }
+    auto loadOp = [&](Attachment const& attachment) {
+        return attachment.access == Access::Keep && hasContent[attachment.texture] ? LoadOp::Load : LoadOp::Clear;
+    };
+    for (Group& group : mGroups) {
+        Pass const& first = mPasses[group.passes[0]];
+        group.colorLoadOps.clear();
+        for (size_t i = 0; i < first.colors.size(); i++) {
+            group.colorLoadOps.push_back(loadOp(first.colors[i]));
+            hasContent[first.colors[i].texture] = group.colorStoreOps[i] == StoreOp::Store;
+        }
+        if (first.hasDepth) {
+            group.depthLoadOp = loadOp(first.depth);
+            hasContent[first.depth.texture] = group.depthStoreOp == StoreOp::Store;
+        }
+    }
+}
+
+// each transient texture is taken from the pool for the render passes between its first and its last use,
+// then given back: the next transient textures with the same description can use it again
+// the textures of the pool that the frame doesn't use are destroyed
+void RenderGraph::allocateTransients(Device device) {
+    std::vector<int> firstUse(mResources.size(), -1);
+    std::vector<int> lastUse(mResources.size(), -1);
+    for (size_t g = 0; g < mGroups.size(); g++) {
+        for (uint32_t i : mGroups[g].passes) {
+            Pass const& pass = mPasses[i];
+            std::vector<Resource> textures = pass.reads;
+            for (Attachment const& attachment : pass.colors) textures.push_back(attachment.texture);
+            if (pass.hasDepth) textures.push_back(pass.depth.texture);
+            for (Resource texture : textures) {
+                if (firstUse[texture] < 0) firstUse[texture] = (int)g;
+                lastUse[texture] = (int)g;
+            }
+        }
+    }
+
+    for (PoolEntry& entry : mPool) {
+        entry.used = false;
+    }
+    std::vector<bool> taken(mPool.size(), false);
+    for (size_t g = 0; g < mGroups.size(); g++) {
+        for (size_t r = 0; r < mResources.size(); r++) {
+            ResourceInfo& resource = mResources[r];
+            if (!resource.transient || firstUse[r] != (int)g) continue;
+            resource.poolEntry = acquirePoolEntry(device, resource.desc, taken);
+            taken.resize(mPool.size(), false);
+            taken[resource.poolEntry] = true;
+            mPool[resource.poolEntry].used = true;
+            resource.view = mPool[resource.poolEntry].view;
+        }
+        for (size_t r = 0; r < mResources.size(); r++) {
+            ResourceInfo const& resource = mResources[r];
+            if (resource.transient && lastUse[r] == (int)g) taken[resource.poolEntry] = false;
+        }
+    }
+
+    std::vector<int> remap(mPool.size(), -1);
+    std::vector<PoolEntry> pool;
+    for (size_t i = 0; i < mPool.size(); i++) {
+        PoolEntry& entry = mPool[i];
+        if (entry.used) {
+            remap[i] = (int)pool.size();
+            pool.push_back(entry);
+            continue;
+        }
+        entry.view.release();
+        entry.texture.destroy();
+        entry.texture.release();
+        mPoolVersion++;
+    }
+    mPool = pool;
+    for (ResourceInfo& resource : mResources) {
+        if (resource.poolEntry >= 0) resource.poolEntry = remap[resource.poolEntry];
+    }
+}
+
+int RenderGraph::acquirePoolEntry(Device device, TextureDesc const& desc, std::vector<bool> const& taken) {
+    for (size_t i = 0; i < mPool.size(); i++) {
+        TextureDesc const& other = mPool[i].desc;
+        if (!taken[i] && other.width == desc.width && other.height == desc.height && other.format == desc.format && other.usage == desc.usage) {
+            return (int)i;
+        }
+    }
+
+    PoolEntry entry;
+    entry.desc = desc;
+    TextureDescriptor textureDesc;
+    textureDesc.label = desc.label;
+    textureDesc.dimension = TextureDimension::_2D;
+    textureDesc.format = desc.format;
+    textureDesc.mipLevelCount = 1;
+    textureDesc.sampleCount = 1;
+    textureDesc.size = {desc.width, desc.height, 1};
+    textureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding | desc.usage;
+    textureDesc.viewFormatCount = 1;
+    textureDesc.viewFormats = (WGPUTextureFormat*)&entry.desc.format;
+    entry.texture = device.createTexture(textureDesc);
+
+    TextureViewDescriptor textureViewDesc;
+    textureViewDesc.aspect = TextureAspect::All;
+    textureViewDesc.baseArrayLayer = 0;
+    textureViewDesc.arrayLayerCount = 1;
+    textureViewDesc.baseMipLevel = 0;
+    textureViewDesc.mipLevelCount = 1;
+    textureViewDesc.dimension = TextureViewDimension::_2D;
+    textureViewDesc.format = desc.format;
+    entry.view = entry.texture.createView(textureViewDesc);
+
+    mPool.push_back(entry);
+    mPoolVersion++;
+    return (int)mPool.size() - 1;
+}
+
+void RenderGraph::execute(CommandEncoder encoder, GpuTimer& timer) {
+    for (Group const& group : mGroups) {
+        Pass const& first = mPasses[group.passes[0]];
+
+        std::vector<RenderPassColorAttachment> colorAttachments(first.colors.size());
+        for (size_t i = 0; i < first.colors.size(); i++) {
+            RenderPassColorAttachment& colorAttachment = colorAttachments[i];
+            colorAttachment = {};
+            colorAttachment.view = mResources[first.colors[i].texture].view;
+            colorAttachment.resolveTarget = nullptr;
+            colorAttachment.loadOp = group.colorLoadOps[i];
+            colorAttachment.storeOp = group.colorStoreOps[i];
+            colorAttachment.clearValue = first.colors[i].clearColor;
+        }
+
+        RenderPassDepthStencilAttachment depthStencilAttachment;
+        if (first.hasDepth) {
+            depthStencilAttachment.view = mResources[first.depth.texture].view;
+            depthStencilAttachment.depthClearValue = first.depth.clearDepth;
+            depthStencilAttachment.depthLoadOp = group.depthLoadOp;
+            depthStencilAttachment.depthStoreOp = group.depthStoreOp;
+            depthStencilAttachment.depthReadOnly = false;
+            depthStencilAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+            depthStencilAttachment.stencilLoadOp = LoadOp::Clear;
+            depthStencilAttachment.stencilStoreOp = StoreOp::Store;
+#else
+            depthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
+            depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
+#endif
+            depthStencilAttachment.stencilReadOnly = false;
+        }
+
+        RenderPassDescriptor renderPassDesc{};
+        renderPassDesc.label = group.label.c_str();
+        renderPassDesc.colorAttachmentCount = (uint32_t)colorAttachments.size();
+        renderPassDesc.colorAttachments = colorAttachments.data();
+        renderPassDesc.depthStencilAttachment = first.hasDepth ? &depthStencilAttachment : nullptr;
+        renderPassDesc.timestampWriteCount = 0;
+        renderPassDesc.timestampWrites = nullptr;
+        if (group.passes.size() == 1 && first.timedPass >= 0) {
+            timer.measurePass(renderPassDesc, (uint32_t)first.timedPass);
+        }
+        RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+
+        // the viewport and the scissor a pass leaves must not leak in the next one
+        ResourceInfo const& target = mResources[first.colors.empty() ? first.depth.texture : first.colors[0].texture];
+        for (size_t i = 0; i < group.passes.size(); i++) {
+            if (i > 0) {
+                renderPass.setViewport(0.0f, 0.0f, (float)target.width, (float)target.height, 0.0f, 1.0f);
+                renderPass.setScissorRect(0, 0, target.width, target.height);
+            }
+            mPasses[group.passes[i]].execute(renderPass);
+        }
+        renderPass.end();
+    }
+}
+
+void RenderGraph::printSchedule(std::ostream& out) const {
+    auto loadName = [](LoadOp op) { return op == LoadOp::Load ? "load" : "clear"; };
+    auto storeName = [](StoreOp op) { return op == StoreOp::Store ? "store" : "discard"; };
+
+    out << "Render graph: " << mPasses.size() << " passes in " << mGroups.size() << " render passes, "
+        << mCulledCount << " culled" << std::endl;
+    for (size_t g = 0; g < mGroups.size(); g++) {
+        Group const& group = mGroups[g];
+        Pass const& first = mPasses[group.passes[0]];
+        out << "  [" << g << "] " << group.label << std::endl;
+        for (size_t i = 0; i < first.colors.size(); i++) {
+            out << "      color " << mResources[first.colors[i].texture].name << ": "
+                << loadName(group.colorLoadOps[i]) << " / " << storeName(group.colorStoreOps[i]) << std::endl;
+        }
+        if (first.hasDepth) {
+            out << "      depth " << mResources[first.depth.texture].name << ": "
+                << loadName(group.depthLoadOp) << " / " << storeName(group.depthStoreOp) << std::endl;
+        }
+        for (uint32_t i : group.passes) {
+            for (Resource texture : mPasses[i].reads) {
+                out << "      reads " << mResources[texture].name << std::endl;
+            }
+        }
+    }
+    for (Pass const& pass : mPasses) {
+        if (pass.culled) out << "  culled: " << pass.name << std::endl;
+    }
+    for (ResourceInfo const& resource : mResources) {
+        if (!resource.transient) continue;
+        out << "  transient " << resource.name << " " << resource.width << "x" << resource.height;
+        if (resource.poolEntry >= 0) {
+            out << ": pool texture #" << resource.poolEntry << std::endl;
+        } else {
+            out << ": unused" << std::endl;
+        }
+    }
+    out << "  pool: " << mPool.size() << " textures" << std::endl;
+}
+
+void RenderGraph::release() {
+    for (PoolEntry& entry : mPool) {
+        entry.view.release();
+        entry.texture.destroy();
+        entry.texture.release();
+    }
+    mPool.clear();
+    mPoolVersion++;
+    reset();
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "core/GpuTimer.h"
+
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The render passes of a frame, declared with the textures they read and write
+// it is built again every frame (reset, import the textures, add the passes), then compile() works out:
+// - the passes that can be dropped: nothing after them uses what they write
+// - the passes that can be merged in a single render pass: same attachments, no clear, nothing sampled
+// - the load and store ops of the attachments: load only what has content, store only what is used later
+// - the transient textures: taken from a pool, the ones that are never used at the same time share a texture
+// and execute() records the render passes
+class RenderGraph {
+   public:
+    using Resource = uint32_t;
+    using Execute = std::function<void(wgpu::RenderPassEncoder)>;
+
+    struct TextureDesc {
+        char const* label;
+        uint32_t width;
+        uint32_t height;
+        wgpu::TextureFormat format;
+        // on top of RenderAttachment and TextureBinding
+        WGPUTextureUsageFlags usage = wgpu::TextureUsage::None;
+    };
+
+    // what a pass declares, chained after addPass
+    class PassBuilder {
+       public:
+        // a color attachment cleared by the pass, or kept and drawn over
+        PassBuilder& clearColor(Resource texture, wgpu::Color value);
+        PassBuilder& writeColor(Resource texture);
+        // same for the depth attachment
+        PassBuilder& clearDepth(Resource texture, float value);
+        PassBuilder& writeDepth(Resource texture);
+        // a depth attachment the pipelines need but whose content the pass doesn't care about
+        PassBuilder& scratchDepth(Resource texture);
+        // a texture sampled by the pass
+        PassBuilder& read(Resource texture);
+        // GPU time of the pass, in its GpuTimer slot (not merged while the timer is enabled)
+        PassBuilder& measure(uint32_t timedPass);
+
+       private:
+        friend class RenderGraph;
+        PassBuilder(RenderGraph& graph, uint32_t pass) : mGraph(graph), mPass(pass) {}
+        RenderGraph& mGraph;
+        uint32_t mPass;
+    };
+
+    // start the graph of a new frame, the pool keeps its textures
+    void reset();
+
+    // a texture owned by someone else, with its content at the start of the frame or not
+    // and that must be kept after the frame or not (presented, or used again by the next frames)
+    Resource importTexture(std::string const& name, wgpu::TextureView view, uint32_t width, uint32_t height, bool initialized, bool retained);
+    // a texture that only lives during the frame, from the pool
+    Resource createTexture(TextureDesc const& desc);
+
+    PassBuilder addPass(std::string const& name, Execute execute);
+
+    // the measured passes are only merged when the timer is disabled
+    void compile(wgpu::Device device, GpuTimer const& timer);
+    void execute(wgpu::CommandEncoder encoder, GpuTimer& timer);
+
+    // valid after compile
+    wgpu::TextureView getTextureView(Resource texture) const { return mResources[texture].view; }
+    // changes when a texture of the pool is created or destroyed: the bind groups of the transient textures are out of date
+    uint64_t getPoolVersion() const { return mPoolVersion; }
+
+    // the compiled schedule: render passes, their attachments with the load and store ops, and the textures of the pool
+    void printSchedule(std::ostream& out) const;
+
+    // count of the declared, culled and merged passes of the last compile
+    uint32_t getPassCount() const { return (uint32_t)mPasses.size(); }
+    uint32_t getCulledCount() const { return mCulledCount; }
+    uint32_t getRenderPassCount() const { return (uint32_t)mGroups.size(); }
+
+    void release();
+
+   private:
+    enum class Access {
+        Clear,    // the previous content is discarded
+        Keep,     // the pass draws over the previous content
+        Scratch,  // the previous content doesn't matter, and what the pass leaves there is not used
+    };
+
+    struct Attachment {
+        Resource texture;
+        Access access;
+        wgpu::Color clearColor{0.0, 0.0, 0.0, 0.0};
+        float clearDepth = 1.0f;
+    };
+
+    struct Pass {
+        std::string name;
+        Execute execute;
+        std::vector<Attachment> colors;
+        bool hasDepth = false;
+        Attachment depth{};
+        std::vector<Resource> reads;
+        int timedPass = -1;
+        bool culled = false;
+    };
+
+    struct ResourceInfo {
+        std::string name;
+        wgpu::TextureView view = nullptr;
+        uint32_t width;
+        uint32_t height;
+        bool initialized;
+        bool retained;
+        // transient only
+        bool transient = false;
+        TextureDesc desc{};
+        int poolEntry = -1;
+    };
+
+    // passes merged in a single render pass, with the ops of its attachments
+    struct Group {
+        std::vector<uint32_t> passes;
+        std::string label;  // the names of its passes
+        std::vector<wgpu::LoadOp> colorLoadOps;
+        std::vector<wgpu::StoreOp> colorStoreOps;
+        wgpu::LoadOp depthLoadOp = wgpu::LoadOp::Clear;
+        wgpu::StoreOp depthStoreOp = wgpu::StoreOp::Discard;
+    };
+
+    struct PoolEntry {
+        TextureDesc desc;
+        wgpu::Texture texture = nullptr;
+        wgpu::TextureView view = nullptr;
+        bool used = false;  // by the current frame
+    };
+
+    void cullPasses();
+    void mergePasses(bool measuring);
+    void computeOps();
+    void allocateTransients(wgpu::Device device);
+    bool canMerge(Group const& group, Pass const& pass, bool measuring) const;
+    int acquirePoolEntry(wgpu::Device device, TextureDesc const& desc, std::vector<bool> const& taken);
+
+    std::vector<Pass> mPasses;
+    std::vector<ResourceInfo> mResources;
+    std::vector<Group> mGroups;
+    std::vector<PoolEntry> mPool;
+    uint64_t mPoolVersion = 0;
+    uint32_t mCulledCount = 0;
+};
@@ -1,8 +1,15 @@
 #include "core/Renderer.h"
+#include "core/Frustum.h"
+
+#include <cstdio>
+#include <thread>
 
 using namespace wgpu;
 using VertexAttributes = ResourceManager::VertexAttributes;
 
+// in the order of GUISettings::presentMode, Fifo is the only one every surface has
+static const PresentMode PRESENT_MODES[] = {PresentMode::Fifo, PresentMode::Mailbox, PresentMode::Immediate};
+
 bool Renderer::init(GLFWwindow* window) {
     mInstance = createInstance(InstanceDescriptor{});
     if (!mInstance) {
@@ -10,11 +17,51 @@ bool Renderer::init(GLFWwindow* window) {
         return false;
     }
 
-    std::cout << "Requesting adapter..." << std::endl;
     mSurface = glfwGetWGPUSurface(mInstance, window);
     RequestAdapterOptions adapterOpts{};
     adapterOpts.compatibleSurface = mSurface;
+    if (!initDevice(adapterOpts)) return false;
+
+    buildSwapChain(window);
+    buildShadowDepthTexture();
+
+    // Create the uniform buffers that will be common to all the pipelines
+    initUniforms();
+    mGpuTimer.init(mDevice, TimedPassCount);
+    return true;
+}
+
+// no surface: the frames are drawn in an offscreen texture, and the passes only for the screen are skipped
+bool Renderer::initHeadless(uint32_t width, uint32_t height, bool forceFallbackAdapter) {
+    mHeadless = true;
+    mInstance = createInstance(InstanceDescriptor{});
+    if (!mInstance) {
+        std::cerr << "Could not initialize WebGPU!" << std::endl;
+        return false;
+    }
+
+    RequestAdapterOptions adapterOpts{};
+    adapterOpts.forceFallbackAdapter = forceFallbackAdapter;
+    if (!initDevice(adapterOpts)) return false;
+
+    buildOffscreenTarget(width, height);
+    buildShadowDepthTexture();
+    initUniforms();
+    mGpuTimer.init(mDevice, TimedPassCount);
+    // a core is left for the rendering
+    unsigned int workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    mFrameCapture.init(mDevice, mOffscreenTexture, width, height, FrameCapture::DEFAULT_RING_SIZE, workerCount);
+    return true;
+}
+
+// the adapter, the device and its queue, the same with or without a window
+bool Renderer::initDevice(RequestAdapterOptions const& adapterOpts) {
+    std::cout << "Requesting adapter..." << std::endl;
     mAdapter = mInstance.requestAdapter(adapterOpts);
+    if (!mAdapter) {
+        std::cerr << "Could not get a WebGPU adapter!" << std::endl;
+        return false;
+    }
     std::cout << "Got adapter: " << mAdapter << std::endl;
 
     SupportedLimits supportedLimits;
@@ -24,15 +71,23 @@ bool Renderer::init(GLFWwindow* window) {
     RequiredLimits requiredLimits = Default;
     requiredLimits.limits.maxVertexAttributes = 6;
     requiredLimits.limits.maxVertexBuffers = 1;
-    requiredLimits.limits.maxBufferSize = 5000000 * sizeof(VertexAttributes);
+    // enough for 6 faces of 1000 * 1000 vertices
+    requiredLimits.limits.maxBufferSize = std::min<uint64_t>(6000000 * sizeof(VertexAttributes), supportedLimits.limits.maxBufferSize);
     requiredLimits.limits.maxVertexBufferArrayStride = sizeof(VertexAttributes);
+    // the planet vertices are read as a storage buffer when drawn without index buffer
+    requiredLimits.limits.maxStorageBuffersPerShaderStage = 1;
+    requiredLimits.limits.maxStorageBufferBindingSize = std::min(requiredLimits.limits.maxBufferSize, supportedLimits.limits.maxStorageBufferBindingSize);
+    mMaxStorageBufferBindingSize = requiredLimits.limits.maxStorageBufferBindingSize;
     requiredLimits.limits.minStorageBufferOffsetAlignment = supportedLimits.limits.minStorageBufferOffsetAlignment;
     requiredLimits.limits.minUniformBufferOffsetAlignment = supportedLimits.limits.minUniformBufferOffsetAlignment;
+    mMinUniformBufferOffsetAlignment = supportedLimits.limits.minUniformBufferOffsetAlignment;
     requiredLimits.limits.maxInterStageShaderComponents = 32;
-    requiredLimits.limits.maxBindGroups = 2;
-    //                                    ^ This was a 1
-    requiredLimits.limits.maxUniformBuffersPerShaderStage = 1;
+    // the scene, the object, the frame and the material (see common/uniforms.wgsl)
+    requiredLimits.limits.maxBindGroups = 4;
+    requiredLimits.limits.maxUniformBuffersPerShaderStage = 4;
     requiredLimits.limits.maxUniformBufferBindingSize = 64 * 4 * sizeof(float);
+    // the uniforms of the frame and of the object are picked in their buffer by a dynamic offset
+    requiredLimits.limits.maxDynamicUniformBuffersPerPipelineLayout = 4;
     // Allow textures up to 4K
     requiredLimits.limits.maxTextureDimension1D = 4096;
     requiredLimits.limits.maxTextureDimension2D = 4096;
@@ -40,9 +95,16 @@ bool Renderer::init(GLFWwindow* window) {
     requiredLimits.limits.maxSampledTexturesPerShaderStage = 2;
     requiredLimits.limits.maxSamplersPerShaderStage = 1;
 
+    // the GPU timings need the timestamp queries, they are only measured when the adapter has them
+    std::vector<WGPUFeatureName> requiredFeatures;
+    if (mAdapter.hasFeature(FeatureName::TimestampQuery)) {
+        requiredFeatures.push_back(FeatureName::TimestampQuery);
+    }
+
     DeviceDescriptor deviceDesc;
     deviceDesc.label = "My Device";
-    deviceDesc.requiredFeaturesCount = 0;
+    deviceDesc.requiredFeaturesCount = (uint32_t)requiredFeatures.size();
+    deviceDesc.requiredFeatures = requiredFeatures.data();
     deviceDesc.requiredLimits = &requiredLimits;
     deviceDesc.defaultQueue.label = "The default queue";
     mDevice = mAdapter.requestDevice(deviceDesc);
@@ -56,156 +118,419 @@ bool Renderer::init(GLFWwindow* window) {
     });
 
     mQueue = mDevice.getQueue();
+    return true;
+}
 
-    // Create the uniform buffer that will be common to the planet, shadow and ocean pipeline
-    BufferDescriptor bufferDesc;
-    bufferDesc.size = sizeof(SceneUniforms);
-    bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
-    bufferDesc.mappedAtCreation = false;
-    mUniformBuffer = mDevice.createBuffer(bufferDesc);
+// the uniform buffers, and the bind groups of the scene, of the frame and of the objects without vertices
+// the planet object also has the vertices, its bind group follows the vertex buffer (see buildPlanetBindGroups)
+void Renderer::initUniforms() {
+    mSceneUniforms.init(mDevice, mMinUniformBufferOffsetAlignment, "Scene uniforms");
+    mObjectUniforms.init(mDevice, mMinUniformBufferOffsetAlignment, "Object uniforms", ObjectCount);
+    mFrameUniforms.init(mDevice, mMinUniformBufferOffsetAlignment, "Frame uniforms");
+    mMaterialUniforms.init(mDevice, mMinUniformBufferOffsetAlignment, "Material uniforms", MaterialCount);
+
+    auto createBindGroupLayout = [&](std::vector<BindGroupLayoutEntry> const& entries) {
+        BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+        bindGroupLayoutDesc.entryCount = (uint32_t)entries.size();
+        bindGroupLayoutDesc.entries = entries.data();
+        return mDevice.createBindGroupLayout(bindGroupLayoutDesc);
+    };
+    WGPUShaderStageFlags stages = ShaderStage::Vertex | ShaderStage::Fragment;
+    mSceneBindGroupLayout = createBindGroupLayout({mSceneUniforms.getBindingLayout(0, stages)});
+    mObjectBindGroupLayout = createBindGroupLayout({mObjectUniforms.getBindingLayout(0, stages)});
+    mFrameBindGroupLayout = createBindGroupLayout({mFrameUniforms.getBindingLayout(0, stages)});
+
+    // The planet vertices, pulled by the vertex shader (unused when drawn with the index buffer)
+    BindGroupLayoutEntry verticesBindingLayout = Default;
+    verticesBindingLayout.binding = 1;
+    verticesBindingLayout.visibility = ShaderStage::Vertex;
+    verticesBindingLayout.buffer.type = BufferBindingType::ReadOnlyStorage;
+    verticesBindingLayout.buffer.minBindingSize = sizeof(VertexAttributes);
+    mPlanetObjectBindGroupLayout = createBindGroupLayout({mObjectUniforms.getBindingLayout(0, stages), verticesBindingLayout});
+
+    auto createBindGroup = [&](BindGroupLayout layout, BindGroupEntry const& binding) {
+        BindGroupDescriptor bindGroupDesc;
+        bindGroupDesc.layout = layout;
+        bindGroupDesc.entryCount = 1;
+        bindGroupDesc.entries = &binding;
+        return mDevice.createBindGroup(bindGroupDesc);
+    };
+    mSceneBindGroup = createBindGroup(mSceneBindGroupLayout, mSceneUniforms.getBinding(0));
+    mObjectBindGroup = createBindGroup(mObjectBindGroupLayout, mObjectUniforms.getBinding(0));
+    mFrameBindGroup = createBindGroup(mFrameBindGroupLayout, mFrameUniforms.getBinding(0));
+
+    // The initial value of the uniforms, the light matrices follow the camera (see updateShadowCascades)
+    SceneUniforms scene{};
+    scene.projectionMatrix = glm::perspective(
+        glm::radians(fov),
+        float(mSwapChainDesc.width) / float(mSwapChainDesc.height),
+        near, far);
+    scene.invProjectionMatrix = glm::inverse(scene.projectionMatrix);
+    for (mat4x4& lightViewProjMatrix : scene.lightViewProjMatrices) {
+        lightViewProjMatrix = mat4x4(1.0);
+    }
+    scene.cascadeCount = 1;
+    scene.lightDirection = glm::normalize(-mSunPosition);
+    scene.fov = fov;
+    scene.width = mSwapChainDesc.width;
+    scene.height = mSwapChainDesc.height;
+    scene.shadowDepthBias = SHADOW_DEPTH_BIAS;
+    mSceneUniforms.setAll(scene);
+
+    FrameUniforms frame{};
+    frame.viewMatrix = glm::lookAt(vec3(-2.0f, -3.0f, 2.0f), vec3(0.0f), vec3(0, 1, 0));
+    frame.invViewMatrix = glm::inverse(frame.viewMatrix);
+    frame.viewPosition = vec4(0.0f);  // dunno how to init this one...
+    frame.time = 1.0f;
+    mFrameUniforms.setAll(frame);
+
+    // all the objects are at the origin
+    ObjectUniforms object{};
+    object.modelMatrix = mat4x4(1.0);
+    for (uint32_t slot = 0; slot < ObjectCount; slot++) {
+        mObjectUniforms.setAll(object, slot);
+    }
+}
 
-    buildSwapChain(window);
-    buildShadowDepthTexture();
-    return true;
+// pipeline layout from the layouts of its bind groups, in the order of the groups
+PipelineLayout Renderer::createPipelineLayout(std::vector<BindGroupLayout> const& bindGroupLayouts) {
+    PipelineLayoutDescriptor layoutDesc{};
+    layoutDesc.bindGroupLayoutCount = (uint32_t)bindGroupLayouts.size();
+    layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout const*)bindGroupLayouts.data();
+    return mDevice.createPipelineLayout(layoutDesc);
 }
 
 void Renderer::onFrame() {
+    // the shadow settings changed in the GUI of the last frame, which was still using the old map
+    if (mShadowMapDirty) {
+        setShadowMapSettings();
+    }
+    // same for the resolution of the ocean, the timings of the other resolution are dropped
+    // and for the present mode: only the swap chain is created again, the depth buffer keeps its size
+    int presentMode = glm::clamp(mGUISettings.presentMode, 0, 2);
+    if (!mHeadless && mPresentMode != presentMode) {
+        setPresentMode(presentMode);
+    }
+    uint32_t oceanDownscale = (uint32_t)glm::clamp(mGUISettings.oceanDownscale, 0, MAX_OCEAN_DOWNSCALE);
+    if (mOceanDownscale != oceanDownscale) {
+        mOceanDownscale = oceanDownscale;
+        mGpuTimer.resetPass(OceanPass);
+        mGpuTimer.resetPass(OceanCompositePass);
+    }
+
     // Update time in the uniform
-    mUniforms.time = static_cast<float>(glfwGetTime());
-    mQueue.writeBuffer(mUniformBuffer, offsetof(SceneUniforms, time), &mUniforms.time, sizeof(SceneUniforms::time));
+    // (no clock without a window: the headless frames are the same from a run to the next)
+    float time = mHeadless ? 0.0f : static_cast<float>(glfwGetTime());
+    mFrameUniforms.set(&FrameUniforms::time, time);
+
+    // the day and night cycle: the sun turns around the Y axis of the planet
+    if (mGUISettings.sunSpeed != 0.0f) {
+        mSunAngle += glm::radians(mGUISettings.sunSpeed) * (time - mLastFrameTime);
+        mSunPosition = glm::rotate(mat4x4(1.0f), mSunAngle, vec3(0, 1, 0)) * mSunStartPosition;
+        mSceneUniforms.set(&SceneUniforms::lightDirection, glm::normalize(-mSunPosition));
+        mShadowCullingDirty = true;
+    }
+    mLastFrameTime = time;
+
+    updateShadowCascades();
+    scheduleShadowCascades();
+    updateOceanBounds();
+    // send everything that changed since the last frame, in the copies used by this frame
+    mSceneUniforms.flush(mQueue);
+    mObjectUniforms.flush(mQueue);
+    mFrameUniforms.flush(mQueue);
+    mMaterialUniforms.flush(mQueue);
+    uint32_t sceneOffset = mSceneUniforms.getOffset();
+    uint32_t frameOffset = mFrameUniforms.getOffset();
+    uint32_t planetOffset = mObjectUniforms.getOffset(PlanetObject);
 
     // the "current textureview" could be seen as the "context" in the JS version ?
-    TextureView nextTexture = mSwapChain.getCurrentTextureView();
+    TextureView nextTexture = mHeadless ? mOffscreenTextureView : nullptr;
+    if (!mHeadless && mSwapChain != nullptr) nextTexture = mSwapChain.getCurrentTextureView();
     if (!nextTexture) {
         std::cerr << "Cannot acquire next swap chain texture" << std::endl;
+        // the first frame with a present mode the surface doesn't have, the next ones are in Fifo
+        if (!mPresentModeWorks && mPresentMode != 0) {
+            setPresentMode(0);
+        }
+        // the cascades scheduled for this frame are not rendered after all
+        for (uint32_t cascade : mShadowCascadesToRender) {
+            mShadowCache[cascade].valid = false;
+        }
         return;
     }
 
+    mPresentModeWorks = true;
+
     CommandEncoderDescriptor commandEncoderDesc;
     commandEncoderDesc.label = "Command Encoder";
     CommandEncoder encoder = mDevice.createCommandEncoder(commandEncoderDesc);
+    mGpuTimer.beginFrame();
+
+    // the passes of the frame with the textures they read and write, the render graph works out
+    // which ones are merged, the load and store ops and the transient textures (see RenderGraph)
+    // the passes are recorded by compile and execute, while the locals of this function still exist
+    mRenderGraph.reset();
+    RenderGraph::Resource swapChainTexture = mRenderGraph.importTexture("swapchain", nextTexture, mSwapChainDesc.width, mSwapChainDesc.height, false, true);
+    RenderGraph::Resource depthTexture = mRenderGraph.importTexture("depth", mDepthTextureView, mSwapChainDesc.width, mSwapChainDesc.height, false, false);
+
+    // SHADOW PASSES
+    // a pass per cascade picked by scheduleShadowCascades, in its layer of the shadow map
+    // the other layers are kept from the previous frames
+    for (uint32_t cascade : mShadowCascadesToRender) {
+        RenderGraph::Resource shadowLayer = mRenderGraph.importTexture(
+            "shadow cascade " + std::to_string(cascade), mShadowCascadeViews[cascade], mShadowDepthTextureSize, mShadowDepthTextureSize, true, true);
+        mRenderGraph.addPass("Shadow Render Pass " + std::to_string(cascade), [&, cascade](RenderPassEncoder shadowPass) {
+            // the reduced shadow casters, without the clusters facing away from the sun
+            if (mShadowCullingDirty) {
+                cullShadowClusters();
+                mShadowCullingDirty = false;
+            }
+            shadowPass.setPipeline(mVertexPulling ? mShadowPulledPipeline : mShadowPipeline);
+            shadowPass.setBindGroup(0, mSceneBindGroup, 1, &sceneOffset);
+            shadowPass.setBindGroup(1, mPlanetObjectBindGroup, 1, &planetOffset);
+            if (!mVertexPulling) {
+                shadowPass.setVertexBuffer(0, mVertexBuffer, 0, mVertexCount * sizeof(VertexAttributes));
+            }
+            shadowPass.setIndexBuffer(mShadowIndexBuffer, IndexFormat::Uint32, 0, mShadowIndexData.size() * sizeof(uint32_t));
+            // the shader picks the light matrix of the cascade with the instance index
+            uint32_t level = std::min(mShadowCascadeLevels[cascade], (uint32_t)mShadowRanges.size() - 1);
+            for (IndexRange const& range : mShadowRanges[level]) {
+                shadowPass.drawIndexed(range.count, 1, range.first, 0, cascade);
+            }
+        })
+            .clearDepth(shadowLayer, 1.0f)
+            .measure(ShadowPass);
+    }
 
-    // SHADOW PASS
-    RenderPassDepthStencilAttachment shadowDepthStencilAttachment;
-    shadowDepthStencilAttachment.view = mShadowDepthTextureView;
-    shadowDepthStencilAttachment.depthClearValue = 1.0f;
-    shadowDepthStencilAttachment.depthLoadOp = LoadOp::Clear;
-    shadowDepthStencilAttachment.depthStoreOp = StoreOp::Store;
-    shadowDepthStencilAttachment.depthReadOnly = false;
-    shadowDepthStencilAttachment.stencilClearValue = 0;
-#ifdef WEBGPU_BACKEND_WGPU
-    shadowDepthStencilAttachment.stencilLoadOp = LoadOp::Clear;
-    shadowDepthStencilAttachment.stencilStoreOp = StoreOp::Store;
-#else
-    shadowDepthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
-    shadowDepthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
-#endif
-    shadowDepthStencilAttachment.stencilReadOnly = false;
-
-    RenderPassDescriptor shadowPassDesc{};
-    shadowPassDesc.label = "Shadow Render Pass";
-    shadowPassDesc.colorAttachmentCount = 0;
-    shadowPassDesc.colorAttachments = nullptr;
-    shadowPassDesc.depthStencilAttachment = &shadowDepthStencilAttachment;
-    shadowPassDesc.timestampWriteCount = 0;
-    shadowPassDesc.timestampWrites = nullptr;
-    RenderPassEncoder shadowPass = encoder.beginRenderPass(shadowPassDesc);
-
-    // This should write in the shadow depth texture ?
-    shadowPass.setPipeline(mShadowPipeline);
-    shadowPass.setVertexBuffer(0, mVertexBuffer, 0, mVertexCount * sizeof(VertexAttributes));
-    shadowPass.setIndexBuffer(mIndexBuffer, IndexFormat::Uint32, 0, mIndexCount * sizeof(uint32_t));
-    shadowPass.setBindGroup(0, mShadowBindGroup, 0, nullptr);
-    shadowPass.drawIndexed(mIndexCount, 1, 0, 0, 0);
-    shadowPass.end();
-
-    // SKYBOX + OCEAN + SCENE RENDER PASS
-    RenderPassDepthStencilAttachment depthStencilAttachment;
-    depthStencilAttachment.view = mDepthTextureView;
-    depthStencilAttachment.depthClearValue = 1.0f;
-    depthStencilAttachment.depthLoadOp = LoadOp::Clear;
-    depthStencilAttachment.depthStoreOp = StoreOp::Store;
-    depthStencilAttachment.depthReadOnly = false;
-    depthStencilAttachment.stencilClearValue = 0;
-#ifdef WEBGPU_BACKEND_WGPU
-    depthStencilAttachment.stencilLoadOp = LoadOp::Clear;
-    depthStencilAttachment.stencilStoreOp = StoreOp::Store;
-#else
-    depthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
-    depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
-#endif
-    depthStencilAttachment.stencilReadOnly = false;
-
-    RenderPassColorAttachment renderPassColorAttachment{};
-    renderPassColorAttachment.view = nextTexture;
-    renderPassColorAttachment.resolveTarget = nullptr;
-    renderPassColorAttachment.loadOp = LoadOp::Clear;
-    renderPassColorAttachment.storeOp = StoreOp::Store;
-    renderPassColorAttachment.clearValue = Color{0.65, 0.67, 1, 1.0};
-
-    RenderPassDescriptor renderPassDesc{};
-    renderPassDesc.label = "Scene Render pass";
-    renderPassDesc.colorAttachmentCount = 1;
-    renderPassDesc.colorAttachments = &renderPassColorAttachment;
-    renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
-    renderPassDesc.timestampWriteCount = 0;
-    renderPassDesc.timestampWrites = nullptr;
-    RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
-
-    // the skybox stuff
-    renderPass.setPipeline(mSkyboxPipeline);
-    renderPass.setVertexBuffer(0, mSkyboxVertexBuffer, 0, mSkyboxVertexCount * sizeof(VertexAttributes));
-    renderPass.setBindGroup(0, mSkyboxBindGroup, 0, nullptr);
-    renderPass.draw(mSkyboxVertexCount, 1, 0, 0);
-
-    // the whole scene stuff
-    renderPass.setPipeline(mPipeline);
-    renderPass.setVertexBuffer(0, mVertexBuffer, 0, mVertexCount * sizeof(VertexAttributes));
-    renderPass.setIndexBuffer(mIndexBuffer, IndexFormat::Uint32, 0, mIndexCount * sizeof(uint32_t));
-    renderPass.setBindGroup(0, mBindGroup, 0, nullptr);
-    renderPass.drawIndexed(mIndexCount, 1, 0, 0, 0);
-
-    renderPass.end();
+    // SKYBOX + SCENE RENDER PASS
+    mRenderGraph.addPass("Scene Render pass", [&](RenderPassEncoder renderPass) {
+        // the scene and the frame are the same for all the pipelines of the pass, they stay bound
+        // (the pipelines have the same layouts for these groups)
+        renderPass.setBindGroup(0, mSceneBindGroup, 1, &sceneOffset);
+        renderPass.setBindGroup(2, mFrameBindGroup, 1, &frameOffset);
+
+        // the skybox stuff
+        uint32_t skyboxOffset = mObjectUniforms.getOffset(SkyboxObject);
+        renderPass.setPipeline(mSkyboxPipeline);
+        renderPass.setVertexBuffer(0, mSkyboxVertexBuffer, 0, mSkyboxVertexCount * sizeof(VertexAttributes));
+        renderPass.setBindGroup(1, mObjectBindGroup, 1, &skyboxOffset);
+        renderPass.setBindGroup(3, mSkyboxBindGroup, 0, nullptr);
+        renderPass.draw(mSkyboxVertexCount, 1, 0, 0);
+
+        // the whole scene stuff, only the clusters that can be seen
+        if (mCullingDirty) {
+            cullPlanetClusters();
+            mCullingDirty = false;
+        }
+        renderPass.setPipeline(mVertexPulling ? mGridPipeline : mPipeline);
+        uint32_t terrainOffset = mMaterialUniforms.getOffset(TerrainMaterial);
+        renderPass.setBindGroup(1, mPlanetObjectBindGroup, 1, &planetOffset);
+        renderPass.setBindGroup(3, mBindGroup, 1, &terrainOffset);
+        if (mVertexPulling) {
+            // the vertex index is the position in the (virtual) index buffer
+            for (IndexRange const& range : mVisibleRanges) {
+                renderPass.draw(range.count, 1, range.first, 0);
+            }
+        } else {
+            renderPass.setVertexBuffer(0, mVertexBuffer, 0, mVertexCount * sizeof(VertexAttributes));
+            renderPass.setIndexBuffer(mIndexBuffer, IndexFormat::Uint32, 0, mIndexCount * sizeof(uint32_t));
+            for (IndexRange const& range : mVisibleRanges) {
+                renderPass.drawIndexed(range.count, 1, range.first, 0, 0);
+            }
+        }
+    })
+        .clearColor(swapChainTexture, Color{0.65, 0.67, 1, 1.0})
+        .clearDepth(depthTexture, 1.0f)
+        .measure(ScenePass);
 
     // OCEAN RENDER PASS
-    renderPassColorAttachment.loadOp = LoadOp::Load;  // Load the texture of the previous render passes
+    // shaded over the scene, or at a lower resolution in its own target then upsampled over the scene
+    // only in the rectangle around its sphere, and not at all when it can't be seen
+    bool oceanDownscaled = mOceanDownscale > 0;
+    uint32_t oceanOffset = mObjectUniforms.getOffset(OceanObject);
+    uint32_t oceanMaterialOffset = mMaterialUniforms.getOffset(OceanMaterial);
+    if (mOceanVisibility == OceanVisible) {
+        uint32_t oceanWidth = std::max(mSwapChainDesc.width >> mOceanDownscale, 1u);
+        uint32_t oceanHeight = std::max(mSwapChainDesc.height >> mOceanDownscale, 1u);
+        RenderGraph::Resource oceanTexture = swapChainTexture;
+        if (oceanDownscaled) {
+            oceanTexture = mRenderGraph.createTexture({"ocean", oceanWidth, oceanHeight, mOceanTextureFormat});
+        }
 
-    RenderPassDescriptor oceanRenderPassDesc{};
-    oceanRenderPassDesc.label = "Ocean Render Pass";
-    oceanRenderPassDesc.colorAttachmentCount = 1;
-    oceanRenderPassDesc.colorAttachments = &renderPassColorAttachment;
-    oceanRenderPassDesc.depthStencilAttachment = nullptr;
-    oceanRenderPassDesc.timestampWriteCount = 0;
-    oceanRenderPassDesc.timestampWrites = nullptr;
-    RenderPassEncoder oceanRenderPass = encoder.beginRenderPass(oceanRenderPassDesc);
+        RenderGraph::PassBuilder oceanPass = mRenderGraph.addPass("Ocean Render Pass", [&, oceanWidth, oceanHeight](RenderPassEncoder oceanRenderPass) {
+            // the texels of the lower resolution target are shaded at their center: no margin needed
+            oceanRenderPass.setPipeline(oceanDownscaled ? mOceanLowPipeline : mOceanPipeline);
+            setOceanScissor(oceanRenderPass, oceanWidth, oceanHeight, 0);
+            oceanRenderPass.setBindGroup(0, mSceneBindGroup, 1, &sceneOffset);
+            oceanRenderPass.setBindGroup(1, mObjectBindGroup, 1, &oceanOffset);
+            oceanRenderPass.setBindGroup(2, mFrameBindGroup, 1, &frameOffset);
+            oceanRenderPass.setBindGroup(3, mOceanBindGroup, 1, &oceanMaterialOffset);
+            oceanRenderPass.draw(6, 1, 0, 0);  // draw a double triangle
+        });
+        if (oceanDownscaled) {
+            oceanPass.clearColor(oceanTexture, Color{0.0, 0.0, 0.0, 0.0});
+        } else {
+            oceanPass.writeColor(swapChainTexture);
+        }
+        oceanPass.read(depthTexture).measure(OceanPass);
+
+        if (oceanDownscaled) {
+            mRenderGraph.addPass("Ocean Composite Render Pass", [&, oceanTexture](RenderPassEncoder compositeRenderPass) {
+                buildOceanCompositeBindGroup(mRenderGraph.getTextureView(oceanTexture));
+                // the same groups as the ocean, only the scene is read
+                // the pixels around the rectangle still blend the texels of its border
+                compositeRenderPass.setPipeline(mOceanCompositePipeline);
+                setOceanScissor(compositeRenderPass, mSwapChainDesc.width, mSwapChainDesc.height, 1u << mOceanDownscale);
+                compositeRenderPass.setBindGroup(0, mSceneBindGroup, 1, &sceneOffset);
+                compositeRenderPass.setBindGroup(1, mObjectBindGroup, 1, &oceanOffset);
+                compositeRenderPass.setBindGroup(2, mFrameBindGroup, 1, &frameOffset);
+                compositeRenderPass.setBindGroup(3, mOceanCompositeBindGroup, 0, nullptr);
+                compositeRenderPass.draw(3, 1, 0, 0);  // a triangle over the screen
+            })
+            .writeColor(swapChainTexture)
+            .read(oceanTexture)
+            .read(depthTexture)
+            .measure(OceanCompositePass);
+        }
+    }
 
-    // The ocean stuff
-    oceanRenderPass.setPipeline(mOceanPipeline);
-    oceanRenderPass.setBindGroup(0, mOceanBindGroup, 0, nullptr);
-    oceanRenderPass.draw(6, 1, 0, 0);  // draw a double triangle
+    // Write the GUI after everythin else to be above the rest
+    // (its pipeline has a depth attachment, but doesn't use it)
+    if (!mHeadless) {
+        mRenderGraph.addPass("GUI Render Pass", [&](RenderPassEncoder GUIRenderPass) { updateGui(GUIRenderPass); })
+            .writeColor(swapChainTexture)
+            .scratchDepth(depthTexture)
+            .measure(GuiPass);
+    }
 
-    oceanRenderPass.end();
+    mRenderGraph.compile(mDevice, mGpuTimer);
+    if (mPrintRenderGraph) {
+        mRenderGraph.printSchedule(std::cout);
+        mPrintRenderGraph = false;
+    }
+    mRenderGraph.execute(encoder, mGpuTimer);
 
-    // Write the GUI after everythin else to be above the rest
-    RenderPassEncoder GUIRenderPass = encoder.beginRenderPass(renderPassDesc);
-    updateGui(GUIRenderPass);
-    GUIRenderPass.end();
+    if (!mHeadless) nextTexture.release();
 
-    nextTexture.release();
+    // the copy of a capture goes with the frame, it is read a few frames later (see FrameCapture)
+    bool capturing = !mCapturePath.empty();
+    if (capturing) {
+        mFrameCapture.waitForSlot([this]() { pollDevice(); });
+        mFrameCapture.copy(encoder, mCapturePath);
+        mCapturePath.clear();
+    }
 
     CommandBufferDescriptor cmdBufferDescriptor{};
     cmdBufferDescriptor.label = "Command buffer";
+    mGpuTimer.resolve(encoder);
     CommandBuffer command = encoder.finish(cmdBufferDescriptor);
     mQueue.submit(command);
+    mGpuTimer.readback();
+    if (capturing) mFrameCapture.readback();
+
+    // the frame is in flight until the GPU is done with it, and so is the input it shows
+    // (the callback runs at the next poll of the device: the latency is rounded up to it)
+    uint64_t frame = ++mFramesSubmitted;
+    double inputTime = mPendingInputTime;
+    mPendingInputTime = -1.0;
+    mFramesInFlight.push_back({frame, mQueue.onSubmittedWorkDone([this, frame, inputTime](QueueWorkDoneStatus) {
+        mFramesCompleted = std::max(mFramesCompleted, frame);
+        if (inputTime < 0.0) return;
+        mInputLatencyMs = (glfwGetTime() - inputTime) * 1000.0;
+        mAverageInputLatencyMs = mAverageInputLatencyMs < 0.0 ? mInputLatencyMs : 0.9 * mAverageInputLatencyMs + 0.1 * mInputLatencyMs;
+    })});
+
+    // GPU time of the ocean at the current resolution, once all of its passes are measured
+    double oceanMs = mGpuTimer.getPassMs(OceanPass);
+    double compositeMs = oceanDownscaled ? mGpuTimer.getPassMs(OceanCompositePass) : 0.0;
+    if (oceanMs >= 0.0 && compositeMs >= 0.0) {
+        mOceanGpuMs[mOceanDownscale] = oceanMs + compositeMs;
+    }
+
+    // first frame with a new planet: time from the start of its regeneration until the GPU is done with it
+    if (mPlanetUpdatePending) {
+        mPlanetUpdatePending = false;
+        mFirstFrameSubmitMs = mPlanetUpdateTimer.elapsedMs();
+        // the callbacks of the previous regenerations may still be pending, they are kept until they ran
+        while (!mFirstFrameCallbacks.empty() && mFirstFrameCallbacks.front().done) {
+            mFirstFrameCallbacks.pop_front();
+        }
+        FirstFrameCallback& firstFrame = mFirstFrameCallbacks.emplace_back();
+        firstFrame.callback = mQueue.onSubmittedWorkDone([this, &firstFrame](QueueWorkDoneStatus) {
+            mFirstFrameMs = mPlanetUpdateTimer.elapsedMs();
+            firstFrame.done = true;
+        });
+    }
 
-    mSwapChain.present();
+    if (!mHeadless) mSwapChain.present();
+    pollDevice();
+}
 
+// call the callbacks of the work done since the last poll, without waiting
+void Renderer::pollDevice() {
 #ifdef WEBGPU_BACKEND_DAWN
     // Check for pending error callbacks
     mDevice.tick();
+#elif defined(WEBGPU_BACKEND_WGPU)
+    wgpuDevicePoll(mDevice, false, nullptr);
 #endif
 }
 
+// the frame limiter first: asleep until about 1 ms before the start of the frame, then yielding until it
+// a frame late or more, the next ones are planned from now instead of catching up
+// then the CPU waits for the GPU to be done with enough frames: the fewer frames in flight, the sooner
+// the inputs read after this are on the screen
+void Renderer::waitForNextFrame() {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+    if (mGUISettings.targetFrameMs > 0.0f) {
+        Clock::duration frameTime = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(mGUISettings.targetFrameMs));
+        if (mNextFrameTime + frameTime < start || mNextFrameTime > start + frameTime) {
+            mNextFrameTime = start;
+        }
+        if (mNextFrameTime - std::chrono::milliseconds(1) > start) {
+            std::this_thread::sleep_until(mNextFrameTime - std::chrono::milliseconds(1));
+        }
+        while (Clock::now() < mNextFrameTime) {
+            std::this_thread::yield();
+        }
+        mNextFrameTime += frameTime;
+    }
+
+    uint64_t maxFramesInFlight = (uint64_t)glm::clamp(mGUISettings.maxFramesInFlight, 1, MAX_FRAMES_IN_FLIGHT);
+    while (mFramesSubmitted - mFramesCompleted >= maxFramesInFlight) {
+        pollDevice();
+        std::this_thread::yield();
+    }
+    // the callbacks of the frames done are not running anymore
+    while (!mFramesInFlight.empty() && mFramesInFlight.front().frame <= mFramesCompleted) {
+        mFramesInFlight.pop_front();
+    }
+    mFrameWaitMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void Renderer::markInput() {
+    if (mPendingInputTime < 0.0) mPendingInputTime = glfwGetTime();
+}
+
+// only the swap chain is created again, the depth buffer keeps its size
+// the surfaces don't tell their present modes here: one they don't have fails the creation of the swap chain or
+// the first acquire of a texture, then the swap chain is created again with Fifo, which every surface has
+void Renderer::setPresentMode(int presentMode) {
+    mPresentMode = presentMode;
+    mGUISettings.presentMode = presentMode;
+    mPresentModeWorks = false;
+    mSwapChainDesc.presentMode = PRESENT_MODES[mPresentMode];
+    if (mSwapChain != nullptr) mSwapChain.release();
+    mSwapChain = mDevice.createSwapChain(mSurface, mSwapChainDesc);
+    std::cout << "Swapchain: " << mSwapChain << std::endl;
+    if (mSwapChain == nullptr && presentMode != 0) {
+        std::cerr << "The surface doesn't have this present mode, back to Fifo" << std::endl;
+        setPresentMode(0);
+    }
+}
+
 // Build a new swapchain if from the current window
 // This will be re-called if the window changes size
 void Renderer::buildSwapChain(GLFWwindow* window) {
@@ -227,13 +552,56 @@ void Renderer::buildSwapChain(GLFWwindow* window) {
     mSwapChainDesc.height = static_cast<uint32_t>(height);
     mSwapChainDesc.usage = TextureUsage::RenderAttachment;
     mSwapChainDesc.format = mSwapChainFormat;
-    mSwapChainDesc.presentMode = PresentMode::Fifo;
+    mSwapChainDesc.presentMode = PRESENT_MODES[mPresentMode];
     mSwapChain = mDevice.createSwapChain(mSurface, mSwapChainDesc);
     std::cout << "Swapchain: " << mSwapChain << std::endl;
 
     buildDepthTexture();
 }
 
+// the color texture drawn instead of the swap chain without a window, then copied by the captures
+// the shaders write linear colors, like for the sRGB swap chain of the surface (see shader.wgsl)
+void Renderer::buildOffscreenTarget(uint32_t width, uint32_t height) {
+    mSwapChainFormat = TextureFormat::RGBA8UnormSrgb;
+    mSwapChainDesc.width = width;
+    mSwapChainDesc.height = height;
+    mSwapChainDesc.format = mSwapChainFormat;
+
+    TextureDescriptor textureDesc;
+    textureDesc.label = "Offscreen color";
+    textureDesc.dimension = TextureDimension::_2D;
+    textureDesc.format = mSwapChainFormat;
+    textureDesc.mipLevelCount = 1;
+    textureDesc.sampleCount = 1;
+    textureDesc.size = {width, height, 1};
+    textureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats = nullptr;
+    mOffscreenTexture = mDevice.createTexture(textureDesc);
+
+    TextureViewDescriptor textureViewDesc;
+    textureViewDesc.aspect = TextureAspect::All;
+    textureViewDesc.baseArrayLayer = 0;
+    textureViewDesc.arrayLayerCount = 1;
+    textureViewDesc.baseMipLevel = 0;
+    textureViewDesc.mipLevelCount = 1;
+    textureViewDesc.dimension = TextureViewDimension::_2D;
+    textureViewDesc.format = mSwapChainFormat;
+    mOffscreenTextureView = mOffscreenTexture.createView(textureViewDesc);
+    std::cout << "Offscreen texture: " << width << "x" << height << std::endl;
+
+    buildDepthTexture();
+}
+
+void Renderer::captureFrame(std::filesystem::path const& path) {
+    if (mHeadless) mCapturePath = path;
+}
+
+uint32_t Renderer::finishCaptures() {
+    mFrameCapture.finish([this]() { pollDevice(); });
+    return mFrameCapture.getSavedCount();
+}
+
 // Build a new depth buffer
 // This has to be re-called if the swap chain changes (e.g. on window resize)
 void Renderer::buildDepthTexture() {
@@ -271,7 +639,12 @@ void Renderer::buildDepthTexture() {
     std::cout << "Depth texture view: " << mDepthTextureView << std::endl;
 }
 
+// the shadow map from the GUI settings: a layer per cascade in a single texture
 void Renderer::buildShadowDepthTexture() {
+    mShadowDepthTextureSize = (unsigned int)mGUISettings.shadowMapSize;
+    mShadowCascadeCount = (uint32_t)glm::clamp(mGUISettings.shadowCascades, 1, int(MAX_SHADOW_CASCADES));
+    mShadowDepthTextureFormat = mGUISettings.shadowDepth16 ? TextureFormat::Depth16Unorm : TextureFormat::Depth32Float;
+
     // Create the depth texture
     TextureDescriptor depthTextureDesc;
     depthTextureDesc.dimension = TextureDimension::_2D;
@@ -279,37 +652,74 @@ void Renderer::buildShadowDepthTexture() {
     depthTextureDesc.mipLevelCount = 1;
     depthTextureDesc.sampleCount = 1;
 
-    depthTextureDesc.size = {mShadowDepthTextureSize, mShadowDepthTextureSize, 1};
+    depthTextureDesc.size = {mShadowDepthTextureSize, mShadowDepthTextureSize, mShadowCascadeCount};
     depthTextureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
     depthTextureDesc.viewFormatCount = 1;
     depthTextureDesc.viewFormats = (WGPUTextureFormat*)&mShadowDepthTextureFormat;
     mShadowDepthTexture = mDevice.createTexture(depthTextureDesc);
     std::cout << "Depth texture: " << mShadowDepthTexture << std::endl;
 
-    // Create the view of the depth texture manipulated by the rasterizer
+    // Create the view of the depth texture read by the planet shader, with all the cascades
     TextureViewDescriptor depthTextureViewDesc;
     depthTextureViewDesc.aspect = TextureAspect::DepthOnly;
     depthTextureViewDesc.baseArrayLayer = 0;
-    depthTextureViewDesc.arrayLayerCount = 1;
+    depthTextureViewDesc.arrayLayerCount = mShadowCascadeCount;
     depthTextureViewDesc.baseMipLevel = 0;
     depthTextureViewDesc.mipLevelCount = 1;
-    depthTextureViewDesc.dimension = TextureViewDimension::_2D;
+    depthTextureViewDesc.dimension = TextureViewDimension::_2DArray;
     depthTextureViewDesc.format = mShadowDepthTextureFormat;
     mShadowDepthTextureView = mShadowDepthTexture.createView(depthTextureViewDesc);
     std::cout << "Depth texture view: " << mShadowDepthTextureView << std::endl;
+
+    // and the views manipulated by the rasterizer, one per cascade
+    depthTextureViewDesc.arrayLayerCount = 1;
+    depthTextureViewDesc.dimension = TextureViewDimension::_2D;
+    for (uint32_t cascade = 0; cascade < mShadowCascadeCount; cascade++) {
+        depthTextureViewDesc.baseArrayLayer = cascade;
+        mShadowCascadeViews.push_back(mShadowDepthTexture.createView(depthTextureViewDesc));
+    }
+
+    // a new texture holds nothing yet
+    for (ShadowCache& cache : mShadowCache) {
+        cache.valid = false;
+    }
 }
 
-// create a pipeline from a given resource bundle
-bool Renderer::setPlanetPipeline(
-    std::vector<VertexAttributes> const& vertexData,
-    std::vector<uint32_t> const& indices) {
-    mVertexData = vertexData;
-    mIndexData = indices;
+void Renderer::releaseShadowDepthTexture() {
+    for (TextureView view : mShadowCascadeViews) {
+        view.release();
+    }
+    mShadowCascadeViews.clear();
+    mShadowDepthTextureView.release();
+    mShadowDepthTexture.destroy();
+    mShadowDepthTexture.release();
+}
+
+// apply the shadow settings of the GUI, the map is created again if they changed
+// the pipelines only depend on the format and the bind group on the texture view
+void Renderer::setShadowMapSettings() {
+    mShadowMapDirty = false;
+    TextureFormat previousFormat = mShadowDepthTextureFormat;
+    releaseShadowDepthTexture();
+    buildShadowDepthTexture();
+    if (mShadowDepthTextureFormat != previousFormat && mShadowPipeline != nullptr) {
+        mShadowPipeline.release();
+        mShadowPulledPipeline.release();
+        setShadowPipeline();
+    }
+    if (mBindGroup != nullptr) {
+        buildPlanetBindGroups();
+    }
+}
 
+// create the planet pipelines, only once: a new planet only changes the content of the buffers (see setPlanetData)
+// the 2 ways of drawing the planet (with an index buffer, or pulling the vertices of the grid) have their own
+// pipeline with the same bind group layout, so the bind group doesn't depend on how the planet is drawn
+bool Renderer::setPlanetPipeline() {
     // Load the shaders
     // std::cout << "Creating shader module..." << std::endl;
-    string shaderPath = ASSETS_DIR "/planet/shader.wgsl";
-    wgpu::ShaderModule shaderModule = ResourceManager::loadShaderModule(shaderPath, mDevice);
+    std::vector<ResourceManager::path> shaderPaths = {ASSETS_DIR "/common/uniforms.wgsl", ASSETS_DIR "/planet/grid.wgsl", ASSETS_DIR "/planet/shader.wgsl"};
+    wgpu::ShaderModule shaderModule = ResourceManager::loadShaderModule(shaderPaths, mDevice);
     // std::cout << "Shader module: " << shaderModule << std::endl;
 
     // std::cout << "Creating render pipeline..." << std::endl;
@@ -404,17 +814,11 @@ bool Renderer::setPlanetPipeline(
     pipelineDesc.multisample.mask = ~0u;
     pipelineDesc.multisample.alphaToCoverageEnabled = false;
 
-    // Create binding layouts
-    // Just the uniforms for now: no texture or anything
-    int binGroupEntriesCount = 3;
-    std::vector<BindGroupLayoutEntry> bindingLayoutEntries(binGroupEntriesCount, Default);
+    // Create the binding layout of the terrain material
+    std::vector<BindGroupLayoutEntry> bindingLayoutEntries(3, Default);
 
-    // The uniform buffer binding that we already had
-    BindGroupLayoutEntry& bindingLayout = bindingLayoutEntries[0];
-    bindingLayout.binding = 0;
-    bindingLayout.visibility = ShaderStage::Vertex | ShaderStage::Fragment;
-    bindingLayout.buffer.type = BufferBindingType::Uniform;
-    bindingLayout.buffer.minBindingSize = sizeof(SceneUniforms);
+    // The material uniforms
+    bindingLayoutEntries[0] = mMaterialUniforms.getBindingLayout(0, ShaderStage::Fragment);
 
     // Shadow Sampler
     BindGroupLayoutEntry& samplerBindingLayout = bindingLayoutEntries[1];
@@ -427,75 +831,124 @@ bool Renderer::setPlanetPipeline(
     baseColorTextureBindingLayout.binding = 2;
     baseColorTextureBindingLayout.visibility = ShaderStage::Fragment;
     baseColorTextureBindingLayout.texture.sampleType = TextureSampleType::Depth;
-    baseColorTextureBindingLayout.texture.viewDimension = TextureViewDimension::_2D;
+    baseColorTextureBindingLayout.texture.viewDimension = TextureViewDimension::_2DArray;
 
     // Create a bind group layout
     BindGroupLayoutDescriptor bindGroupLayoutDesc{};
     bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
     bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
-    BindGroupLayout bindGroupLayout = mDevice.createBindGroupLayout(bindGroupLayoutDesc);
+    mBindGroupLayout = mDevice.createBindGroupLayout(bindGroupLayoutDesc);
 
-    // Create the pipeline layout
-    PipelineLayoutDescriptor layoutDesc{};
-    layoutDesc.bindGroupLayoutCount = 1;
-    layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
-    PipelineLayout layout = mDevice.createPipelineLayout(layoutDesc);
-    pipelineDesc.layout = layout;
+    // Create the pipeline layout, the vertices are in the group of the planet object
+    pipelineDesc.layout = createPipelineLayout({mSceneBindGroupLayout, mPlanetObjectBindGroupLayout, mFrameBindGroupLayout, mBindGroupLayout});
 
     mPipeline = mDevice.createRenderPipeline(pipelineDesc);
 
+    // same pipeline, with the vertices pulled from the storage buffer
+    pipelineDesc.vertex.bufferCount = 0;
+    pipelineDesc.vertex.buffers = nullptr;
+    pipelineDesc.vertex.entryPoint = "vs_grid";
+    mGridPipeline = mDevice.createRenderPipeline(pipelineDesc);
+
     // Create the sampler for the shadows
     SamplerDescriptor shadowSamplerDesc;
     shadowSamplerDesc.compare = CompareFunction::Less;
     shadowSamplerDesc.maxAnisotropy = 1;
     mShadowSampler = mDevice.createSampler(shadowSamplerDesc);
 
-    // define vertex buffer
-    BufferDescriptor bufferDesc;
-    bufferDesc.size = mVertexData.size() * sizeof(VertexAttributes);
-    bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
-    bufferDesc.mappedAtCreation = false;
-    mVertexBuffer = mDevice.createBuffer(bufferDesc);
-    mQueue.writeBuffer(mVertexBuffer, 0, mVertexData.data(), bufferDesc.size);
+    // also write the base settings to the uniform
+    setTerrainMaterialSettings();
+
+    // Create the shadow pipeline after the planet one
+    setShadowPipeline();
+    return true;
+}
+
+// upload a new planet
+// the buffers are only created again if they are too small, and the bind groups only if a buffer they use changed
+void Renderer::setPlanetData(
+    std::vector<VertexAttributes> const& vertexData,
+    std::vector<uint32_t> const& indices,
+    unsigned int gridResolution) {
+    mVertexData = vertexData;
+    mIndexData = indices;
+
+    // the whole vertex buffer must fit in a single storage binding to be pulled by the shaders
+    mVertexPulling = gridResolution > 0 && mVertexData.size() * sizeof(VertexAttributes) <= mMaxStorageBufferBindingSize;
+
+    // the vertex buffer is both a vertex and a storage buffer, it is read either way depending on the planet
+    uint64_t vertexBytes = mVertexData.size() * sizeof(VertexAttributes);
+    bool newVertexBuffer = reserveBuffer(
+        mVertexBuffer, mVertexBufferSize, vertexBytes,
+        BufferUsage::CopyDst | BufferUsage::Vertex | BufferUsage::Storage);
+    mQueue.writeBuffer(mVertexBuffer, 0, mVertexData.data(), vertexBytes);
     mVertexCount = static_cast<int>(mVertexData.size());
 
-    // Create index buffer
-    // (we reuse the bufferDesc initialized for the vertexBuffer)
-    bufferDesc.size = mIndexData.size() * sizeof(uint32_t);
-    bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Index;
-    bufferDesc.mappedAtCreation = false;
-    mIndexBuffer = mDevice.createBuffer(bufferDesc);
-    mQueue.writeBuffer(mIndexBuffer, 0, mIndexData.data(), bufferDesc.size);
+    // the index buffer is not needed when the shader derives the corners from the vertex index
+    if (!mVertexPulling) {
+        reserveBuffer(mIndexBuffer, mIndexBufferSize, mIndexData.size() * sizeof(uint32_t), BufferUsage::CopyDst | BufferUsage::Index);
+        mQueue.writeBuffer(mIndexBuffer, 0, mIndexData.data(), mIndexData.size() * sizeof(uint32_t));
+    }
     mIndexCount = static_cast<int>(mIndexData.size());
 
-    // Upload the initial value of the uniforms
-    mUniforms.modelMatrix = mat4x4(1.0);
-    mUniforms.viewMatrix = glm::lookAt(vec3(-2.0f, -3.0f, 2.0f), vec3(0.0f), vec3(0, 1, 0));
-    mUniforms.projectionMatrix = glm::perspective(
-        glm::radians(fov),
-        float(mSwapChainDesc.width) / float(mSwapChainDesc.height),
-        near, far);
-    mUniforms.invProjectionMatrix = glm::inverse(mUniforms.projectionMatrix);
-    mUniforms.color = {0.0f, 1.0f, 0.4f, 1.0f};
-    mUniforms.lightDirection = glm::normalize(-mSunPosition);
-    mUniforms.viewPosition = vec4(0.0f);  // dunno how to init this one...
-    mUniforms.time = 1.0f;
-    mUniforms.fov = fov;
-    mUniforms.width = mSwapChainDesc.width;
-    mUniforms.height = mSwapChainDesc.height;
-    mQueue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(SceneUniforms));
+    // the shadow casters, the full planet if the generator gave none
+    if (mShadowIndexData.empty()) {
+        mShadowIndexData = mIndexData;
+    }
+    reserveBuffer(mShadowIndexBuffer, mShadowIndexBufferSize, mShadowIndexData.size() * sizeof(uint32_t), BufferUsage::CopyDst | BufferUsage::Index);
+    mQueue.writeBuffer(mShadowIndexBuffer, 0, mShadowIndexData.data(), mShadowIndexData.size() * sizeof(uint32_t));
 
-    // also write the base settings to the uniform
-    setTerrainMaterialSettings();
+    mObjectUniforms.set(PlanetObject, &ObjectUniforms::gridResolution, mVertexPulling ? gridResolution : 0u);
+
+    if (newVertexBuffer || mBindGroup == nullptr) {
+        buildPlanetBindGroups();
+    }
+    mCullingDirty = true;
+    mShadowCullingDirty = true;
+    mGeometryVersion++;
+}
+
+void Renderer::updateShadowIndices(std::vector<uint32_t> const& indices) {
+    size_t first = std::mismatch(mShadowIndexData.begin(), mShadowIndexData.end(), indices.begin(), indices.end()).second - indices.begin();
+    mShadowIndexData = indices;
+    if (reserveBuffer(mShadowIndexBuffer, mShadowIndexBufferSize, mShadowIndexData.size() * sizeof(uint32_t), BufferUsage::CopyDst | BufferUsage::Index)) {
+        first = 0;
+    }
+    if (first < mShadowIndexData.size()) {
+        mQueue.writeBuffer(mShadowIndexBuffer, first * sizeof(uint32_t), mShadowIndexData.data() + first, (mShadowIndexData.size() - first) * sizeof(uint32_t));
+    }
+    mShadowCullingDirty = true;
+    mGeometryVersion++;
+}
+
+// make sure the buffer holds at least size bytes, true if it had to be created again
+bool Renderer::reserveBuffer(wgpu::Buffer& buffer, uint64_t& capacity, uint64_t size, WGPUBufferUsageFlags usage) {
+    if (buffer != nullptr && capacity >= size) {
+        return false;
+    }
+    if (buffer != nullptr) {
+        buffer.destroy();
+        buffer.release();
+    }
+    BufferDescriptor bufferDesc;
+    bufferDesc.size = size;
+    bufferDesc.usage = usage;
+    bufferDesc.mappedAtCreation = false;
+    buffer = mDevice.createBuffer(bufferDesc);
+    capacity = size;
+    return true;
+}
+
+// the bind groups of the terrain material, and of the planet object that points to the vertex buffer
+void Renderer::buildPlanetBindGroups() {
+    if (mBindGroup != nullptr) mBindGroup.release();
+    if (mPlanetObjectBindGroup != nullptr) mPlanetObjectBindGroup.release();
 
     // Add the data to the actual bindings
-    std::vector<BindGroupEntry> bindings(binGroupEntriesCount);
+    std::vector<BindGroupEntry> bindings(3);
 
     // uniform
-    bindings[0].binding = 0;
-    bindings[0].buffer = mUniformBuffer;
-    bindings[0].offset = 0;
-    bindings[0].size = sizeof(SceneUniforms);
+    bindings[0] = mMaterialUniforms.getBinding(0);
 
     // sampler
     bindings[1].binding = 1;
@@ -506,22 +959,34 @@ bool Renderer::setPlanetPipeline(
     bindings[2].textureView = mShadowDepthTextureView;
 
     BindGroupDescriptor bindGroupDesc;
-    bindGroupDesc.layout = bindGroupLayout;
+    bindGroupDesc.layout = mBindGroupLayout;
     bindGroupDesc.entryCount = (uint32_t)bindings.size();
     bindGroupDesc.entries = bindings.data();
     mBindGroup = mDevice.createBindGroup(bindGroupDesc);
 
-    // Create the shadow pipeline after the planet one
-    setShadowPipeline();
-    return true;
+    // a storage binding can't be bigger than the limit: the shaders only pull the vertices when they all fit in it
+    uint64_t verticesBindingSize = std::min(mVertexBufferSize, mMaxStorageBufferBindingSize / sizeof(VertexAttributes) * sizeof(VertexAttributes));
+
+    // the object uniforms and the vertices, also used by the shadows
+    std::vector<BindGroupEntry> objectBindings(2);
+    objectBindings[0] = mObjectUniforms.getBinding(0);
+    objectBindings[1].binding = 1;
+    objectBindings[1].buffer = mVertexBuffer;
+    objectBindings[1].offset = 0;
+    objectBindings[1].size = verticesBindingSize;
+
+    bindGroupDesc.layout = mPlanetObjectBindGroupLayout;
+    bindGroupDesc.entryCount = (uint32_t)objectBindings.size();
+    bindGroupDesc.entries = objectBindings.data();
+    mPlanetObjectBindGroup = mDevice.createBindGroup(bindGroupDesc);
 }
 
 // create the ocean pipeline (mostly a shader)
 bool Renderer::setOceanPipeline() {
     // Load the shaders
     // std::cout << "Creating shader module..." << std::endl;
-    string shaderPath = ASSETS_DIR "/ocean/ocean.wgsl";
-    wgpu::ShaderModule shaderModule = ResourceManager::loadShaderModule(shaderPath, mDevice);
+    std::vector<ResourceManager::path> shaderPaths = {ASSETS_DIR "/common/uniforms.wgsl", ASSETS_DIR "/ocean/ocean.wgsl"};
+    wgpu::ShaderModule shaderModule = ResourceManager::loadShaderModule(shaderPaths, mDevice);
     // std::cout << "Shader module: " << shaderModule << std::endl;
 
     // std::cout << "Creating render pipeline..." << std::endl;
@@ -566,17 +1031,12 @@ bool Renderer::setOceanPipeline() {
     pipelineDesc.multisample.mask = ~0u;
     pipelineDesc.multisample.alphaToCoverageEnabled = false;
 
-    // Create binding layouts
-    // Just the uniforms for now: no texture or anything
+    // Create the binding layout of the ocean material
     int bindGroupEntriesCount = 4;
     std::vector<BindGroupLayoutEntry> bindingLayoutEntries(bindGroupEntriesCount, Default);
 
-    // The uniform buffer binding
-    BindGroupLayoutEntry& bindingLayout = bindingLayoutEntries[0];
-    bindingLayout.binding = 0;
-    bindingLayout.visibility = ShaderStage::Vertex | ShaderStage::Fragment;
-    bindingLayout.buffer.type = BufferBindingType::Uniform;
-    bindingLayout.buffer.minBindingSize = sizeof(SceneUniforms);
+    // The material uniforms
+    bindingLayoutEntries[0] = mMaterialUniforms.getBindingLayout(0, ShaderStage::Fragment);
 
     // Planet scene depth texture sampler
     BindGroupLayoutEntry& samplerBindingLayout = bindingLayoutEntries[1];
@@ -605,14 +1065,39 @@ bool Renderer::setOceanPipeline() {
     BindGroupLayout bindGroupLayout = mDevice.createBindGroupLayout(bindGroupLayoutDesc);
 
     // Create the pipeline layout
-    PipelineLayoutDescriptor layoutDesc{};
-    layoutDesc.bindGroupLayoutCount = 1;
-    layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
-    PipelineLayout layout = mDevice.createPipelineLayout(layoutDesc);
-    pipelineDesc.layout = layout;
+    pipelineDesc.layout = createPipelineLayout({mSceneBindGroupLayout, mObjectBindGroupLayout, mFrameBindGroupLayout, bindGroupLayout});
 
     mOceanPipeline = mDevice.createRenderPipeline(pipelineDesc);
 
+    // the same in the lower resolution target, the blending is done when it is upsampled
+    colorTarget.format = mOceanTextureFormat;
+    colorTarget.blend = nullptr;
+    mOceanLowPipeline = mDevice.createRenderPipeline(pipelineDesc);
+
+    // the upsampling over the scene, blended like the ocean
+    std::vector<ResourceManager::path> compositeShaderPaths = {ASSETS_DIR "/common/uniforms.wgsl", ASSETS_DIR "/ocean/composite.wgsl"};
+    wgpu::ShaderModule compositeShaderModule = ResourceManager::loadShaderModule(compositeShaderPaths, mDevice);
+    pipelineDesc.vertex.module = compositeShaderModule;
+    fragmentState.module = compositeShaderModule;
+    colorTarget.format = mSwapChainFormat;
+    colorTarget.blend = &blendState;
+
+    // the ocean and the scene depth, only loaded: no sampler
+    std::vector<BindGroupLayoutEntry> compositeLayoutEntries(2, Default);
+    compositeLayoutEntries[0].binding = 1;
+    compositeLayoutEntries[0].visibility = ShaderStage::Fragment;
+    compositeLayoutEntries[0].texture.sampleType = TextureSampleType::UnfilterableFloat;
+    compositeLayoutEntries[0].texture.viewDimension = TextureViewDimension::_2D;
+    compositeLayoutEntries[1].binding = 2;
+    compositeLayoutEntries[1].visibility = ShaderStage::Fragment;
+    compositeLayoutEntries[1].texture.sampleType = TextureSampleType::Depth;
+    compositeLayoutEntries[1].texture.viewDimension = TextureViewDimension::_2D;
+    bindGroupLayoutDesc.entryCount = (uint32_t)compositeLayoutEntries.size();
+    bindGroupLayoutDesc.entries = compositeLayoutEntries.data();
+    mOceanCompositeBindGroupLayout = mDevice.createBindGroupLayout(bindGroupLayoutDesc);
+    pipelineDesc.layout = createPipelineLayout({mSceneBindGroupLayout, mObjectBindGroupLayout, mFrameBindGroupLayout, mOceanCompositeBindGroupLayout});
+    mOceanCompositePipeline = mDevice.createRenderPipeline(pipelineDesc);
+
     // Create a sampler for the textures
     SamplerDescriptor samplerDesc;
     samplerDesc.compare = CompareFunction::Undefined;
@@ -626,10 +1111,7 @@ bool Renderer::setOceanPipeline() {
     std::vector<BindGroupEntry> bindings(bindGroupEntriesCount);
 
     // uniform
-    bindings[0].binding = 0;
-    bindings[0].buffer = mUniformBuffer;
-    bindings[0].offset = 0;
-    bindings[0].size = sizeof(SceneUniforms);
+    bindings[0] = mMaterialUniforms.getBinding(0);
 
     // depth texture stuff
     bindings[1].binding = 1;
@@ -656,13 +1138,61 @@ bool Renderer::setOceanPipeline() {
     return true;
 }
 
+// the bind group that upsamples the ocean shaded at a lower resolution, made again only when the render graph
+// gives it another texture
+void Renderer::buildOceanCompositeBindGroup(TextureView oceanTextureView) {
+    if (mOceanCompositeBindGroup != nullptr && mOceanCompositePoolVersion == mRenderGraph.getPoolVersion()) return;
+    if (mOceanCompositeBindGroup != nullptr) mOceanCompositeBindGroup.release();
+    mOceanCompositePoolVersion = mRenderGraph.getPoolVersion();
+
+    std::vector<BindGroupEntry> bindings(2);
+    bindings[0].binding = 1;
+    bindings[0].textureView = oceanTextureView;
+    bindings[1].binding = 2;
+    bindings[1].textureView = mDepthTextureView;
+    BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.layout = mOceanCompositeBindGroupLayout;
+    bindGroupDesc.entryCount = (uint32_t)bindings.size();
+    bindGroupDesc.entries = bindings.data();
+    mOceanCompositeBindGroup = mDevice.createBindGroup(bindGroupDesc);
+}
+
+// the ocean sphere projected on the screen, nothing to draw when it is outside
+// or when it is all under the terrain (the planet model matrix stays the identity)
+void Renderer::updateOceanBounds() {
+    float radius = mObjectUniforms.get(OceanObject).radius;
+    if (!mTerrainBounds.planet.empty() && radius <= mTerrainBounds.planet.minRadius) {
+        mOceanVisibility = OceanUnderTerrain;
+        return;
+    }
+    SphereScreenBounds bounds(mFrameUniforms.get().viewMatrix, mSceneUniforms.get().projectionMatrix, vec3(0.0f), radius);
+    mOceanVisibility = bounds.visible ? OceanVisible : OceanOffScreen;
+    mOceanBoundsMin = bounds.min;
+    mOceanBoundsMax = bounds.max;
+}
+
+// limit a pass to the pixels of its target inside the bounds of the ocean, plus a margin
+void Renderer::setOceanScissor(RenderPassEncoder renderPass, uint32_t width, uint32_t height, uint32_t margin) {
+    // normalized device coordinates have y up, the pixels y down
+    float left = std::floor((mOceanBoundsMin.x * 0.5f + 0.5f) * width) - margin;
+    float right = std::ceil((mOceanBoundsMax.x * 0.5f + 0.5f) * width) + margin;
+    float top = std::floor((0.5f - mOceanBoundsMax.y * 0.5f) * height) - margin;
+    float bottom = std::ceil((0.5f - mOceanBoundsMin.y * 0.5f) * height) + margin;
+    uint32_t x = (uint32_t)glm::clamp(left, 0.0f, float(width - 1));
+    uint32_t y = (uint32_t)glm::clamp(top, 0.0f, float(height - 1));
+    uint32_t x1 = (uint32_t)glm::clamp(right, float(x + 1), float(width));
+    uint32_t y1 = (uint32_t)glm::clamp(bottom, float(y + 1), float(height));
+    renderPass.setScissorRect(x, y, x1 - x, y1 - y);
+}
+
 // NOTE: The shadow pipeline MUST be called after the planets pipeline
 // As it relies on values set with it before (light position, various initialized buffers...)
+// like the planet, there is a pipeline for each way of reading the vertices
 bool Renderer::setShadowPipeline() {
     // Load the shaders
     // std::cout << "Creating shader module..." << std::endl;
-    string shaderPath = ASSETS_DIR "/planet/shadows.wgsl";
-    wgpu::ShaderModule shaderModule = ResourceManager::loadShaderModule(shaderPath, mDevice);
+    std::vector<ResourceManager::path> shaderPaths = {ASSETS_DIR "/common/uniforms.wgsl", ASSETS_DIR "/planet/grid.wgsl", ASSETS_DIR "/planet/shadows.wgsl"};
+    wgpu::ShaderModule shaderModule = ResourceManager::loadShaderModule(shaderPaths, mDevice);
     // std::cout << "Shader module: " << shaderModule << std::endl;
 
     // std::cout << "Creating render pipeline..." << std::endl;
@@ -718,8 +1248,11 @@ bool Renderer::setShadowPipeline() {
     // pipelineDesc.primitive.topology = PrimitiveTopology::LineList; // if you want wireframes
     pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
     pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
-    pipelineDesc.primitive.frontFace = FrontFace::CCW;
-    pipelineDesc.primitive.cullMode = CullMode::None;
+    // the terrain triangles facing away from the sun are skipped by the rasterizer, the clusters where they all do
+    // are not even drawn (see cullShadowClusters)
+    // the outward triangles facing the light end up clockwise: glm is left handed here
+    pipelineDesc.primitive.frontFace = FrontFace::CW;
+    pipelineDesc.primitive.cullMode = CullMode::Back;
 
     DepthStencilState depthStencilState = Default;
     depthStencilState.depthCompare = CompareFunction::Less;
@@ -734,70 +1267,136 @@ bool Renderer::setShadowPipeline() {
     pipelineDesc.multisample.mask = ~0u;
     pipelineDesc.multisample.alphaToCoverageEnabled = false;
 
-    // Create binding layouts
-    std::vector<BindGroupLayoutEntry> bindingLayoutEntries(1, Default);
-
-    // The uniform buffer binding that we already had
-    BindGroupLayoutEntry& bindingLayout = bindingLayoutEntries[0];
-    bindingLayout.binding = 0;
-    bindingLayout.visibility = ShaderStage::Vertex;
-    bindingLayout.buffer.type = BufferBindingType::Uniform;
-    bindingLayout.buffer.minBindingSize = sizeof(SceneUniforms);
-
-    // Create a bind group layout
-    BindGroupLayoutDescriptor bindGroupLayoutDesc{};
-    bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
-    bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
-    BindGroupLayout bindGroupLayout = mDevice.createBindGroupLayout(bindGroupLayoutDesc);
-
-    // Create the pipeline layout
-    PipelineLayoutDescriptor layoutDesc{};
-    layoutDesc.bindGroupLayoutCount = 1;
-    layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
-    PipelineLayout layout = mDevice.createPipelineLayout(layoutDesc);
-    pipelineDesc.layout = layout;
+    // Create the pipeline layout: only the scene (light) and the planet object (model and vertices)
+    pipelineDesc.layout = createPipelineLayout({mSceneBindGroupLayout, mPlanetObjectBindGroupLayout});
 
     mShadowPipeline = mDevice.createRenderPipeline(pipelineDesc);
 
-    // the view matrix should be from the light's perspective
-    auto viewMatrix = glm::lookAt(vec3(mSunPosition), vec3(0.0f), vec3(0, 1, 0));
+    // the shadow casters are indexed: with vertex pulling the vertex index is the index read from the buffer
+    pipelineDesc.vertex.bufferCount = 0;
+    pipelineDesc.vertex.buffers = nullptr;
+    pipelineDesc.vertex.entryPoint = "vs_pulled";
+    mShadowPulledPipeline = mDevice.createRenderPipeline(pipelineDesc);
+    return true;
+}
 
-    // the projection should be ortholinear since the light source is infinitely far
-    float near = 0.01f, far = 100.0f;
-    float size = 5.0f;
-    auto projectionMatrix = glm::ortho(
-        -size, size, -size, size, near, far);
+// split the view in cascades, each one with its own light frustum in a layer of the shadow map
+// - only the depths where the planet can be are covered: between the closest and the furthest point of its bounding sphere
+// - the splits are between a uniform and a logarithmic repartition (see SHADOW_SPLIT_LAMBDA)
+// - the light frustum of a cascade is a box around the bounding sphere of its slice of the view, never bigger
+//   than the planet, and only moved by whole texels so that the shadows don't shimmer when the camera moves
+// done every frame, the uniforms are only sent when a matrix changed
+void Renderer::updateShadowCascades() {
+    // (a bit of margin so that the border texels are not on the silhouette)
+    float planetRadius = mTerrainBounds.planet.empty() ? 5.0f : mTerrainBounds.planet.maxRadius * 1.01f;
 
-    // we set the lightViewProjMatrix once at pipeline creation, since it won't change
-    mUniforms.lightViewProjMatrix = projectionMatrix * viewMatrix;
-    mQueue.writeBuffer(
-        mUniformBuffer,
-        offsetof(SceneUniforms, lightViewProjMatrix),
-        &mUniforms.lightViewProjMatrix,
-        sizeof(SceneUniforms::lightViewProjMatrix));
+    // the view matrix should be from the light's perspective
+    // the light is kept outside of the planet, in the direction of the sun
+    vec3 lightDirection = glm::normalize(vec3(mSunPosition));
+    float lightDistance = std::max(glm::length(vec3(mSunPosition)), 2.0f * planetRadius);
+    mat4x4 lightViewMatrix = glm::lookAt(lightDirection * lightDistance, vec3(0.0f), vec3(0, 1, 0));
+    // every cascade has the depth of the whole planet: the casters can be anywhere towards the sun
+    // (and the depth bias keeps the same meaning in all of them)
+    float lightNear = lightDistance - planetRadius, lightFar = lightDistance + planetRadius;
+
+    FrameUniforms const& frame = mFrameUniforms.get();
+    float viewDistance = glm::length(vec3(frame.viewPosition));
+    float viewNear = std::max(near, viewDistance - planetRadius);
+    float viewFar = std::max(std::min(far, viewDistance + planetRadius), viewNear * 1.001f);
+    float tanHalfHeight = std::tan(glm::radians(fov) / 2.0f);
+    float tanHalfWidth = tanHalfHeight * float(mSwapChainDesc.width) / float(mSwapChainDesc.height);
+
+    float sliceNear = viewNear;
+    for (uint32_t cascade = 0; cascade < mShadowCascadeCount; cascade++) {
+        float t = float(cascade + 1) / float(mShadowCascadeCount);
+        float uniformSplit = viewNear + (viewFar - viewNear) * t;
+        float logSplit = viewNear * std::pow(viewFar / viewNear, t);
+        float sliceFar = glm::mix(uniformSplit, logSplit, SHADOW_SPLIT_LAMBDA);
+
+        // bounding sphere of the 8 corners of the slice, in world space
+        vec3 corners[8];
+        vec3 center(0.0f);
+        for (unsigned int i = 0; i < 8; i++) {
+            float depth = i < 4 ? sliceNear : sliceFar;
+            float x = (i & 1 ? 1.0f : -1.0f) * tanHalfWidth * depth;
+            float y = (i & 2 ? 1.0f : -1.0f) * tanHalfHeight * depth;
+            corners[i] = vec3(frame.invViewMatrix * vec4(x, y, depth, 1.0f));
+            center += corners[i] / 8.0f;
+        }
+        float radius = 0.0f;
+        for (vec3 const& corner : corners) {
+            radius = std::max(radius, glm::length(corner - center));
+        }
+        // no need to cover more than the planet
+        if (radius >= planetRadius) {
+            center = vec3(0.0f);
+            radius = planetRadius;
+        }
 
-    // Bing group for the uniform
-    std::vector<BindGroupEntry> bindings(1);
+        // snap the center to the texels of the cascade, in the plane of the light
+        // (and the level of the shadow casters drawn in it is detailed enough for its texels)
+        float texelSize = 2.0f * radius / float(mShadowDepthTextureSize);
+        mShadowCascadeLevels[cascade] = ShadowLevel::pick(mShadowLevels, texelSize);
+        vec3 lightCenter = vec3(lightViewMatrix * vec4(center, 1.0f));
+        lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+        lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+
+        // the projection should be ortholinear since the light source is infinitely far
+        mat4x4 projectionMatrix = glm::ortho(
+            lightCenter.x - radius, lightCenter.x + radius,
+            lightCenter.y - radius, lightCenter.y + radius,
+            lightNear, lightFar);
+        mShadowCascadeTargets[cascade] = projectionMatrix * lightViewMatrix;
+        sliceNear = sliceFar;
+    }
+    mSceneUniforms.set(&SceneUniforms::cascadeCount, mShadowCascadeCount);
+}
 
-    // uniform
-    bindings[0].binding = 0;
-    bindings[0].buffer = mUniformBuffer;
-    bindings[0].offset = 0;
-    bindings[0].size = sizeof(SceneUniforms);
+// pick the cascades rendered this frame, they get their target light matrix
+// - the first cascade is rendered every frame it is out of date
+// - the others take turns: each one is rendered at most once every shadowFarCascadePeriod frames
+// - a cascade that was never rendered in the current map can't wait
+// a cascade that isn't rendered keeps the light matrix of its layer in the uniforms: the shader reads the layer
+// with the matrix it was rendered with, so its shadows are reprojected to the new view and only lag behind the sun
+void Renderer::scheduleShadowCascades() {
+    mShadowCascadesToRender.clear();
+    ObjectUniforms const& planet = mObjectUniforms.get(PlanetObject);
+    mat4x4 lightViewProjMatrices[MAX_SHADOW_CASCADES];
+    std::copy(std::begin(mSceneUniforms.get().lightViewProjMatrices), std::end(mSceneUniforms.get().lightViewProjMatrices), lightViewProjMatrices);
+    uint64_t period = (uint64_t)std::max(mGUISettings.shadowFarCascadePeriod, 1);
+
+    for (uint32_t cascade = 0; cascade < mShadowCascadeCount; cascade++) {
+        ShadowCache& cache = mShadowCache[cascade];
+        if (cache.valid
+            && cache.lightViewProjMatrix == mShadowCascadeTargets[cascade]
+            && cache.modelMatrix == planet.modelMatrix
+            && cache.geometryVersion == mGeometryVersion) {
+            mShadowPassesSkipped++;
+            continue;
+        }
+        bool due = cascade == 0 || !cache.valid || mShadowFrameIndex % period == (cascade - 1) % period;
+        if (!due) {
+            mShadowPassesDeferred++;
+            continue;
+        }
 
-    BindGroupDescriptor bindGroupDesc;
-    bindGroupDesc.layout = bindGroupLayout;
-    bindGroupDesc.entryCount = (uint32_t)bindings.size();
-    bindGroupDesc.entries = bindings.data();
-    mShadowBindGroup = mDevice.createBindGroup(bindGroupDesc);
+        lightViewProjMatrices[cascade] = mShadowCascadeTargets[cascade];
+        cache.valid = true;
+        cache.lightViewProjMatrix = mShadowCascadeTargets[cascade];
+        cache.modelMatrix = planet.modelMatrix;
+        cache.geometryVersion = mGeometryVersion;
+        mShadowCascadesToRender.push_back(cascade);
+        mShadowPassesRendered++;
+    }
+    mShadowFrameIndex++;
 
-    return true;
+    mSceneUniforms.set(&SceneUniforms::lightViewProjMatrices, lightViewProjMatrices);
 }
 
 bool Renderer::setSkyboxPipeline() {
-    string shaderPath = ASSETS_DIR "/skybox/shader.wgsl";
+    std::vector<ResourceManager::path> shaderPaths = {ASSETS_DIR "/common/uniforms.wgsl", ASSETS_DIR "/skybox/shader.wgsl"};
     std::cout << "Creating shader module..." << std::endl;
-    wgpu::ShaderModule shaderModule = ResourceManager::loadShaderModule(shaderPath, mDevice);
+    wgpu::ShaderModule shaderModule = ResourceManager::loadShaderModule(shaderPaths, mDevice);
     std::cout << "Shader module: " << shaderModule << std::endl;
 
     std::cout << "Creating skybox render pipeline..." << std::endl;
@@ -891,24 +1490,18 @@ bool Renderer::setSkyboxPipeline() {
     pipelineDesc.multisample.mask = ~0u;
     pipelineDesc.multisample.alphaToCoverageEnabled = false;
 
-    int entriesCount = 3;
+    // the skybox material has no uniforms, only its textures
+    int entriesCount = 2;
     std::vector<BindGroupLayoutEntry> bindingLayoutEntries(entriesCount, Default);
 
-    // Uniform buffer
-    BindGroupLayoutEntry& bindingLayout = bindingLayoutEntries[0];
-    bindingLayout.binding = 0;
-    bindingLayout.visibility = ShaderStage::Vertex | ShaderStage::Fragment;
-    bindingLayout.buffer.type = BufferBindingType::Uniform;
-    bindingLayout.buffer.minBindingSize = sizeof(SceneUniforms);
-
     // Sampler
-    BindGroupLayoutEntry& samplerBindingLayout = bindingLayoutEntries[1];
+    BindGroupLayoutEntry& samplerBindingLayout = bindingLayoutEntries[0];
     samplerBindingLayout.binding = 1;
     samplerBindingLayout.visibility = ShaderStage::Fragment;
     samplerBindingLayout.sampler.type = SamplerBindingType::Filtering;
 
     // Base color of the skybox
-    BindGroupLayoutEntry& baseColorTextureBindingLayout = bindingLayoutEntries[2];
+    BindGroupLayoutEntry& baseColorTextureBindingLayout = bindingLayoutEntries[1];
     baseColorTextureBindingLayout.binding = 2;
     baseColorTextureBindingLayout.visibility = ShaderStage::Fragment;
     baseColorTextureBindingLayout.texture.sampleType = TextureSampleType::Float;
@@ -921,11 +1514,7 @@ bool Renderer::setSkyboxPipeline() {
     BindGroupLayout bindGroupLayout = mDevice.createBindGroupLayout(bindGroupLayoutDesc);
 
     // Create the pipeline layout
-    PipelineLayoutDescriptor layoutDesc{};
-    layoutDesc.bindGroupLayoutCount = 1;
-    layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
-    PipelineLayout layout = mDevice.createPipelineLayout(layoutDesc);
-    pipelineDesc.layout = layout;
+    pipelineDesc.layout = createPipelineLayout({mSceneBindGroupLayout, mObjectBindGroupLayout, mFrameBindGroupLayout, bindGroupLayout});
 
     mSkyboxPipeline = mDevice.createRenderPipeline(pipelineDesc);
     std::cout << "Skybox pipeline: " << mSkyboxPipeline << std::endl;
@@ -961,34 +1550,12 @@ bool Renderer::setSkyboxPipeline() {
 
     mSkyboxVertexCount = static_cast<int>(mSkyboxVertexData.size());
 
-    // Create uniform buffer
-    bufferDesc.size = sizeof(SceneUniforms);
-    bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
-    bufferDesc.mappedAtCreation = false;
-    mSkyboxUniformBuffer = mDevice.createBuffer(bufferDesc);
-
-    // Upload the initial value of the uniforms
-    mSkyboxUniforms.modelMatrix = glm::mat4(1.0f);
-    mSkyboxUniforms.viewMatrix = glm::lookAt(vec3(1.0f), vec3(0.0f), vec3(0, 1, 0));
-    mSkyboxUniforms.projectionMatrix = glm::perspective(
-        glm::radians(fov),
-        float(mSwapChainDesc.width) / float(mSwapChainDesc.height),
-        near, far);
-    mSkyboxUniforms.time = 1.0f;
-    mQueue.writeBuffer(mSkyboxUniformBuffer, 0, &mSkyboxUniforms, sizeof(SceneUniforms));
-
     // Add the data to the actual bindings
     std::vector<BindGroupEntry> bindings(entriesCount);
 
-    // uniform
-    bindings[0].binding = 0;
-    bindings[0].buffer = mSkyboxUniformBuffer;
-    bindings[0].offset = 0;
-    bindings[0].size = sizeof(SceneUniforms);
-
     // sampler
-    bindings[1].binding = 1;
-    bindings[1].sampler = mSkyboxSampler;
+    bindings[0].binding = 1;
+    bindings[0].sampler = mSkyboxSampler;
 
     // loab cubemaps
     string baseColorTexturePath = ASSETS_DIR "/skybox";
@@ -998,8 +1565,8 @@ bool Renderer::setSkyboxPipeline() {
         std::cerr << "Could not load texture!" << std::endl;
         return false;
     }
-    bindings[2].binding = 2;
-    bindings[2].textureView = mSkyboxTextureView;
+    bindings[1].binding = 2;
+    bindings[1].textureView = mSkyboxTextureView;
 
     BindGroupDescriptor bindGroupDesc;
     bindGroupDesc.layout = bindGroupLayout;
@@ -1011,88 +1578,142 @@ bool Renderer::setSkyboxPipeline() {
 
 // updates the view stuff given the new camera position
 void Renderer::updateCamera(glm::vec3 position) {
-    // update the view position
-    mUniforms.viewPosition = glm::vec4(position.x, position.y, position.z, 1.0);
-    mQueue.writeBuffer(
-        mUniformBuffer,
-        offsetof(SceneUniforms, viewPosition),
-        &mUniforms.viewPosition,
-        sizeof(SceneUniforms::viewPosition));
-
-    // update the view matrix for the model
-    mUniforms.viewMatrix = glm::lookAt(position, vec3(0.0f), vec3(0, 1, 0));
-    mQueue.writeBuffer(
-        mUniformBuffer,
-        offsetof(SceneUniforms, viewMatrix),
-        &mUniforms.viewMatrix,
-        sizeof(SceneUniforms::viewMatrix));
-    mUniforms.invViewMatrix = glm::inverse(mUniforms.viewMatrix);
-    mQueue.writeBuffer(
-        mUniformBuffer,
-        offsetof(SceneUniforms, invViewMatrix),
-        &mUniforms.invViewMatrix,
-        sizeof(SceneUniforms::invViewMatrix));
-
-    // update the view matrix for the skybox
-    // we get rid of the translation part also with an intermediary mat3
-    mSkyboxUniforms.viewMatrix = glm::mat4(glm::mat3(glm::lookAt(position, vec3(0.0f), vec3(0, 1, 0))));
-    mQueue.writeBuffer(
-        mSkyboxUniformBuffer,
-        offsetof(SceneUniforms, viewMatrix),
-        &mSkyboxUniforms.viewMatrix,
-        sizeof(SceneUniforms::viewMatrix));
+    // update the view position (only sent with the next frame)
+    mFrameUniforms.set(&FrameUniforms::viewPosition, glm::vec4(position.x, position.y, position.z, 1.0));
+
+    // update the view matrix, the skybox shader gets rid of its translation part
+    mat4x4 viewMatrix = glm::lookAt(position, vec3(0.0f), vec3(0, 1, 0));
+    mFrameUniforms.set(&FrameUniforms::viewMatrix, viewMatrix);
+    mFrameUniforms.set(&FrameUniforms::invViewMatrix, glm::inverse(viewMatrix));
+
+    mCullingDirty = true;
+}
+
+// keep the clusters facing the camera, inside the view frustum and in front of the horizon
+// the tiles are tested first, the clusters only if their tile is visible
+// consecutive visible clusters are merged in a single draw
+void Renderer::cullPlanetClusters() {
+    mVisibleRanges.clear();
+    mCullingStats = CullingStats();
+    std::vector<Cluster> const& clusters = mTerrainClusters.clusters;
+    if (clusters.empty() ||
+        clusters.back().firstIndex + clusters.back().indexCount != (uint32_t)mIndexCount ||
+        mTerrainClusters.tileFirstCluster.size() != mTerrainBounds.tiles.size() + 1) {
+        // no clusters for this index buffer: draw everything
+        mVisibleRanges.push_back({0, (uint32_t)mIndexCount});
+        return;
+    }
+
+    Frustum frustum(mSceneUniforms.get().projectionMatrix * mFrameUniforms.get().viewMatrix);
+    vec3 cameraPosition = vec3(mFrameUniforms.get().viewPosition);
+    // nothing of the terrain is below its lowest point
+    HorizonOccluder horizon(cameraPosition, mTerrainBounds.planet.minRadius);
+
+    auto addVisible = [&](uint32_t first, uint32_t count) {
+        if (!mVisibleRanges.empty() && mVisibleRanges.back().first + mVisibleRanges.back().count == first) {
+            mVisibleRanges.back().count += count;
+        } else {
+            mVisibleRanges.push_back({first, count});
+        }
+    };
+    for (size_t tile = 0; tile < mTerrainBounds.tiles.size(); tile++) {
+        Bounds const& bounds = mTerrainBounds.tiles[tile];
+        Cluster const& firstCluster = clusters[mTerrainClusters.tileFirstCluster[tile]];
+        Cluster const& lastCluster = clusters[mTerrainClusters.tileFirstCluster[tile + 1] - 1];
+        uint32_t tileTriangles = (lastCluster.firstIndex + lastCluster.indexCount - firstCluster.firstIndex) / 3;
+
+        if (!frustum.intersectsBox(bounds.min, bounds.max)) {
+            mCullingStats.frustumTriangles += tileTriangles;
+            continue;
+        }
+        if (horizon.hides(bounds.center(), glm::length(bounds.max - bounds.min) * 0.5f)) {
+            mCullingStats.horizonTriangles += tileTriangles;
+            continue;
+        }
+        for (uint32_t c = mTerrainClusters.tileFirstCluster[tile]; c < mTerrainClusters.tileFirstCluster[tile + 1]; c++) {
+            Cluster const& cluster = clusters[c];
+            if (cluster.backFacing(cameraPosition)) {
+                mCullingStats.backFacingTriangles += cluster.indexCount / 3;
+            } else if (!frustum.intersectsSphere(cluster.center, cluster.radius)) {
+                mCullingStats.frustumTriangles += cluster.indexCount / 3;
+            } else if (horizon.hides(cluster.center, cluster.radius)) {
+                mCullingStats.horizonTriangles += cluster.indexCount / 3;
+            } else {
+                mCullingStats.visibleClusters++;
+                addVisible(cluster.firstIndex, cluster.indexCount);
+            }
+        }
+    }
+}
+
+// the light is a direction: only the normal cones of the clusters matter, not where the camera is
+void Renderer::cullShadowClusters() {
+    mShadowRanges.clear();
+    mShadowBackFacingTriangles = 0;
+    if (mShadowLevels.empty() || mShadowLevels.back().firstIndex + mShadowLevels.back().indexCount != (uint32_t)mShadowIndexData.size()) {
+        // no levels for these shadow casters: draw them all in every cascade
+        mShadowRanges.push_back({{0, (uint32_t)mShadowIndexData.size()}});
+        return;
+    }
+    mShadowRanges.resize(mShadowLevels.size());
+
+    vec3 lightDirection = glm::normalize(vec3(mSunPosition));
+    for (size_t level = 0; level < mShadowLevels.size(); level++) {
+        std::vector<Cluster> const& clusters = mShadowLevels[level].clusters.clusters;
+        std::vector<IndexRange>& ranges = mShadowRanges[level];
+        if (clusters.empty()) {
+            ranges.push_back({mShadowLevels[level].firstIndex, mShadowLevels[level].indexCount});
+            continue;
+        }
+        for (Cluster const& cluster : clusters) {
+            if (cluster.backFacingDirection(lightDirection)) {
+                mShadowBackFacingTriangles += cluster.indexCount / 3;
+            } else if (!ranges.empty() && ranges.back().first + ranges.back().count == cluster.firstIndex) {
+                ranges.back().count += cluster.indexCount;
+            } else {
+                ranges.push_back({cluster.firstIndex, cluster.indexCount});
+            }
+        }
+    }
+}
+
+// world space ray going through a point of the screen, by unprojecting it on the near and far planes
+void Renderer::getCameraRay(glm::vec2 ndc, glm::vec3& origin, glm::vec3& direction) {
+    mat4x4 invViewProj = glm::inverse(mSceneUniforms.get().projectionMatrix * mFrameUniforms.get().viewMatrix);
+    vec4 nearPoint = invViewProj * vec4(ndc.x, ndc.y, 0.0f, 1.0f);
+    vec4 farPoint = invViewProj * vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+    origin = vec3(nearPoint) / nearPoint.w;
+    direction = glm::normalize(vec3(farPoint) / farPoint.w - origin);
+}
+
+// only the vertices touched by the brush are sent, the buffer and the pipeline stay the same
+void Renderer::updatePlanetVertices(
+    std::vector<VertexAttributes> const& vertexData,
+    std::vector<VertexRange> const& ranges) {
+    if (mVertexBuffer == nullptr || vertexData.size() != (size_t)mVertexCount) return;
+    for (VertexRange const& range : ranges) {
+        mQueue.writeBuffer(
+            mVertexBuffer,
+            range.first * sizeof(VertexAttributes),
+            &vertexData[range.first],
+            range.count * sizeof(VertexAttributes));
+    }
+    mGeometryVersion++;
 }
 
 void Renderer::setOceanSettings() {
-    mUniforms.oceanRadius = mGUISettings.oceanRadius;
-    mQueue.writeBuffer(
-        mUniformBuffer,
-        offsetof(SceneUniforms, oceanRadius),
-        &mUniforms.oceanRadius,
-        sizeof(SceneUniforms::oceanRadius));
-    mUniforms.oceanColor.r = mGUISettings.oceanColor[0];
-    mUniforms.oceanColor.g = mGUISettings.oceanColor[1];
-    mUniforms.oceanColor.b = mGUISettings.oceanColor[2];
-    mQueue.writeBuffer(
-        mUniformBuffer,
-        offsetof(SceneUniforms, oceanColor),
-        &mUniforms.oceanColor,
-        sizeof(SceneUniforms::oceanColor));
-    mUniforms.oceanShininess = mGUISettings.oceanShininess;
-    mQueue.writeBuffer(
-        mUniformBuffer,
-        offsetof(SceneUniforms, oceanShininess),
-        &mUniforms.oceanShininess,
-        sizeof(SceneUniforms::oceanShininess));
-    mUniforms.oceanKSpecular = mGUISettings.oceanKSpecular;
-    mQueue.writeBuffer(
-        mUniformBuffer,
-        offsetof(SceneUniforms, oceanKSpecular),
-        &mUniforms.oceanKSpecular,
-        sizeof(SceneUniforms::oceanKSpecular));
+    mObjectUniforms.set(OceanObject, &ObjectUniforms::radius, mGUISettings.oceanRadius);
+    vec4 oceanColor(mGUISettings.oceanColor[0], mGUISettings.oceanColor[1], mGUISettings.oceanColor[2], 1.0f);
+    mMaterialUniforms.set(OceanMaterial, &MaterialUniforms::color, oceanColor);
+    mMaterialUniforms.set(OceanMaterial, &MaterialUniforms::shininess, mGUISettings.oceanShininess);
+    mMaterialUniforms.set(OceanMaterial, &MaterialUniforms::kSpecular, mGUISettings.oceanKSpecular);
 }
 
 void Renderer::setTerrainMaterialSettings() {
-    mUniforms.baseColor.r = mGUISettings.baseColor[0];
-    mUniforms.baseColor.g = mGUISettings.baseColor[1];
-    mUniforms.baseColor.b = mGUISettings.baseColor[2];
-    mQueue.writeBuffer(
-        mUniformBuffer,
-        offsetof(SceneUniforms, baseColor),
-        &mUniforms.baseColor,
-        sizeof(SceneUniforms::baseColor));
-    mUniforms.terrainShininess = mGUISettings.terrainShininess;
-    mQueue.writeBuffer(
-        mUniformBuffer,
-        offsetof(SceneUniforms, terrainShininess),
-        &mUniforms.terrainShininess,
-        sizeof(SceneUniforms::terrainShininess));
-    mUniforms.terrainKSpecular = mGUISettings.terrainKSpecular;
-    mQueue.writeBuffer(
-        mUniformBuffer,
-        offsetof(SceneUniforms, terrainKSpecular),
-        &mUniforms.terrainKSpecular,
-        sizeof(SceneUniforms::terrainKSpecular));
+    vec4 baseColor(mGUISettings.baseColor[0], mGUISettings.baseColor[1], mGUISettings.baseColor[2], 1.0f);
+    mMaterialUniforms.set(TerrainMaterial, &MaterialUniforms::color, baseColor);
+    mMaterialUniforms.set(TerrainMaterial, &MaterialUniforms::shininess, mGUISettings.terrainShininess);
+    mMaterialUniforms.set(TerrainMaterial, &MaterialUniforms::kSpecular, mGUISettings.terrainKSpecular);
 }
 
 void Renderer::updateGui(RenderPassEncoder renderPass) {
@@ -1108,10 +1729,39 @@ void Renderer::updateGui(RenderPassEncoder renderPass) {
 
         // Planet construction part
         ImGui::SeparatorText("Planet shape");
-        planetSettingsChanged = ImGui::SliderInt("resolution", &(mGUISettings.resolution), 2, 500) || planetSettingsChanged;  // count of vertices per face
+        planetSettingsChanged = ImGui::SliderInt("resolution", &(mGUISettings.resolution), 2, 1000) || planetSettingsChanged;  // count of vertices per face
         planetSettingsChanged = ImGui::SliderFloat("radius", &(mGUISettings.radius), 1.0f, 10.0f) || planetSettingsChanged;
         planetSettingsChanged = ImGui::SliderFloat("noise frequency", &(mGUISettings.frequency), 0.001f, 5.0f) || planetSettingsChanged;
         planetSettingsChanged = ImGui::SliderInt("noise octaves", &(mGUISettings.octaves), 1, 10) || planetSettingsChanged;  // count of vertices per face
+        const char* tessellations[] = {"Cube sphere", "Icosphere", "HEALPix"};
+        int tessellation = int(mGUISettings.tessellation);
+        if (ImGui::Combo("tessellation", &tessellation, tessellations, IM_ARRAYSIZE(tessellations))) {
+            mGUISettings.tessellation = Tessellation(tessellation);
+            planetSettingsChanged = true;
+        }
+        if (mGUISettings.tessellation == Tessellation::CubeSphere) {
+            const char* projections[] = {"Normalize", "Tangent", "Equal area"};
+            int projection = int(mGUISettings.projection);
+            if (ImGui::Combo("cube projection", &projection, projections, IM_ARRAYSIZE(projections))) {
+                mGUISettings.projection = CubeProjection(projection);
+                planetSettingsChanged = true;
+            }
+            // merge the flat parts of the grid in bigger triangles, under the given distance to the full grid
+            planetSettingsChanged = ImGui::Checkbox("simplify", &(mGUISettings.simplify)) || planetSettingsChanged;
+            if (mGUISettings.simplify) {
+                planetSettingsChanged = ImGui::SliderFloat("simplify error", &(mGUISettings.simplifyError), 0.0001f, 0.05f, "%.4f", ImGuiSliderFlags_Logarithmic) || planetSettingsChanged;
+            }
+        }
+
+        // Sculpting brush, the left click paints on the planet instead of orbiting when a brush is selected
+        ImGui::SeparatorText("Sculpting");
+        const char* brushModes[] = {"Off", "Raise", "Lower", "Smooth"};
+        int brushMode = int(mGUISettings.brushMode);
+        if (ImGui::Combo("brush", &brushMode, brushModes, IM_ARRAYSIZE(brushModes))) {
+            mGUISettings.brushMode = BrushMode(brushMode);
+        }
+        ImGui::SliderFloat("brush radius", &(mGUISettings.brushRadius), 0.01f, 2.0f);
+        ImGui::SliderFloat("brush strength", &(mGUISettings.brushStrength), 0.001f, 0.05f);
 
         // Planet terrain material
         ImGui::SeparatorText("Terrain material");
@@ -1133,12 +1783,162 @@ void Renderer::updateGui(RenderPassEncoder renderPass) {
         if (oceanSettingsChanged) {
             setOceanSettings();
         }
+        // the target is created again at the start of the next frame
+        const char* oceanResolutions[] = {"Full", "Half", "Quarter"};
+        ImGui::Combo("ocean resolution", &(mGUISettings.oceanDownscale), oceanResolutions, IM_ARRAYSIZE(oceanResolutions));
+
+        // Shadows, the map is created again at the start of the next frame
+        ImGui::SeparatorText("Shadows");
+        mShadowMapDirty = ImGui::SliderInt("shadow cascades", &(mGUISettings.shadowCascades), 1, int(MAX_SHADOW_CASCADES)) || mShadowMapDirty;
+        const char* shadowMapSizes[] = {"1024", "2048", "4096"};
+        int shadowMapSize = mGUISettings.shadowMapSize >= 4096 ? 2 : mGUISettings.shadowMapSize >= 2048 ? 1 : 0;
+        if (ImGui::Combo("shadow map size", &shadowMapSize, shadowMapSizes, IM_ARRAYSIZE(shadowMapSizes))) {
+            mGUISettings.shadowMapSize = 1024 << shadowMapSize;
+            mShadowMapDirty = true;
+            // the shadow casters are simplified down to the texels of the map
+            planetSettingsChanged = true;
+        }
+        mShadowMapDirty = ImGui::Checkbox("16 bit shadow depth", &(mGUISettings.shadowDepth16)) || mShadowMapDirty;
+        ImGui::SliderInt("far cascade period", &(mGUISettings.shadowFarCascadePeriod), 1, 8);
+        ImGui::SliderFloat("sun speed", &(mGUISettings.sunSpeed), -30.0f, 30.0f, "%.1f deg/s");
+        ImGui::Text("Shadow map: %u x %u x %u (%.1f MB)", mShadowDepthTextureSize, mShadowDepthTextureSize, mShadowCascadeCount,
+                    float(mShadowDepthTextureSize) * float(mShadowDepthTextureSize) * float(mShadowCascadeCount) * (mShadowDepthTextureFormat == TextureFormat::Depth16Unorm ? 2.0f : 4.0f) / (1024.0f * 1024.0f));
+
+        // the present mode is applied at the start of the next frame, the rest before its inputs are read
+        ImGui::SeparatorText("Presentation");
+        const char* presentModes[] = {"Fifo (vsync)", "Mailbox", "Immediate"};
+        ImGui::Combo("present mode", &(mGUISettings.presentMode), presentModes, IM_ARRAYSIZE(presentModes));
+        ImGui::SliderFloat("frame time limit", &(mGUISettings.targetFrameMs), 0.0f, 50.0f, mGUISettings.targetFrameMs > 0.0f ? "%.1f ms" : "none");
+        ImGui::SliderInt("max frames in flight", &(mGUISettings.maxFramesInFlight), 1, MAX_FRAMES_IN_FLIGHT);
+        ImGui::Text("Frames in flight: %llu, waited %.2f ms", (unsigned long long)(mFramesSubmitted - mFramesCompleted), mFrameWaitMs);
+        if (mInputLatencyMs < 0.0) {
+            ImGui::Text("Input to present: move the camera to measure it");
+        } else {
+            ImGui::Text("Input to present: %.1f ms (average %.1f ms)", mInputLatencyMs, mAverageInputLatencyMs);
+        }
 
         mGUISettings.planetSettingsChanged = planetSettingsChanged;
         ImGui::SeparatorText("Debug");
-        ImGui::Text("View pos: (%.3f, %.3f, %.3f)", mUniforms.viewPosition.x, mUniforms.viewPosition.y, mUniforms.viewPosition.z);
+        ImGui::Text("View pos: (%.3f, %.3f, %.3f)", mFrameUniforms.get().viewPosition.x, mFrameUniforms.get().viewPosition.y, mFrameUniforms.get().viewPosition.z);
         ImGuiIO& io = ImGui::GetIO();
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+        ImGui::Text("Planet drawn %s", mVertexPulling ? "without index buffer" : "with an index buffer");
+        ImGui::Text("Regeneration to first frame: %.2f ms (submitted after %.2f ms)", mFirstFrameMs, mFirstFrameSubmitMs);
+        if (!mTerrainClusters.clusters.empty()) {
+            ImGui::Text("Clusters: %u / %zu visible (%zu draws)", mCullingStats.visibleClusters, mTerrainClusters.clusters.size(), mVisibleRanges.size());
+            ImGui::Text("Culled triangles: %u / %d", mCullingStats.culledTriangles(), mIndexCount / 3);
+            ImGui::Text("  frustum %u, horizon %u, back facing %u",
+                        mCullingStats.frustumTriangles, mCullingStats.horizonTriangles, mCullingStats.backFacingTriangles);
+        }
+        ImGui::Text("Shadow casters: %zu triangles in %zu levels (planet %d), %u facing away from the sun",
+                    mShadowIndexData.size() / 3, std::max<size_t>(mShadowLevels.size(), 1), mIndexCount / 3, mShadowBackFacingTriangles);
+        for (uint32_t cascade = 0; cascade < mShadowCascadeCount && !mShadowLevels.empty(); cascade++) {
+            uint32_t level = std::min(mShadowCascadeLevels[cascade], (uint32_t)mShadowLevels.size() - 1);
+            ImGui::Text("  cascade %u: level %u (%u triangles)", cascade, level, mShadowLevels[level].indexCount / 3);
+        }
+        double oceanMs = mOceanGpuMs[mOceanDownscale], fullOceanMs = mOceanGpuMs[0];
+        if (!mGpuTimer.isEnabled()) {
+            ImGui::Text("Ocean GPU time: no GPU timings");
+        } else if (oceanMs < 0.0) {
+            ImGui::Text("Ocean GPU time: measuring...");
+        } else if (mOceanDownscale == 0 || fullOceanMs < 0.0) {
+            ImGui::Text("Ocean GPU time: %.3f ms", oceanMs);
+        } else {
+            ImGui::Text("Ocean GPU time: %.3f ms (full resolution %.3f ms, saved %.3f ms)", oceanMs, fullOceanMs, fullOceanMs - oceanMs);
+        }
+        if (mOceanVisibility == OceanVisible) {
+            vec2 oceanSize = (mOceanBoundsMax - mOceanBoundsMin) * 0.5f;
+            ImGui::Text("Ocean bounds: %.0f%% of the screen", 100.0f * oceanSize.x * oceanSize.y);
+        } else {
+            ImGui::Text("Ocean bounds: skipped, %s", mOceanVisibility == OceanOffScreen ? "off screen" : "under the terrain");
+        }
+        ImGui::Text("Shadow cascade passes: %llu rendered, %llu skipped, %llu deferred",
+                    (unsigned long long)mShadowPassesRendered, (unsigned long long)mShadowPassesSkipped, (unsigned long long)mShadowPassesDeferred);
+        // the GUI is drawn by the last pass: the graph of this frame is already compiled
+        ImGui::Text("Render graph: %u passes in %u render passes, %u culled",
+                    mRenderGraph.getPassCount(), mRenderGraph.getRenderPassCount(), mRenderGraph.getCulledCount());
+        ImGui::SameLine();
+        if (ImGui::Button("Print")) {
+            mPrintRenderGraph = true;
+        }
+        // GPU time of each kind of pass in the last frames, read back a few frames late
+        if (!mGpuTimer.isAvailable()) {
+            ImGui::Text("GPU timings: no timestamp queries on this adapter");
+        } else {
+            bool gpuTimings = mGpuTimer.isEnabled();
+            if (ImGui::Checkbox("GPU timings (the timed passes are not merged)", &gpuTimings)) {
+                mGpuTimer.setEnabled(gpuTimings);
+            }
+            for (uint32_t pass = 0; gpuTimings && pass < TimedPassCount; pass++) {
+                char overlay[32];
+                std::snprintf(overlay, sizeof(overlay), "%.3f ms", std::max(mGpuTimer.getPassMs(pass), 0.0));
+                ImGui::PlotLines(TIMED_PASS_NAMES[pass], mGpuTimer.getHistory(pass), GpuTimer::HISTORY_SIZE,
+                                 mGpuTimer.getHistoryOffset(), overlay, 0.0f, FLT_MAX, ImVec2(0, 40));
+            }
+            if (ImGui::Button("Export GPU timings to CSV")) {
+                std::ofstream file("gpu_timings.csv");
+                if (file.is_open()) {
+                    mGpuTimer.writeCsv(file, std::vector<std::string>(TIMED_PASS_NAMES, TIMED_PASS_NAMES + TimedPassCount));
+                }
+                if (file.is_open() && file.good()) {
+                    std::cout << "GPU timings written to gpu_timings.csv" << std::endl;
+                } else {
+                    std::cerr << "Could not write gpu_timings.csv" << std::endl;
+                }
+            }
+        }
+        ImGui::Text("Uniform writes: %u (%llu bytes)",
+                    mSceneUniforms.getWriteCount() + mObjectUniforms.getWriteCount() + mFrameUniforms.getWriteCount() + mMaterialUniforms.getWriteCount(),
+                    (unsigned long long)(mSceneUniforms.getWriteBytes() + mObjectUniforms.getWriteBytes() + mFrameUniforms.getWriteBytes() + mMaterialUniforms.getWriteBytes()));
+        if (!mTerrainBounds.planet.empty()) {
+            ImGui::Text("Terrain radius: %.3f - %.3f", mTerrainBounds.planet.minRadius, mTerrainBounds.planet.maxRadius);
+            float histogram[TerrainBounds::HISTOGRAM_BINS];
+            for (unsigned int i = 0; i < TerrainBounds::HISTOGRAM_BINS; i++) {
+                histogram[i] = float(mTerrainBounds.histogram[i]);
+            }
+            ImGui::PlotHistogram("elevation", histogram, TerrainBounds::HISTOGRAM_BINS, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+        }
+#if PROCPLANETS_STATS
+        ImGui::Text("Noise samples: %llu (%llu octaves)",
+                    (unsigned long long)mGenerationStats.samplesEvaluated,
+                    (unsigned long long)mGenerationStats.octavesEvaluated);
+        ImGui::Text("Noise cache: %llu hits, %llu misses",
+                    (unsigned long long)mGenerationStats.cacheHits,
+                    (unsigned long long)mGenerationStats.cacheMisses);
+        ImGui::Text("Noise: %.2f ms CPU, summed over the threads (%.1f ns/sample)", mGenerationStats.noiseMs, mGenerationStats.nsPerSample());
+        ImGui::Text("Normals: %.2f ms", mGenerationStats.normalsMs);
+        ImGui::Text("Upload: %.2f ms", mGenerationStats.uploadMs);
+        ImGui::Text("Total generation: %.2f ms", mGenerationStats.totalMs);
+        ImGui::Text("Vertex cache: ACMR %.3f (row order %.3f), ATVR %.3f", mGenerationStats.acmr, mGenerationStats.acmrRowMajor, mGenerationStats.atvr);
+        ImGui::Text("Grid edges: max %.5f (max / min %.2f)", mGenerationStats.maxEdgeLength, mGenerationStats.edgeLengthRatio);
+        if (mGUISettings.tessellation == Tessellation::CubeSphere) {
+            ImGui::Text("Same max edge: normalize %llu, tangent %llu, equal area %llu triangles",
+                        (unsigned long long)mGenerationStats.equalEdgeTrianglesNormalize,
+                        (unsigned long long)mGenerationStats.equalEdgeTrianglesTangent,
+                        (unsigned long long)mGenerationStats.equalEdgeTrianglesEqualArea);
+        }
+        ImGui::Text("Same max edge: cube %llu, icosphere %llu, HEALPix %llu vertices",
+                    (unsigned long long)mGenerationStats.equalEdgeVerticesCube,
+                    (unsigned long long)mGenerationStats.equalEdgeVerticesIcosphere,
+                    (unsigned long long)mGenerationStats.equalEdgeVerticesHEALPix);
+        if (mGUISettings.tessellation != Tessellation::CubeSphere) {
+            ImGui::Text("Tessellation: %.2f ms", mGenerationStats.tessellationMs);
+        }
+        if (mGUISettings.simplify && mGUISettings.tessellation == Tessellation::CubeSphere) {
+            ImGui::Text("Simplified: %llu / %llu triangles, max error %.4f (rms %.4f)",
+                        (unsigned long long)mGenerationStats.simplifiedTriangles,
+                        (unsigned long long)mGenerationStats.fullTriangles,
+                        mGenerationStats.simplifyMaxError, mGenerationStats.simplifyRmsError);
+        }
+        ImGui::Text("Shadow proxy: %.2f ms, %llu levels (min step %llu)", mGenerationStats.shadowMs,
+                    (unsigned long long)mGenerationStats.shadowLevels, (unsigned long long)mGenerationStats.shadowMinStep);
+        ImGui::Text("Last stroke: %.2f ms (%llu vertices)", mGenerationStats.sculptMs, (unsigned long long)mGenerationStats.sculptVertices);
+        if (ImGui::Button("Dump stats to JSON")) {
+            std::ofstream file("generation_stats.json");
+            file << mGenerationStats.toJson();
+            std::cout << "Generation stats written to generation_stats.json" << std::endl;
+        }
+#endif
         ImGui::End();
     }
 
@@ -1152,31 +1952,65 @@ void Renderer::terminatePlanetPipeline() {
     // check if there's something to release
     if (mPipeline != nullptr) {
         mPipeline.release();
+        mGridPipeline.release();
+        mBindGroupLayout.release();
+        mShadowPipeline.release();
+        mShadowPulledPipeline.release();
+        mShadowSampler.release();
+        mPipeline = nullptr;
+    }
+    if (mBindGroup != nullptr) {
         mBindGroup.release();
-
-        mVertexBuffer.destroy();
-        mVertexBuffer.release();
-        mIndexBuffer.destroy();
-        mIndexBuffer.release();
+        mPlanetObjectBindGroup.release();
+        mBindGroup = nullptr;
+        mPlanetObjectBindGroup = nullptr;
+    }
+    for (wgpu::Buffer* buffer : {&mVertexBuffer, &mIndexBuffer, &mShadowIndexBuffer}) {
+        if (*buffer != nullptr) {
+            buffer->destroy();
+            buffer->release();
+            *buffer = nullptr;
+        }
     }
+    mVertexBufferSize = mIndexBufferSize = mShadowIndexBufferSize = 0;
 }
 
 void Renderer::terminate() {
     terminatePlanetPipeline();
 
-    mUniformBuffer.release();
+    for (BindGroup bindGroup : {mSceneBindGroup, mObjectBindGroup, mFrameBindGroup}) {
+        bindGroup.release();
+    }
+    for (BindGroupLayout bindGroupLayout : {mSceneBindGroupLayout, mObjectBindGroupLayout, mPlanetObjectBindGroupLayout, mFrameBindGroupLayout}) {
+        bindGroupLayout.release();
+    }
+    mSceneUniforms.release();
+    mObjectUniforms.release();
+    mFrameUniforms.release();
+    mMaterialUniforms.release();
     mSampler.release();
 
     mDepthTextureView.release();
     mDepthTexture.destroy();
     mDepthTexture.release();
+    releaseShadowDepthTexture();
+    if (mOceanCompositeBindGroup != nullptr) mOceanCompositeBindGroup.release();
+    mRenderGraph.release();
+    mGpuTimer.release([this]() { pollDevice(); });
 
     // TODO: should release the vertex buffer of the texture too
     mSkyboxTextureView.release();
     mSkyboxTexture.destroy();
     mSkyboxTexture.release();
 
-    mSwapChain.release();
+    if (mSwapChain != nullptr) mSwapChain.release();
+    if (mOffscreenTexture != nullptr) {
+        finishCaptures();
+        mFrameCapture.release();
+        mOffscreenTextureView.release();
+        mOffscreenTexture.destroy();
+        mOffscreenTexture.release();
+    }
     mQueue.release();
     mDevice.release();
     mAdapter.release();
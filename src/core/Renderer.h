@@ -1,6 +1,14 @@
 #pragma once
 
 #include "resource/ResourceManager.h"
+#include "procgen/CubeProjection.hpp"
+#include "procgen/GenerationStats.hpp"
+#include "procgen/TerrainBounds.hpp"
+#include "procgen/TerrainClusters.hpp"
+#include "core/FrameCapture.h"
+#include "core/GpuTimer.h"
+#include "core/RenderGraph.h"
+#include "core/UniformStaging.h"
 
 #include <glfw3webgpu.h>
 #include <GLFW/glfw3.h>
@@ -15,8 +23,37 @@
 #include <backends/imgui_impl_wgpu.h>
 #include <backends/imgui_impl_glfw.h>
 
+#include <chrono>
+#include <deque>
+#include <filesystem>
+
 using VertexAttributes = ResourceManager::VertexAttributes;
 
+// what the sculpting brush does to the terrain under the cursor
+enum class BrushMode : int {
+    Off = 0,
+    Raise,
+    Lower,
+    Smooth,
+};
+
+// how the unit sphere is split in triangles (see SphereTessellation)
+// - CubeSphere: the 6 faces of a cube, with the grid of FaceGenerator
+// - Icosphere: the 20 faces of an icosahedron, each one split in a triangular grid
+// - HEALPix: the 12 base pixels of HEALPix, each one split in a grid of equal area pixels
+// only the cube has tiles, simplification, sculpting and vertex pulling
+enum class Tessellation : int {
+    CubeSphere = 0,
+    Icosphere,
+    HEALPix,
+};
+
+// a range of vertices of the planet that changed and needs to be uploaded again
+struct VertexRange {
+    uint32_t first;
+    uint32_t count;
+};
+
 struct GUISettings {
     // default to true for the initial render
     // is only for the planet shape stuff
@@ -25,6 +62,11 @@ struct GUISettings {
     float radius = 1.0;
     float frequency = 1.0f;
     int octaves = 8;
+    Tessellation tessellation = Tessellation::CubeSphere;
+    CubeProjection projection = CubeProjection::Normalize;
+    // curvature adaptive simplification of the grid, with the max distance to the full grid in world units
+    bool simplify = false;
+    float simplifyError = 0.002f;
 
     // terrain material settings
     float baseColor[3]{0.48, 0.39, 0.31};
@@ -36,14 +78,66 @@ struct GUISettings {
     float oceanColor[3]{0.00, 0.55, 1.00};
     float oceanShininess = 32.0f;
     float oceanKSpecular = 1.0f;
+    // the ocean is shaded at 1 / 2^oceanDownscale of the screen resolution, then upsampled (0 is full resolution)
+    int oceanDownscale = 0;
+
+    // sculpting brush
+    BrushMode brushMode = BrushMode::Off;
+    float brushRadius = 0.2f;     // in world units
+    float brushStrength = 0.01f;  // elevation added per frame, relative to the radius
+
+    // shadow map: a layer of mapSize texels per cascade
+    int shadowCascades = 3;
+    int shadowMapSize = 2048;
+    bool shadowDepth16 = false;  // Depth16Unorm instead of Depth32Float, half the memory
+    // frames between 2 updates of a far cascade, the first one is updated every frame
+    int shadowFarCascadePeriod = 4;
+
+    // day and night cycle, in degrees per second around the Y axis (0 keeps the sun still)
+    float sunSpeed = 0.0f;
+
+    // presentation: Fifo, Mailbox or Immediate, a frame time to wait for (0 is no limit)
+    // and the frames the CPU can submit before it waits for the GPU
+    int presentMode = 0;
+    float targetFrameMs = 0.0f;
+    int maxFramesInFlight = 2;
 };
 
 class Renderer {
    public:
+    // offset of the depth compared with the shadow map, in the [0, 1] depth of the light (sent in SceneUniforms)
+    static constexpr float SHADOW_DEPTH_BIAS = 0.007f;
+    // the view is split in up to this many shadow cascades (the size of the light matrices in uniforms.wgsl)
+    static constexpr unsigned int MAX_SHADOW_CASCADES = 4;
+    // how the splits of the cascades are spread: 0 is uniform along the view, 1 is logarithmic
+    static constexpr float SHADOW_SPLIT_LAMBDA = 0.75f;
+    // down to a quarter of the screen resolution (see GUISettings::oceanDownscale)
+    static constexpr int MAX_OCEAN_DOWNSCALE = 2;
+    // the copies of the uniforms and of the GPU timer (see UniformStaging and GpuTimer)
+    static constexpr int MAX_FRAMES_IN_FLIGHT = 3;
+
     bool init(GLFWwindow* window);
-    bool setPlanetPipeline(
+    // without a window: the frames are drawn in an offscreen texture of the given size, without the GUI
+    // the fallback adapter is the software one of the backend, for the machines without a GPU
+    bool initHeadless(uint32_t width, uint32_t height, bool forceFallbackAdapter);
+    // save the next frame as a PNG, while the next ones render (headless only, see FrameCapture)
+    void captureFrame(std::filesystem::path const& path);
+    // wait for the captures to be saved, returns how many were
+    uint32_t finishCaptures();
+    // the pipelines of the planet and its shadows, created once
+    bool setPlanetPipeline();
+    // upload a new planet, in the existing buffers when they are big enough
+    // with a gridResolution, the planet is a cube sphere grid drawn without index buffer:
+    // the shaders pull the vertices from a storage buffer (the indices are still used for the culling ranges)
+    void setPlanetData(
         std::vector<VertexAttributes> const& vertexData,
-        std::vector<uint32_t> const& indices);
+        std::vector<uint32_t> const& indices,
+        unsigned int gridResolution = 0);
+    // the planet is about to be generated again: start timing until its first frame is done on the GPU
+    void beginPlanetUpdate() {
+        mPlanetUpdateTimer = StageTimer();
+        mPlanetUpdatePending = true;
+    };
     bool setSkyboxPipeline();
     bool setOceanPipeline();
     void terminate();
@@ -54,16 +148,68 @@ class Renderer {
     wgpu::TextureFormat getDepthTextureFormat() { return mDepthTextureFormat; };
     void updateCamera(glm::vec3 position);
     void resizeSwapChain(GLFWwindow* window);
+    // before the inputs of a frame are read: wait for the frame limiter, then for a frame in flight to be done
+    void waitForNextFrame();
+    // an input changed what the next frame shows, its latency is measured until that frame is done
+    void markInput();
+    // upload only the given ranges of the planet vertices, in the existing vertex buffer
+    void updatePlanetVertices(
+        std::vector<VertexAttributes> const& vertexData,
+        std::vector<VertexRange> const& ranges);
+    // world space ray going through a point of the screen, given in normalized device coordinates
+    void getCameraRay(glm::vec2 ndc, glm::vec3& origin, glm::vec3& direction);
     GUISettings getGUISettings() { return mGUISettings; };
+    void setGenerationStats(GenerationStats const& stats) { mGenerationStats = stats; };
+    // the shadow cascades are clamped to it
+    void setTerrainBounds(TerrainBounds const& bounds) {
+        mTerrainBounds = bounds;
+        mCullingDirty = true;
+    };
+    // the planet is only drawn cluster by cluster once they are set
+    void setTerrainClusters(TerrainClusters const& clusters) {
+        mTerrainClusters = clusters;
+        mCullingDirty = true;
+    };
+    // reduced triangles drawn in the shadow map, on the planet vertices
+    // must be set before the planet data, the shadow index buffer is filled with it
+    void setShadowIndices(std::vector<uint32_t> const& indices) { mShadowIndexData = indices; };
+    // after the sculpting: only the end of the buffer from the first index that changed is uploaded
+    void updateShadowIndices(std::vector<uint32_t> const& indices);
+    // the levels of detail of the shadow casters, each cascade draws the one made for its texels
+    // they are only drawn cluster by cluster once they are set (the back-facing ones are skipped)
+    void setShadowLevels(std::vector<ShadowLevel> const& levels) {
+        mShadowLevels = levels;
+        mShadowCullingDirty = true;
+        mGeometryVersion++;
+    };
+    // texels per side of a layer of the shadow map, the next one when it is about to change
+    unsigned int getShadowMapSize() const { return (unsigned int)mGUISettings.shadowMapSize; };
 
    private:
+    void initUniforms();
+    wgpu::PipelineLayout createPipelineLayout(std::vector<wgpu::BindGroupLayout> const& bindGroupLayouts);
+    bool initDevice(wgpu::RequestAdapterOptions const& adapterOpts);
     void buildSwapChain(GLFWwindow* window);
+    void setPresentMode(int presentMode);
+    void buildOffscreenTarget(uint32_t width, uint32_t height);
+    void pollDevice();
     void buildDepthTexture();
     void buildShadowDepthTexture();
+    void buildOceanCompositeBindGroup(wgpu::TextureView oceanTextureView);
+    void updateOceanBounds();
+    void setOceanScissor(wgpu::RenderPassEncoder renderPass, uint32_t width, uint32_t height, uint32_t margin);
+    void releaseShadowDepthTexture();
     void updateGui(wgpu::RenderPassEncoder renderPass);
     bool setShadowPipeline();
+    void setShadowMapSettings();
+    void updateShadowCascades();
+    void scheduleShadowCascades();
+    bool reserveBuffer(wgpu::Buffer& buffer, uint64_t& capacity, uint64_t size, WGPUBufferUsageFlags usage);
+    void buildPlanetBindGroups();
     void setOceanSettings();
     void setTerrainMaterialSettings();
+    void cullPlanetClusters();
+    void cullShadowClusters();
 
     // (Just aliases to make notations lighter)
     using mat4x4 = glm::mat4x4;
@@ -71,43 +217,69 @@ class Renderer {
     using vec3 = glm::vec3;
     using vec2 = glm::vec2;
 
+    // The uniforms, in the groups of common/uniforms.wgsl, by how often they change
+    // the scene: projection and light
     struct SceneUniforms {
-        // Transform matrices
         mat4x4 projectionMatrix;
         mat4x4 invProjectionMatrix;
-        mat4x4 viewMatrix;
-        mat4x4 invViewMatrix;
-        mat4x4 modelMatrix;
-        mat4x4 lightViewProjMatrix;
-
-        // Some more stuff, sometimes unused
-        vec4 color;
+        // one per cascade, they follow the camera
+        mat4x4 lightViewProjMatrices[MAX_SHADOW_CASCADES];
         vec4 lightDirection;
-        vec4 baseColor;
-        vec4 viewPosition;
-        float time;
         float fov;
-        float terrainShininess;
-        float terrainKSpecular;
-
         // swapchain height size
         float width;
         float height;
-        float _pad1[2];
-
-        // ocean settings
-        vec4 oceanColor;
-        float oceanRadius;
-        float oceanShininess;
-        float oceanKSpecular;
-        float _pad2[1];
+        uint32_t cascadeCount;
+        // SHADOW_DEPTH_BIAS, the shader has it from here
+        float shadowDepthBias;
+        float _pad[3];
+    };
+    // an object drawn, in its slot of the object uniforms
+    struct ObjectUniforms {
+        mat4x4 modelMatrix;
+        // resolution of the planet grid when the vertices are pulled from the storage buffer
+        uint32_t gridResolution;
+        // radius of the ocean sphere
+        float radius;
+        float _pad[2];
+    };
+    // the camera and the time, change every frame
+    struct FrameUniforms {
+        mat4x4 viewMatrix;
+        mat4x4 invViewMatrix;
+        vec4 viewPosition;
+        float time;
+        float _pad[3];
+    };
+    // the settings of a material, in its slot of the material uniforms
+    struct MaterialUniforms {
+        vec4 color;
+        float shininess;
+        float kSpecular;
+        float _pad[2];
     };
     // Have the compiler check byte alignment
     static_assert(sizeof(SceneUniforms) % 16 == 0);
+    static_assert(sizeof(ObjectUniforms) % 16 == 0);
+    static_assert(sizeof(FrameUniforms) % 16 == 0);
+    static_assert(sizeof(MaterialUniforms) % 16 == 0);
+
+    // the slots of the objects and of the materials
+    enum ObjectSlot : uint32_t {
+        PlanetObject = 0,
+        OceanObject,
+        SkyboxObject,
+        ObjectCount,
+    };
+    enum MaterialSlot : uint32_t {
+        TerrainMaterial = 0,
+        OceanMaterial,
+        MaterialCount,
+    };
 
     // some constant settings
-    // TODO: make the sun further ? Shadows are buggy on big planet.
-    vec4 mSunPosition = vec4({54.0f, 7.77f, 2.5f, 0.0f});
+    // the sun turns around the planet from there (see GUISettings::sunSpeed)
+    vec4 mSunStartPosition = vec4({54.0f, 7.77f, 2.5f, 0.0f});
     float near = 0.01f;
     float far = 100.0f;
     float fov = 45.0f;
@@ -118,7 +290,14 @@ class Renderer {
     wgpu::Device mDevice = nullptr;
     wgpu::Queue mQueue = nullptr;
     wgpu::SwapChain mSwapChain = nullptr;
+    // the size and format of the color target, with or without a swap chain
     wgpu::SwapChainDescriptor mSwapChainDesc;
+    // drawn instead of the swap chain without a window
+    bool mHeadless = false;
+    wgpu::Texture mOffscreenTexture = nullptr;
+    wgpu::TextureView mOffscreenTextureView = nullptr;
+    FrameCapture mFrameCapture;
+    std::filesystem::path mCapturePath;  // of the next frame, empty if it isn't captured
 
     // depth texture
     wgpu::Texture mDepthTexture = nullptr;
@@ -130,17 +309,38 @@ class Renderer {
 
     // the planet geometry pipeline data
     wgpu::RenderPipeline mPipeline = nullptr;
+    wgpu::RenderPipeline mGridPipeline = nullptr;  // with vertex pulling
+    wgpu::BindGroupLayout mBindGroupLayout = nullptr;  // the terrain material
     wgpu::Sampler mSampler = nullptr;
+    // the buffers are kept from a planet to the next, their capacity in bytes can be more than what is used
     wgpu::Buffer mVertexBuffer = nullptr;
-    wgpu::Buffer mIndexBuffer = nullptr;
-    wgpu::Buffer mUniformBuffer = nullptr;
+    uint64_t mVertexBufferSize = 0;
+    wgpu::Buffer mIndexBuffer = nullptr;  // only without vertex pulling
+    uint64_t mIndexBufferSize = 0;
+    bool mVertexPulling = false;
+    uint64_t mMaxStorageBufferBindingSize = 0;
+    uint32_t mMinUniformBufferOffsetAlignment = 256;
     wgpu::BindGroup mBindGroup = nullptr;
 
     // Error callback set on the device (for debugging)
     std::unique_ptr<wgpu::ErrorCallback> mErrorCallbackHandle;
 
+    // the uniforms of all the pipelines, sent once per frame
+    // the groups of the scene, of the frame and of the objects without vertices are shared by every pipeline
+    UniformStaging<SceneUniforms> mSceneUniforms;
+    UniformStaging<ObjectUniforms> mObjectUniforms;
+    UniformStaging<FrameUniforms> mFrameUniforms;
+    UniformStaging<MaterialUniforms> mMaterialUniforms;
+    wgpu::BindGroupLayout mSceneBindGroupLayout = nullptr;
+    wgpu::BindGroupLayout mObjectBindGroupLayout = nullptr;
+    wgpu::BindGroupLayout mPlanetObjectBindGroupLayout = nullptr;  // with the vertices
+    wgpu::BindGroupLayout mFrameBindGroupLayout = nullptr;
+    wgpu::BindGroup mSceneBindGroup = nullptr;
+    wgpu::BindGroup mObjectBindGroup = nullptr;
+    wgpu::BindGroup mPlanetObjectBindGroup = nullptr;
+    wgpu::BindGroup mFrameBindGroup = nullptr;
+
     // Model rendering part
-    SceneUniforms mUniforms;
     int mVertexCount;
     int mIndexCount;
     vector<ResourceManager::VertexAttributes> mVertexData;
@@ -152,20 +352,26 @@ class Renderer {
 
     // shadow related stuff
     wgpu::RenderPipeline mShadowPipeline = nullptr;
-    wgpu::BindGroup mShadowBindGroup = nullptr;
-    unsigned int mShadowDepthTextureSize = 4096;
-    wgpu::TextureView mShadowDepthTextureView = nullptr;
+    wgpu::RenderPipeline mShadowPulledPipeline = nullptr;  // with vertex pulling
+    // the map has a layer per cascade, built from the GUI settings (see setShadowMapSettings)
+    unsigned int mShadowDepthTextureSize = 0;
+    uint32_t mShadowCascadeCount = 0;
+    wgpu::TextureView mShadowDepthTextureView = nullptr;  // all the layers, read by the planet shader
+    std::vector<wgpu::TextureView> mShadowCascadeViews;   // a layer each, rendered by the shadow passes
     wgpu::Texture mShadowDepthTexture = nullptr;
     wgpu::TextureFormat mShadowDepthTextureFormat = wgpu::TextureFormat::Depth32Float;
+    bool mShadowMapDirty = false;
     wgpu::Sampler mShadowSampler = nullptr;
+    // the shadow casters have their own index buffer, also with vertex pulling
+    wgpu::Buffer mShadowIndexBuffer = nullptr;
+    uint64_t mShadowIndexBufferSize = 0;
+    vector<uint32_t> mShadowIndexData;
 
     // skybox related stuff
     wgpu::RenderPipeline mSkyboxPipeline = nullptr;
     wgpu::Sampler mSkyboxSampler = nullptr;
     wgpu::Buffer mSkyboxVertexBuffer = nullptr;
-    wgpu::Buffer mSkyboxUniformBuffer = nullptr;
     wgpu::BindGroup mSkyboxBindGroup = nullptr;
-    SceneUniforms mSkyboxUniforms;
     int mSkyboxVertexCount;
     vector<ResourceManager::VertexAttributes> mSkyboxVertexData;
     wgpu::TextureView mSkyboxTextureView = nullptr;  // keep track of it for later cleanup
@@ -176,7 +382,121 @@ class Renderer {
     wgpu::BindGroup mOceanBindGroup = nullptr;
     wgpu::TextureView mOceanNMTextureView = nullptr;  // keep track of it for later cleanup
     wgpu::Texture mOceanNMTexture = nullptr;
+    // the ocean shaded at a lower resolution, then upsampled over the scene
+    wgpu::RenderPipeline mOceanLowPipeline = nullptr;        // the ocean in the lower resolution target
+    wgpu::RenderPipeline mOceanCompositePipeline = nullptr;  // that target over the scene
+    wgpu::BindGroupLayout mOceanCompositeBindGroupLayout = nullptr;
+    // the lower resolution target is a transient texture of the render graph, the bind group is made again
+    // when the graph gives another texture
+    wgpu::BindGroup mOceanCompositeBindGroup = nullptr;
+    uint64_t mOceanCompositePoolVersion = 0;
+    wgpu::TextureFormat mOceanTextureFormat = wgpu::TextureFormat::RGBA8Unorm;
+    uint32_t mOceanDownscale = 0;  // 0 at full resolution
+    // where the ocean can be seen this frame, from its sphere projected on the screen (see updateOceanBounds)
+    enum OceanVisibility {
+        OceanVisible = 0,
+        OceanOffScreen,
+        OceanUnderTerrain,
+    };
+    OceanVisibility mOceanVisibility = OceanVisible;
+    vec2 mOceanBoundsMin{-1.0f};  // in normalized device coordinates
+    vec2 mOceanBoundsMax{1.0f};
+
+    // GPU time of the passes, and the last one of the ocean measured at each downscale
+    enum TimedPass : uint32_t {
+        ShadowPass = 0,  // all the cascades rendered in the frame
+        ScenePass,
+        OceanPass,
+        OceanCompositePass,
+        GuiPass,
+        TimedPassCount,
+    };
+    static constexpr char const* TIMED_PASS_NAMES[TimedPassCount]{"shadows", "scene", "ocean", "ocean composite", "gui"};
+    GpuTimer mGpuTimer;
+    double mOceanGpuMs[MAX_OCEAN_DOWNSCALE + 1]{-1.0, -1.0, -1.0};
+
+    // the passes of the frame, declared again every frame (see onFrame)
+    RenderGraph mRenderGraph;
+    bool mPrintRenderGraph = false;  // print the schedule of the next frame
 
     // GUI related stuff
     GUISettings mGUISettings;
+    GenerationStats mGenerationStats;
+
+    // latency of the last regeneration of the planet, until its first frame is submitted and done on the GPU
+    StageTimer mPlanetUpdateTimer;
+    bool mPlanetUpdatePending = false;
+    double mFirstFrameSubmitMs = 0.0;
+    double mFirstFrameMs = 0.0;
+    struct FirstFrameCallback {
+        bool done = false;
+        std::unique_ptr<wgpu::QueueWorkDoneCallback> callback;
+    };
+    std::deque<FirstFrameCallback> mFirstFrameCallbacks;  // (a deque keeps the references of the pending ones)
+
+    // frame pacing (see waitForNextFrame)
+    int mPresentMode = 0;  // in GUISettings::presentMode
+    bool mPresentModeWorks = true;  // a texture has been acquired since it was set
+    std::chrono::steady_clock::time_point mNextFrameTime;
+    double mFrameWaitMs = 0.0;
+    uint64_t mFramesSubmitted = 0;
+    uint64_t mFramesCompleted = 0;  // by the GPU, from the callbacks of the queue
+    struct FrameInFlight {
+        uint64_t frame;
+        std::unique_ptr<wgpu::QueueWorkDoneCallback> callback;
+    };
+    std::deque<FrameInFlight> mFramesInFlight;
+    // glfw time of the first input not shown yet, then from that input until the GPU is done with its frame
+    double mPendingInputTime = -1.0;
+    double mInputLatencyMs = -1.0;
+    double mAverageInputLatencyMs = -1.0;
+    TerrainBounds mTerrainBounds;
+
+    // culling of the planet tiles and clusters, done again only when the camera or the terrain change
+    struct IndexRange {
+        uint32_t first;
+        uint32_t count;
+    };
+    TerrainClusters mTerrainClusters;
+    std::vector<IndexRange> mVisibleRanges;
+    bool mCullingDirty = true;
+    struct CullingStats {
+        uint32_t visibleClusters = 0;
+        uint32_t frustumTriangles = 0;
+        uint32_t horizonTriangles = 0;
+        uint32_t backFacingTriangles = 0;
+        uint32_t culledTriangles() const { return frustumTriangles + horizonTriangles + backFacingTriangles; }
+    };
+    CullingStats mCullingStats;
+
+    // same for the shadow casters, only done again when the sun or the terrain change
+    // a list of ranges per level, and the level drawn by each cascade (picked from its texels)
+    std::vector<ShadowLevel> mShadowLevels;
+    std::vector<std::vector<IndexRange>> mShadowRanges;
+    uint32_t mShadowCascadeLevels[MAX_SHADOW_CASCADES] = {};
+    bool mShadowCullingDirty = true;
+    uint32_t mShadowBackFacingTriangles = 0;
+
+    // what each cascade was last rendered with, its shadow pass is skipped while none of it changes
+    struct ShadowCache {
+        bool valid = false;
+        mat4x4 lightViewProjMatrix = mat4x4(1.0f);
+        mat4x4 modelMatrix = mat4x4(1.0f);
+        uint64_t geometryVersion = 0;
+    };
+    ShadowCache mShadowCache[MAX_SHADOW_CASCADES];
+    // where the cascades should be this frame, and the ones rendered to get there (see scheduleShadowCascades)
+    mat4x4 mShadowCascadeTargets[MAX_SHADOW_CASCADES];
+    std::vector<uint32_t> mShadowCascadesToRender;
+    uint64_t mShadowFrameIndex = 0;
+    uint64_t mShadowPassesRendered = 0;
+    uint64_t mShadowPassesSkipped = 0;   // up to date
+    uint64_t mShadowPassesDeferred = 0;  // out of date, waiting for their turn
+
+    // the sun, moved every frame
+    vec4 mSunPosition = mSunStartPosition;
+    float mSunAngle = 0.0f;
+    float mLastFrameTime = 0.0f;
+    // bumped each time the planet vertices or the shadow casters change
+    uint64_t mGeometryVersion = 0;
 };
\ No newline at end of file
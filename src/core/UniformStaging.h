@@ -0,0 +1,157 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// CPU copy of a uniform struct, uploaded at most once per frame
+// the setters only record the bytes that changed, flush() merges these dirty ranges and sends them
+// in as few writeBuffer as possible
+// there can be several slots of the struct (one per object or material), each one picked with a dynamic offset
+// the buffer holds FRAME_COUNT copies of all the slots, used in turn by the frames:
+// a frame never writes in the copy that the previous frames in flight are reading
+template <typename T>
+class UniformStaging {
+   public:
+    static constexpr unsigned int FRAME_COUNT = 3;
+    // 2 dirty ranges closer than this are sent in a single write, with the clean bytes between them
+    static constexpr uint64_t MERGE_GAP = 64;
+
+    // alignment is the minUniformBufferOffsetAlignment of the device
+    void init(wgpu::Device device, uint32_t alignment, char const* label, uint32_t slotCount = 1) {
+        mStride = (sizeof(T) + alignment - 1) / alignment * alignment;
+        mData.assign(slotCount, T{});
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = label;
+        bufferDesc.size = uint64_t(mStride) * slotCount * FRAME_COUNT;
+        bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Uniform;
+        bufferDesc.mappedAtCreation = false;
+        mBuffer = device.createBuffer(bufferDesc);
+        // every copy starts with garbage
+        markDirty(0, frameSize());
+    }
+
+    void release() {
+        if (mBuffer == nullptr) return;
+        mBuffer.destroy();
+        mBuffer.release();
+        mBuffer = nullptr;
+    }
+
+    wgpu::Buffer getBuffer() const { return mBuffer; }
+    T const& get(uint32_t slot = 0) const { return mData[slot]; }
+    // dynamic offset of a slot in the copy written by the last flush
+    uint32_t getOffset(uint32_t slot = 0) const { return (mFrame * slotCount() + slot) * mStride; }
+
+    // the binding of a single slot, to be used with a dynamic offset
+    wgpu::BindGroupLayoutEntry getBindingLayout(uint32_t binding, WGPUShaderStageFlags visibility) const {
+        wgpu::BindGroupLayoutEntry entry = wgpu::Default;
+        entry.binding = binding;
+        entry.visibility = visibility;
+        entry.buffer.type = wgpu::BufferBindingType::Uniform;
+        entry.buffer.minBindingSize = sizeof(T);
+        entry.buffer.hasDynamicOffset = true;
+        return entry;
+    }
+
+    wgpu::BindGroupEntry getBinding(uint32_t binding) const {
+        wgpu::BindGroupEntry entry;
+        entry.binding = binding;
+        entry.buffer = mBuffer;
+        entry.offset = 0;
+        entry.size = sizeof(T);
+        return entry;
+    }
+
+    // change a field, nothing is sent if it keeps the same value
+    template <typename F>
+    void set(F T::*field, F const& value) {
+        set(0, field, value);
+    }
+
+    template <typename F>
+    void set(uint32_t slot, F T::*field, F const& value) {
+        F& current = mData[slot].*field;
+        if (std::memcmp(&current, &value, sizeof(F)) == 0) return;
+        std::memcpy(&current, &value, sizeof(F));
+        uint64_t fieldOffset = reinterpret_cast<char const*>(&current) - reinterpret_cast<char const*>(&mData[slot]);
+        markDirty(uint64_t(slot) * mStride + fieldOffset, sizeof(F));
+    }
+
+    void setAll(T const& data, uint32_t slot = 0) {
+        mData[slot] = data;
+        markDirty(uint64_t(slot) * mStride, sizeof(T));
+    }
+
+    // move to the copy of the next frame and bring it up to date
+    void flush(wgpu::Queue queue) {
+        mFrame = (mFrame + 1) % FRAME_COUNT;
+        mWriteCount = 0;
+        mWriteBytes = 0;
+        std::vector<Range>& dirty = mDirty[mFrame];
+        if (dirty.empty()) return;
+
+        std::sort(dirty.begin(), dirty.end(), [](Range const& a, Range const& b) { return a.begin < b.begin; });
+        Range write = dirty[0];
+        for (size_t i = 1; i <= dirty.size(); i++) {
+            if (i < dirty.size() && dirty[i].begin <= write.end + MERGE_GAP) {
+                write.end = std::max(write.end, dirty[i].end);
+                continue;
+            }
+            sendRange(queue, write);
+            if (i < dirty.size()) write = dirty[i];
+        }
+        dirty.clear();
+    }
+
+    // what the last flush sent
+    uint32_t getWriteCount() const { return mWriteCount; }
+    uint64_t getWriteBytes() const { return mWriteBytes; }
+
+   private:
+    // byte range in the copy of a frame
+    struct Range {
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    uint32_t slotCount() const { return (uint32_t)mData.size(); }
+    uint64_t frameSize() const { return uint64_t(mStride) * slotCount(); }
+
+    // the change must reach every copy, each one gets it on its next flush
+    // (writeBuffer wants multiples of 4 bytes, which every uniform field is)
+    void markDirty(uint64_t offset, uint64_t size) {
+        uint64_t begin = offset / 4 * 4;
+        uint64_t end = (offset + size + 3) / 4 * 4;
+        for (std::vector<Range>& dirty : mDirty) {
+            dirty.push_back({begin, end});
+        }
+    }
+
+    // the range may cover several slots, the padding between them is sent as zeros
+    void sendRange(wgpu::Queue queue, Range range) {
+        mStaging.assign(range.end - range.begin, 0);
+        for (uint32_t slot = 0; slot < slotCount(); slot++) {
+            uint64_t slotBegin = uint64_t(slot) * mStride;
+            uint64_t begin = std::max(range.begin, slotBegin);
+            uint64_t end = std::min(range.end, slotBegin + sizeof(T));
+            if (begin >= end) continue;
+            std::memcpy(&mStaging[begin - range.begin], reinterpret_cast<char const*>(&mData[slot]) + (begin - slotBegin), end - begin);
+        }
+        queue.writeBuffer(mBuffer, uint64_t(mFrame) * frameSize() + range.begin, mStaging.data(), mStaging.size());
+        mWriteCount++;
+        mWriteBytes += mStaging.size();
+    }
+
+    std::vector<T> mData;
+    wgpu::Buffer mBuffer = nullptr;
+    uint32_t mStride = 0;
+    unsigned int mFrame = 0;
+    std::vector<Range> mDirty[FRAME_COUNT];
+    std::vector<char> mStaging;  // contiguous bytes of a write
+    uint32_t mWriteCount = 0;
+    uint64_t mWriteBytes = 0;
+};
@@ -1,7 +1,42 @@
 #include "core/Engine.h"
 
-int main(int, char**) {
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// procplanets --headless out.png [--size 512x512] [--camera yaw pitch zoom] [--frames 1] [--software]
+// renders without a window and saves the frames, instead of opening the window
+static bool parseHeadless(int argc, char** argv, Engine::HeadlessSettings& settings) {
+	bool headless = false;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+			headless = true;
+			settings.output = argv[++i];
+		} else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+			std::sscanf(argv[++i], "%ux%u", &settings.width, &settings.height);
+		} else if (std::strcmp(argv[i], "--camera") == 0 && i + 3 < argc) {
+			settings.angles.x = std::strtof(argv[++i], nullptr);
+			settings.angles.y = std::strtof(argv[++i], nullptr);
+			settings.zoom = std::strtof(argv[++i], nullptr);
+		} else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			settings.frames = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+		} else if (std::strcmp(argv[i], "--software") == 0) {
+			settings.softwareAdapter = true;
+		} else {
+			std::cerr << "Unknown argument: " << argv[i] << std::endl;
+		}
+	}
+	return headless;
+}
+
+int main(int argc, char** argv) {
 	Engine engine;
+	Engine::HeadlessSettings headless;
+	if (parseHeadless(argc, argv, headless)) {
+		return engine.renderHeadless(headless) ? 0 : 1;
+	}
+
 	if (!engine.onInit()) return 1;
 
 	while (engine.isRunning()) {
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// How the points of a face of the cube are moved onto the sphere
+// - Normalize: project from the center, the cells are ~5 times bigger in the middle of a face than in its corners
+// - Tangent: warp the face coordinates by tan first, the cells are within ~1.4 of each other
+// - EqualArea: every cell covers the same area of the sphere (the edges still stretch a bit in the corners)
+enum class CubeProjection : int {
+    Normalize = 0,
+    Tangent,
+    EqualArea,
+};
+
+// The mapping between the coordinates on a face, in [-1, 1]², and the directions of the unit sphere
+// the directions are in the frame of the face: x and y along the face axes, z along its normal
+struct CubeSphereMapping {
+    static constexpr float PI = 3.14159265358979f;
+
+    // where a point of the face goes on the cube before being normalized from the center
+    // the borders stay exactly on the borders (±1), so the faces share their edge vertices bit for bit
+    static glm::vec2 faceToCube(CubeProjection projection, glm::vec2 face) {
+        switch (projection) {
+            case CubeProjection::Tangent:
+                return glm::vec2(std::tan(face.x * PI / 4.0f), std::tan(face.y * PI / 4.0f)) / std::tan(PI / 4.0f);
+            case CubeProjection::EqualArea:
+                return equalAreaToCube(face);
+            case CubeProjection::Normalize:
+            default:
+                return face;
+        }
+    }
+
+    static glm::vec3 faceToSphere(CubeProjection projection, glm::vec2 face) {
+        return glm::normalize(glm::vec3(faceToCube(projection, face), 1.0f));
+    }
+
+    // inverse of faceToSphere, false if the direction is not on the side of the face
+    // the coordinates go out of [-1, 1] if the direction is closer to another face
+    static bool sphereToFace(CubeProjection projection, glm::vec3 direction, glm::vec2& face) {
+        if (direction.z <= 0.0f) return false;
+        switch (projection) {
+            case CubeProjection::Tangent:
+                face = glm::vec2(std::atan(direction.x / direction.z), std::atan(direction.y / direction.z)) * 4.0f / PI;
+                break;
+            case CubeProjection::EqualArea:
+                face = sphereToEqualArea(glm::normalize(direction));
+                break;
+            case CubeProjection::Normalize:
+            default:
+                face = glm::vec2(direction) / direction.z;
+                break;
+        }
+        return true;
+    }
+
+    // shortest and longest edges of the triangles of a face grid with the given vertices per side
+    // (all the faces are the same on the unit sphere)
+    static void edgeLengths(CubeProjection projection, unsigned int resolution, float& minLength, float& maxLength) {
+        minLength = 2.0f;
+        maxLength = 0.0f;
+        float last = float(resolution - 1);
+        auto point = [&](unsigned int x, unsigned int y) {
+            return faceToSphere(projection, (2.0f * glm::vec2(x, y) - last) / last);
+        };
+        for (unsigned int y = 0; y + 1 < resolution; y++) {
+            for (unsigned int x = 0; x + 1 < resolution; x++) {
+                glm::vec3 p00 = point(x, y);
+                // the right and bottom edges of the grid are reached by the last row and column
+                float lengths[] = {
+                    glm::length(point(x + 1, y) - p00),
+                    glm::length(point(x, y + 1) - p00),
+                    glm::length(point(x + 1, y + 1) - p00),  // diagonal of the 2 triangles
+                };
+                for (float length : lengths) {
+                    minLength = std::min(minLength, length);
+                    maxLength = std::max(maxLength, length);
+                }
+            }
+        }
+    }
+
+   private:
+    // Exact equal area mapping: each of the 4 triangles between the center and an edge of the face
+    // is split in wedges of equal area around the center (the azimuth phi only depends on minor / major),
+    // and along a wedge the spherical cap area 1 - cos(theta) grows like major²
+    // both ways have a closed form, derived from the area of the part of the face below an azimuth:
+    // phi - asin(sin(phi) / sqrt(2)) = pi / 12 * minor / major
+    static glm::vec2 equalAreaToCube(glm::vec2 face) {
+        bool xMajor = std::abs(face.x) >= std::abs(face.y);
+        float major = xMajor ? face.x : face.y;
+        float minor = xMajor ? face.y : face.x;
+        if (major == 0.0f) return glm::vec2(0.0f);
+
+        float ratio = minor / major;
+        float c = PI / 12.0f * ratio;
+        float phi = c + std::atan(std::sin(c) / (std::sqrt(2.0f) - std::cos(c)));
+        // 1 - cos(theta): a fraction major² of the way to the edge of the face at this azimuth
+        float edgeCap = capToEdge(phi);
+        float cap = major * major * edgeCap;
+        // on the cube, the distance to the center along the major axis is tan(theta) cos(phi) = tan(theta) / tan(theta_edge)
+        float cubeMajor = tanFromCap(cap) / tanFromCap(edgeCap);
+        cubeMajor = major > 0.0f ? cubeMajor : -cubeMajor;
+        // on the diagonals phi is pi / 4 only up to rounding: keep the corners exact
+        float cubeMinor = std::abs(ratio) == 1.0f ? cubeMajor * ratio : cubeMajor * std::tan(phi);
+        return xMajor ? glm::vec2(cubeMajor, cubeMinor) : glm::vec2(cubeMinor, cubeMajor);
+    }
+
+    static glm::vec2 sphereToEqualArea(glm::vec3 direction) {
+        bool xMajor = std::abs(direction.x) >= std::abs(direction.y);
+        float major = xMajor ? direction.x : direction.y;
+        float minor = xMajor ? direction.y : direction.x;
+        if (major == 0.0f) return glm::vec2(0.0f);
+
+        float side = major > 0.0f ? 1.0f : -1.0f;
+        float phi = std::atan2(minor * side, std::abs(major));
+        float ratio = (phi - std::asin(std::sin(phi) / std::sqrt(2.0f))) * 12.0f / PI;
+        // 1 - cos(theta) without the cancellation close to the center
+        float oneMinusCos = (direction.x * direction.x + direction.y * direction.y) / (1.0f + direction.z);
+        float faceMajor = side * std::sqrt(oneMinusCos / capToEdge(phi));
+        float faceMinor = ratio * faceMajor;
+        return xMajor ? glm::vec2(faceMajor, faceMinor) : glm::vec2(faceMinor, faceMajor);
+    }
+
+    static float tanFromCap(float oneMinusCos) {
+        return std::sqrt(oneMinusCos * (2.0f - oneMinusCos)) / (1.0f - oneMinusCos);
+    }
+
+    // 1 - cos(theta) on the edge of the face at the azimuth phi (from the middle of the edge)
+    static float capToEdge(float phi) {
+        float cosPhi = std::cos(phi);
+        return 1.0f - cosPhi / std::sqrt(1.0f + cosPhi * cosPhi);
+    }
+};
@@ -3,6 +3,7 @@
 
 #include "glm/glm.hpp"
 #include "procgen/FastNoiseLite.h"
+#include "procgen/GenerationStats.hpp"
 
 // generates the elevation data for a point on the unit sphere of the procedural planet
 class ElevationGenerator {
@@ -12,6 +13,7 @@ class ElevationGenerator {
         float frequency,
         int octaves) {
         mRadius = radius;
+        mOctaves = octaves;
         mNoise.SetSeed(1337);
         mNoise.SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2);
         mNoise.SetFrequency(frequency);
@@ -21,12 +23,35 @@ class ElevationGenerator {
 
     // return the actual point on the sphere, from the point on the unit sphere
     glm::vec3 evaluate(glm::vec3 pointOnUnitSphere) {
+        return displace(pointOnUnitSphere, evaluateNoise(pointOnUnitSphere));
+    }
+
+    // return the raw noise value (between 0 and 1) for a point on the unit sphere
+    float evaluateNoise(glm::vec3 pointOnUnitSphere) {
+        STATS_ADD(mSamplesEvaluated, 1);
+        STATS_ADD(mOctavesEvaluated, mOctaves);
         float noise = mNoise.GetNoise(pointOnUnitSphere.x, pointOnUnitSphere.y, pointOnUnitSphere.z);
-        noise = (noise + 1) * 0.5f;  // get between 0 and 1
+        return (noise + 1) * 0.5f;  // get between 0 and 1
+    }
+
+    // move the point on the unit sphere to its place on the planet, given its noise value
+    glm::vec3 displace(glm::vec3 pointOnUnitSphere, float noise) const {
         return pointOnUnitSphere * mRadius * (1 + noise);
     }
 
+    // add the counters of this generator to the given stats
+    void collectStats([[maybe_unused]] GenerationStats& stats) const {
+        STATS_ADD(stats.samplesEvaluated, mSamplesEvaluated);
+        STATS_ADD(stats.octavesEvaluated, mOctavesEvaluated);
+    }
+
    private:
     FastNoiseLite mNoise;
     float mRadius;
+    int mOctaves;
+
+#if PROCPLANETS_STATS
+    uint64_t mSamplesEvaluated = 0;
+    uint64_t mOctavesEvaluated = 0;
+#endif
 };
\ No newline at end of file
@@ -1,6 +1,12 @@
+#pragma once
+
 #include "glm/glm.hpp"
 #include "resource/ResourceManager.h"
+#include "procgen/CubeProjection.hpp"
 #include "procgen/ElevationGenerator.hpp"
+#include "procgen/GenerationStats.hpp"
+#include "procgen/TerrainBounds.hpp"
+#include "procgen/TerrainClusters.hpp"
 
 using VertexAttributes = ResourceManager::VertexAttributes;
 
@@ -11,10 +17,14 @@ class FaceGenerator {
     // TODO: this constructor is dirty: should I do like this ?
     FaceGenerator(
         glm::vec3 _face_normal,
+        unsigned int _face_index,
         unsigned int _resolution,
+        CubeProjection _projection,
         ElevationGenerator& _elevationGenerator) : elevationGenerator(_elevationGenerator) {
         face_normal = _face_normal;
+        face_index = _face_index;
         resolution = _resolution;
+        projection = _projection;
 
         // we pick a orthogonal vector to get 2 unit axis on the surface...
         // tbh I can't fully grasp the intuition on which axis to get
@@ -24,67 +34,361 @@ class FaceGenerator {
         axis_b = glm::cross(face_normal, axis_a);
     }
 
-    // generate the vertex attributes for a face of the planet
+    // width in quads of the bands the indices are emitted in: the vertices of 2 rows of a band
+    // (2 * (CACHE_BAND_WIDTH + 1) = 14) fit in a 16 entries FIFO, the smallest post-transform cache around
+    // wider bands are slightly better on 32 entries caches but fall back to ~1.1 ACMR on 16 entries ones
+    static constexpr unsigned int CACHE_BAND_WIDTH = 6;
+
+    static unsigned int vertexCount(unsigned int resolution) { return resolution * resolution; }
+    static unsigned int indexCount(unsigned int resolution) { return (resolution - 1) * (resolution - 1) * 2 * 3; }
+
+    // generate the vertex attributes for a face of the planet, positions and normals
     // we directly write in given arrays, they should be of the right size already
+    // (each face only touches its own range, so the faces can be generated in parallel)
+    // noiseCache holds the raw noise of every vertex of the planet: it is read back
+    // if useCachedNoise is true, and filled otherwise
+    // sculptOffsets holds the elevation added by the sculpting brush on every vertex
+    // the bounds of the face and of its tiles are written in the given TerrainBounds
+    //
+    // everything is done in a single pass over the rows of the grid, on structure of arrays rows:
+    // only 2 rows of positions and 2 rows of triangle normals are alive at a time, so they stay in the cache,
+    // and each vertex is written once in the (much bigger) VertexAttributes layout, when its normal is known
     void generateFaceData(
         std::vector<VertexAttributes>& vertexData,
-        std::vector<uint32_t>& indices) {
-        // start the index from the last of the previous face
-        int tri_index = indices.size();
-        int vert_index_offset = vertexData.size();
-
-        // resize the vertex data to hold the new face
-        int quad_count = int(pow(resolution - 1, 2));
-        vertexData.resize(vert_index_offset + resolution * resolution);
-        indices.resize(tri_index + quad_count * 2 * 3);
+        std::vector<uint32_t>& indices,
+        std::vector<float>& noiseCache,
+        bool useCachedNoise,
+        std::vector<float> const& sculptOffsets,
+        TerrainBounds& bounds) {
+        histogram.fill(0);
+        PositionRow rows[2];
+        QuadNormalRow quad_rows[2];
+        for (unsigned int i = 0; i < 2; i++) {
+            rows[i].resize(resolution);
+            quad_rows[i].resize(resolution - 1);
+        }
+
+        StageTimer noiseTimer;
+        generateRow(0, rows[0], noiseCache, useCachedNoise, sculptOffsets, bounds);
+        STATS_ADD(noiseMs, noiseTimer.elapsedMs());
         for (unsigned int y = 0; y < resolution; y++) {
-            for (unsigned int x = 0; x < resolution; x++) {
-                int i = vert_index_offset + x + y * resolution;
-
-                glm::vec2 ratio = glm::vec2(x, y) / float((resolution - 1));
-                // don't know why this calculation is different from the sebastian lague code (b and a inverted ?)
-                glm::vec3 point_on_unit_cube = face_normal + (2 * ratio.x - 1) * axis_a + (2 * ratio.y - 1) * axis_b;
-
-                // normalizing from the center will create a sphere
-                glm::vec3 point_on_unit_sphere = glm::normalize(point_on_unit_cube);
-
-                // glm::vec3 point_on_planet = shape_generator.compute_elevation(point_on_unit_sphere)
-                glm::vec3 point_on_planet = elevationGenerator.evaluate(point_on_unit_sphere);
-
-                // build the vertex attributes
-                VertexAttributes attributes = {
-                    point_on_planet,  // position;
-                    glm::vec3(0.0f),  // normal are computed later
-                    glm::vec3(0.0f),  // color;
-                    glm::vec2(0.0f),  // uv;
-                    glm::vec3(0.0f),  // tangent;
-                    glm::vec3(0.0f),  // bitangent;
-                };
-                vertexData[i] = attributes;
-
-                // create the indexes
-                // we skip the borders
-                if (x != resolution - 1 && y != resolution - 1) {
-                    // 1st triangle
-                    indices[tri_index] = i;
-                    indices[tri_index + 1] = i + resolution + 1;
-                    indices[tri_index + 2] = i + resolution;
-
-                    // 2nd
-                    indices[tri_index + 3] = i;
-                    indices[tri_index + 4] = i + 1;
-                    indices[tri_index + 5] = i + resolution + 1;
-                    tri_index += 6;
+            PositionRow const& row = rows[y % 2];
+            QuadNormalRow const* below = y > 0 ? &quad_rows[(y - 1) % 2] : nullptr;
+            QuadNormalRow const* above = nullptr;
+            // the next row is needed for the triangles above this one
+            if (y + 1 < resolution) {
+                StageTimer rowNoiseTimer;
+                generateRow(y + 1, rows[(y + 1) % 2], noiseCache, useCachedNoise, sculptOffsets, bounds);
+                STATS_ADD(noiseMs, rowNoiseTimer.elapsedMs());
+                above = &quad_rows[y % 2];
+            }
+            StageTimer normalsTimer;
+            if (above) {
+                computeQuadNormals(row, rows[(y + 1) % 2], quad_rows[y % 2]);
+            }
+            writeRow(y, row, below, above, vertexData);
+            STATS_ADD(normalsMs, normalsTimer.elapsedMs());
+        }
+
+        generateFaceIndices(indices);
+    }
+
+    // create the indexes of the face, 2 triangles per quad of the grid
+    // the quads are not emitted row by row: a row of the grid is far too long for the vertices
+    // of the previous row to still be in the post-transform cache of the GPU
+    // instead they go tile by tile (the tiles of TerrainBounds, so that a tile is a contiguous range),
+    // and inside a tile by bands of CACHE_BAND_WIDTH quads, row by row:
+    // the top vertices of a row of the band are reused by the next row while still in the cache
+    void generateFaceIndices(std::vector<uint32_t>& indices) const {
+        // start the indices after the previous faces
+        int tri_index = face_index * indexCount(resolution);
+        int vert_index_offset = face_index * vertexCount(resolution);
+
+        unsigned int quads_per_side = resolution - 1;
+        for (unsigned int tile_y = 0; tile_y < quads_per_side; tile_y += TerrainBounds::TILE_SIZE) {
+            unsigned int tile_y_end = std::min(tile_y + TerrainBounds::TILE_SIZE, quads_per_side);
+            for (unsigned int tile_x = 0; tile_x < quads_per_side; tile_x += TerrainBounds::TILE_SIZE) {
+                unsigned int tile_x_end = std::min(tile_x + TerrainBounds::TILE_SIZE, quads_per_side);
+                for (unsigned int band_x = tile_x; band_x < tile_x_end; band_x += CACHE_BAND_WIDTH) {
+                    unsigned int band_x_end = std::min(band_x + CACHE_BAND_WIDTH, tile_x_end);
+                    for (unsigned int y = tile_y; y < tile_y_end; y++) {
+                        for (unsigned int x = band_x; x < band_x_end; x++) {
+                            uint32_t i = vert_index_offset + x + y * resolution;
+                            // 1st triangle
+                            indices[tri_index] = i;
+                            indices[tri_index + 1] = i + resolution + 1;
+                            indices[tri_index + 2] = i + resolution;
+
+                            // 2nd
+                            indices[tri_index + 3] = i;
+                            indices[tri_index + 4] = i + 1;
+                            indices[tri_index + 5] = i + resolution + 1;
+                            tri_index += 6;
+                        }
+                    }
                 }
             }
         }
     }
 
+    // compute the bounds and normal cones of the clusters of the face, once its vertices and normals are generated
+    void generateFaceClusters(
+        std::vector<VertexAttributes> const& vertexData,
+        std::vector<uint32_t> const& indices,
+        TerrainClusters& clusters) const {
+        for (unsigned int tile_y = 0; tile_y < clusters.tilesPerSide; tile_y++) {
+            for (unsigned int tile_x = 0; tile_x < clusters.tilesPerSide; tile_x++) {
+                clusters.computeTile(clusters.tileIndex(face_index, tile_x, tile_y), vertexData, indices);
+            }
+        }
+    }
+
+    // move one vertex to a new elevation, without evaluating the noise again
+    // the bounds can only grow here, they are recomputed exactly on the next full generation
+    void moveVertex(
+        std::vector<VertexAttributes>& vertexData,
+        TerrainBounds& bounds,
+        unsigned int x, unsigned int y,
+        glm::vec3 point_on_unit_sphere,
+        float elevation) {
+        glm::vec3 point_on_planet = elevationGenerator.displace(point_on_unit_sphere, elevation);
+        vertexData[vertexIndex(x, y)].position = point_on_planet;
+
+        float radius = glm::length(point_on_planet);
+        bounds.faces[face_index].add(point_on_planet, radius);
+        bounds.planet.add(point_on_planet, radius);
+        addToTiles(bounds, x, y, point_on_planet, radius);
+    }
+
+    // recompute the normals of the [x_start, x_end] x [y_start, y_end] rectangle (inclusive)
+    // from the triangles of the grid around each vertex (the same ones as in the index buffer)
+    void regenerateRegionNormals(
+        std::vector<VertexAttributes>& vertexData,
+        unsigned int x_start, unsigned int y_start,
+        unsigned int x_end, unsigned int y_end) const {
+        // the normals of the 2 triangles of each quad touching the rectangle, computed only once
+        unsigned int quad_x_start = x_start == 0 ? 0 : x_start - 1;
+        unsigned int quad_y_start = y_start == 0 ? 0 : y_start - 1;
+        unsigned int quad_x_end = std::min(x_end, resolution - 2);
+        unsigned int quad_y_end = std::min(y_end, resolution - 2);
+        unsigned int quad_width = quad_x_end - quad_x_start + 1;
+        std::vector<glm::vec3> triangle_normals(2 * quad_width * (quad_y_end - quad_y_start + 1));
+        for (unsigned int quad_y = quad_y_start; quad_y <= quad_y_end; quad_y++) {
+            for (unsigned int quad_x = quad_x_start; quad_x <= quad_x_end; quad_x++) {
+                uint32_t i = vertexIndex(quad_x, quad_y);
+                glm::vec3 p = vertexData[i].position;
+                glm::vec3 p_right = vertexData[i + 1].position;
+                glm::vec3 p_up = vertexData[i + resolution].position;
+                glm::vec3 p_diagonal = vertexData[i + resolution + 1].position;
+                unsigned int quad = (quad_y - quad_y_start) * quad_width + (quad_x - quad_x_start);
+                triangle_normals[2 * quad] = glm::cross(p_diagonal - p, p_up - p);         // (i, i + res + 1, i + res)
+                triangle_normals[2 * quad + 1] = glm::cross(p_right - p, p_diagonal - p);  // (i, i + 1, i + res + 1)
+            }
+        }
+        auto quadNormal = [&](unsigned int quad_x, unsigned int quad_y, unsigned int triangle) {
+            return triangle_normals[2 * ((quad_y - quad_y_start) * quad_width + (quad_x - quad_x_start)) + triangle];
+        };
+
+        for (unsigned int y = y_start; y <= y_end; y++) {
+            for (unsigned int x = x_start; x <= x_end; x++) {
+                bool has_left = x > 0, has_right = x < resolution - 1;
+                bool has_down = y > 0, has_up = y < resolution - 1;
+                glm::vec3 normal(0.0f);
+                // the vertex is the first corner of its own quad: both triangles
+                if (has_right && has_up) normal += quadNormal(x, y, 0) + quadNormal(x, y, 1);
+                // the right corner of the quad on its left: 2nd triangle
+                if (has_left && has_up) normal += quadNormal(x - 1, y, 1);
+                // the upper corner of the quad below: 1st triangle
+                if (has_right && has_down) normal += quadNormal(x, y - 1, 0);
+                // the diagonal corner of the quad on the lower left: both triangles
+                if (has_left && has_down) normal += quadNormal(x - 1, y - 1, 0) + quadNormal(x - 1, y - 1, 1);
+                vertexData[vertexIndex(x, y)].normal = glm::normalize(normal);
+            }
+        }
+    }
+
+    // index of the vertex at (x, y) of this face in the planet vertex data
+    uint32_t vertexIndex(unsigned int x, unsigned int y) const {
+        return face_index * vertexCount(resolution) + x + y * resolution;
+    }
+
+    glm::vec3 pointOnUnitSphere(unsigned int x, unsigned int y) const {
+        // in [-1, 1], computed so that mirrored vertices get exactly opposite coordinates
+        float last = float(resolution - 1);
+        glm::vec2 point_on_face = (2.0f * glm::vec2(x, y) - last) / last;
+        // the projection moves the point on the face of the cube, to spread the vertices on the sphere
+        glm::vec2 point_on_cube = CubeSphereMapping::faceToCube(projection, point_on_face);
+        // don't know why this calculation is different from the sebastian lague code (b and a inverted ?)
+        glm::vec3 point_on_unit_cube = face_normal + point_on_cube.x * axis_a + point_on_cube.y * axis_b;
+
+        // normalizing from the center will create a sphere
+        return glm::normalize(point_on_unit_cube);
+    }
+
+    // inverse of pointOnUnitSphere: the (continuous) grid coordinates of a direction
+    // returns false if the direction does not point towards this face
+    // the coordinates can be out of the grid if the direction is closer to another face
+    bool gridCoordinates(glm::vec3 direction, glm::vec2& grid) const {
+        glm::vec3 local(glm::dot(direction, axis_a), glm::dot(direction, axis_b), glm::dot(direction, face_normal));
+        glm::vec2 point_on_face;
+        if (!CubeSphereMapping::sphereToFace(projection, local, point_on_face)) return false;
+        glm::vec2 ratio = (point_on_face + 1.0f) * 0.5f;
+        grid = ratio * float(resolution - 1);
+        return true;
+    }
+
+    // add the counters of this face to the given stats
+    void collectStats([[maybe_unused]] GenerationStats& stats) const {
+        elevationGenerator.collectStats(stats);
+        STATS_ADD(stats.noiseMs, noiseMs);
+        STATS_ADD(stats.normalsMs, normalsMs);
+    }
+
+    std::array<uint32_t, TerrainBounds::HISTOGRAM_BINS> const& getHistogram() const { return histogram; }
+
    private:
+    // positions of a row of vertices of the grid, in structure of arrays
+    struct PositionRow {
+        std::vector<float> x, y, z;
+        void resize(unsigned int size) {
+            x.resize(size);
+            y.resize(size);
+            z.resize(size);
+        }
+    };
+
+    // (unnormalized) normals of the 2 triangles of each quad of a row of quads:
+    // 0 is (i, i + res + 1, i + res) and 1 is (i, i + 1, i + res + 1), like in the index buffer
+    struct QuadNormalRow {
+        std::vector<float> x0, y0, z0, x1, y1, z1;
+        void resize(unsigned int size) {
+            for (std::vector<float>* component : {&x0, &y0, &z0, &x1, &y1, &z1}) {
+                component->resize(size);
+            }
+        }
+    };
+
+    // positions of the vertices of a row, with the bounds and histogram reduced while the vertex is hot
+    void generateRow(
+        unsigned int y,
+        PositionRow& row,
+        std::vector<float>& noiseCache,
+        bool useCachedNoise,
+        std::vector<float> const& sculptOffsets,
+        TerrainBounds& bounds) {
+        Bounds& faceBounds = bounds.faces[face_index];
+        for (unsigned int x = 0; x < resolution; x++) {
+            uint32_t i = vertexIndex(x, y);
+            glm::vec3 point_on_unit_sphere = pointOnUnitSphere(x, y);
+
+            // the noise only depends on the point on the unit sphere, so it can be reused
+            // as long as the resolution and noise settings don't change
+            if (!useCachedNoise) {
+                noiseCache[i] = elevationGenerator.evaluateNoise(point_on_unit_sphere);
+            }
+            float elevation = noiseCache[i] + sculptOffsets[i];
+            glm::vec3 point_on_planet = elevationGenerator.displace(point_on_unit_sphere, elevation);
+            row.x[x] = point_on_planet.x;
+            row.y[x] = point_on_planet.y;
+            row.z[x] = point_on_planet.z;
+
+            float radius = glm::length(point_on_planet);
+            faceBounds.add(point_on_planet, radius);
+            addToTiles(bounds, x, y, point_on_planet, radius);
+            histogram[TerrainBounds::histogramBin(elevation)]++;
+        }
+    }
+
+    // the triangle normals of the quads between 2 rows, plain float loops the compiler can vectorize
+    void computeQuadNormals(PositionRow const& low, PositionRow const& high, QuadNormalRow& normals) const {
+        for (unsigned int x = 0; x + 1 < resolution; x++) {
+            // p is the corner of the quad, then right, up and diagonal
+            float px = low.x[x], py = low.y[x], pz = low.z[x];
+            float rx = low.x[x + 1] - px, ry = low.y[x + 1] - py, rz = low.z[x + 1] - pz;
+            float ux = high.x[x] - px, uy = high.y[x] - py, uz = high.z[x] - pz;
+            float dx = high.x[x + 1] - px, dy = high.y[x + 1] - py, dz = high.z[x + 1] - pz;
+            // cross(diagonal, up)
+            normals.x0[x] = dy * uz - dz * uy;
+            normals.y0[x] = dz * ux - dx * uz;
+            normals.z0[x] = dx * uy - dy * ux;
+            // cross(right, diagonal)
+            normals.x1[x] = ry * dz - rz * dy;
+            normals.y1[x] = rz * dx - rx * dz;
+            normals.z1[x] = rx * dy - ry * dx;
+        }
+    }
+
+    // write the final vertices of a row, with the normals of the triangles around them
+    // (same sum as regenerateRegionNormals, below and above are null on the borders of the face)
+    void writeRow(
+        unsigned int y,
+        PositionRow const& row,
+        QuadNormalRow const* below,
+        QuadNormalRow const* above,
+        std::vector<VertexAttributes>& vertexData) const {
+        for (unsigned int x = 0; x < resolution; x++) {
+            bool has_left = x > 0, has_right = x < resolution - 1;
+            glm::vec3 normal(0.0f);
+            auto add = [&](QuadNormalRow const& quads, unsigned int quad_x, unsigned int triangle) {
+                normal += triangle == 0 ? glm::vec3(quads.x0[quad_x], quads.y0[quad_x], quads.z0[quad_x])
+                                        : glm::vec3(quads.x1[quad_x], quads.y1[quad_x], quads.z1[quad_x]);
+            };
+            if (above) {
+                // the vertex is the first corner of its own quad: both triangles
+                if (has_right) {
+                    add(*above, x, 0);
+                    add(*above, x, 1);
+                }
+                // the right corner of the quad on its left: 2nd triangle
+                if (has_left) add(*above, x - 1, 1);
+            }
+            if (below) {
+                // the upper corner of the quad below: 1st triangle
+                if (has_right) add(*below, x, 0);
+                // the diagonal corner of the quad on the lower left: both triangles
+                if (has_left) {
+                    add(*below, x - 1, 0);
+                    add(*below, x - 1, 1);
+                }
+            }
+
+            vertexData[vertexIndex(x, y)] = {
+                glm::vec3(row.x[x], row.y[x], row.z[x]),  // position
+                glm::normalize(normal),                    // normal
+                glm::vec3(0.0f),                           // color
+                glm::vec2(0.0f),                           // uv
+                glm::vec3(0.0f),                           // tangent
+                glm::vec3(0.0f),                           // bitangent
+            };
+        }
+    }
+
+    // a vertex on the border between tiles is used by the triangles of all of them
+    void addToTiles(TerrainBounds& bounds, unsigned int x, unsigned int y, glm::vec3 point, float radius) {
+        unsigned int last_tile = bounds.tilesPerSide - 1;
+        unsigned int x_start = x == 0 ? 0 : (x - 1) / TerrainBounds::TILE_SIZE;
+        unsigned int x_end = std::min(x / TerrainBounds::TILE_SIZE, last_tile);
+        unsigned int y_start = y == 0 ? 0 : (y - 1) / TerrainBounds::TILE_SIZE;
+        unsigned int y_end = std::min(y / TerrainBounds::TILE_SIZE, last_tile);
+        for (unsigned int tile_y = y_start; tile_y <= y_end; tile_y++) {
+            for (unsigned int tile_x = x_start; tile_x <= x_end; tile_x++) {
+                bounds.tile(face_index, tile_x, tile_y).add(point, radius);
+            }
+        }
+    }
+
     glm::vec3 face_normal;
     glm::vec3 axis_a;
     glm::vec3 axis_b;
+    unsigned int face_index;
     unsigned int resolution;
-    float radius;
+    CubeProjection projection;
     ElevationGenerator elevationGenerator;
+
+    // elevation distribution of this face, merged with the others once every face is done
+    std::array<uint32_t, TerrainBounds::HISTOGRAM_BINS> histogram{};
+
+    // time spent in each stage for this face
+    double noiseMs = 0.0;
+    double normalsMs = 0.0;
 };
\ No newline at end of file
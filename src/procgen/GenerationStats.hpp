@@ -0,0 +1,139 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+// Compile-time switch for the generation counters.
+// Build with -DPROCPLANETS_STATS=0 (or the CMake option PROCPLANETS_ENABLE_STATS=OFF)
+// and every counter update below compiles to nothing.
+#ifndef PROCPLANETS_STATS
+#define PROCPLANETS_STATS 1
+#endif
+
+#if PROCPLANETS_STATS
+#define STATS_ADD(counter, ...) ((counter) += (__VA_ARGS__))
+#define STATS_SET(counter, ...) ((counter) = (__VA_ARGS__))
+#else
+#define STATS_ADD(counter, ...) ((void)0)
+#define STATS_SET(counter, ...) ((void)0)
+#endif
+
+// Counters gathered while generating a planet, to know where the time goes
+// (noise, normals or GPU upload)
+struct GenerationStats {
+    // noise
+    uint64_t samplesEvaluated = 0;
+    uint64_t octavesEvaluated = 0;
+
+    // noise cache (reused when only the radius changes)
+    uint64_t cacheHits = 0;
+    uint64_t cacheMisses = 0;
+
+    // time per stage, in milliseconds
+    // the noise is the CPU time summed over the threads: it can be more than the total
+    double noiseMs = 0.0;
+    double normalsMs = 0.0;
+    double uploadMs = 0.0;
+    double totalMs = 0.0;
+
+    // post-transform cache efficiency of the index buffer (see VertexCacheStats)
+    // measured on one face, compared with the plain row by row order
+    double acmr = 0.0;
+    double atvr = 0.0;
+    double acmrRowMajor = 0.0;
+
+    // simplification (see GridSimplifier): triangles before and after,
+    // and distance between the full grid and the simplified one
+    uint64_t fullTriangles = 0;
+    uint64_t simplifiedTriangles = 0;
+    double simplifyMaxError = 0.0;
+    double simplifyRmsError = 0.0;
+    double simplifyMs = 0.0;
+
+    // spacing of the grid on the unit sphere with the chosen cube projection (see CubeSphereMapping),
+    // and triangles each projection needs for the same longest edge
+    double maxEdgeLength = 0.0;
+    double edgeLengthRatio = 0.0;
+    uint64_t equalEdgeTrianglesNormalize = 0;
+    uint64_t equalEdgeTrianglesTangent = 0;
+    uint64_t equalEdgeTrianglesEqualArea = 0;
+
+    // vertices each tessellation backend needs for the longest edge of the current mesh (see SphereTessellation)
+    uint64_t equalEdgeVerticesCube = 0;
+    uint64_t equalEdgeVerticesIcosphere = 0;
+    uint64_t equalEdgeVerticesHEALPix = 0;
+    // building the mesh of the unit sphere, for the backends other than the cube
+    double tessellationMs = 0.0;
+
+    // triangles of the shadow proxy (see PlanetGenerator::generateShadowProxy) over all its levels,
+    // and the step forced on the grid of the coarsest one
+    uint64_t shadowTriangles = 0;
+    uint64_t shadowLevels = 0;
+    uint64_t shadowMinStep = 0;
+    double shadowMs = 0.0;
+
+    // last sculpting stroke (regeneration of the region + normals, without the upload)
+    double sculptMs = 0.0;
+    uint64_t sculptVertices = 0;
+
+    void reset() { *this = GenerationStats(); }
+
+    double nsPerSample() const {
+        return samplesEvaluated == 0 ? 0.0 : noiseMs * 1e6 / double(samplesEvaluated);
+    }
+
+    std::string toJson() const {
+        std::ostringstream json;
+        json << "{\n"
+             << "  \"samplesEvaluated\": " << samplesEvaluated << ",\n"
+             << "  \"octavesEvaluated\": " << octavesEvaluated << ",\n"
+             << "  \"cacheHits\": " << cacheHits << ",\n"
+             << "  \"cacheMisses\": " << cacheMisses << ",\n"
+             << "  \"noiseMs\": " << noiseMs << ",\n"
+             << "  \"normalsMs\": " << normalsMs << ",\n"
+             << "  \"uploadMs\": " << uploadMs << ",\n"
+             << "  \"totalMs\": " << totalMs << ",\n"
+             << "  \"acmr\": " << acmr << ",\n"
+             << "  \"atvr\": " << atvr << ",\n"
+             << "  \"acmrRowMajor\": " << acmrRowMajor << ",\n"
+             << "  \"fullTriangles\": " << fullTriangles << ",\n"
+             << "  \"simplifiedTriangles\": " << simplifiedTriangles << ",\n"
+             << "  \"simplifyMaxError\": " << simplifyMaxError << ",\n"
+             << "  \"simplifyRmsError\": " << simplifyRmsError << ",\n"
+             << "  \"simplifyMs\": " << simplifyMs << ",\n"
+             << "  \"maxEdgeLength\": " << maxEdgeLength << ",\n"
+             << "  \"edgeLengthRatio\": " << edgeLengthRatio << ",\n"
+             << "  \"equalEdgeTrianglesNormalize\": " << equalEdgeTrianglesNormalize << ",\n"
+             << "  \"equalEdgeTrianglesTangent\": " << equalEdgeTrianglesTangent << ",\n"
+             << "  \"equalEdgeTrianglesEqualArea\": " << equalEdgeTrianglesEqualArea << ",\n"
+             << "  \"equalEdgeVerticesCube\": " << equalEdgeVerticesCube << ",\n"
+             << "  \"equalEdgeVerticesIcosphere\": " << equalEdgeVerticesIcosphere << ",\n"
+             << "  \"equalEdgeVerticesHEALPix\": " << equalEdgeVerticesHEALPix << ",\n"
+             << "  \"tessellationMs\": " << tessellationMs << ",\n"
+             << "  \"shadowTriangles\": " << shadowTriangles << ",\n"
+             << "  \"shadowLevels\": " << shadowLevels << ",\n"
+             << "  \"shadowMinStep\": " << shadowMinStep << ",\n"
+             << "  \"shadowMs\": " << shadowMs << ",\n"
+             << "  \"sculptMs\": " << sculptMs << ",\n"
+             << "  \"sculptVertices\": " << sculptVertices << ",\n"
+             << "  \"nsPerSample\": " << nsPerSample() << "\n"
+             << "}\n";
+        return json.str();
+    }
+};
+
+// Small helper to time a generation stage
+class StageTimer {
+   public:
+    StageTimer() : mStart(std::chrono::steady_clock::now()) {}
+
+    double elapsedMs() const {
+        auto elapsed = std::chrono::steady_clock::now() - mStart;
+        return std::chrono::duration<double, std::milli>(elapsed).count();
+    }
+
+   private:
+    std::chrono::steady_clock::time_point mStart;
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include "procgen/FaceGenerator.hpp"
+#include "procgen/TerrainBounds.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Curvature adaptive simplification of a face grid, done after the generation
+// each tile of TerrainBounds is triangulated with the coarsest power of 2 step that keeps
+// the distance between the full grid and the coarse triangles under the target error
+// - the cells of a tile all have the same size, so the inside of a tile is always conforming
+// - on the border between 2 tiles, the edges of the cells follow the step of the finer tile:
+//   the cells of the coarser one are split in a fan around their center to meet them
+// - the borders of the faces keep every vertex, so the faces stay crack-free with each other
+// a minimum step can be forced whatever the error, for cells that would be too small to matter anyway
+class GridSimplifier {
+   public:
+    static constexpr unsigned int MAX_STEP = TerrainBounds::TILE_SIZE;
+
+    GridSimplifier(FaceGenerator const& _face, unsigned int _resolution, float _target_error, unsigned int _min_step = 1)
+        : face(_face), resolution(_resolution), target_error(_target_error), min_step(_min_step) {
+        tiles_per_side = TerrainBounds::tileCountPerSide(resolution);
+    }
+
+    // pick the step of every tile of the face, row by row
+    // also gives the largest and the squared sum of the errors of the chosen steps (on the vertices of the full grid)
+    void chooseSteps(std::vector<VertexAttributes> const& vertexData) {
+        steps.assign(tiles_per_side * tiles_per_side, 1);
+        max_error = 0.0f;
+        squared_error_sum = 0.0;
+        for (unsigned int tile_y = 0; tile_y < tiles_per_side; tile_y++) {
+            for (unsigned int tile_x = 0; tile_x < tiles_per_side; tile_x++) {
+                chooseTileStep(vertexData, tile_x, tile_y);
+            }
+        }
+    }
+
+    // pick the step of a single tile, after its vertices moved
+    // (the other tiles keep the steps given by setTileSteps, the errors are only added up)
+    void chooseTileStep(std::vector<VertexAttributes> const& vertexData, unsigned int tile_x, unsigned int tile_y) {
+        unsigned int width, height;
+        tileSize(tile_x, tile_y, width, height);
+        unsigned int step = 1;
+        float error = 0.0f;
+        double squared_error = 0.0;
+        // the error grows with the step: stop at the first one that is too coarse (past the minimum step)
+        for (unsigned int next = 2; next <= MAX_STEP && width % next == 0 && height % next == 0; next *= 2) {
+            double next_squared_error = 0.0;
+            float give_up_error = next > min_step ? target_error : FLT_MAX;
+            float next_error = stepError(vertexData, tile_x, tile_y, width, height, next, give_up_error, next_squared_error);
+            if (next_error > target_error && next > min_step) break;
+            step = next;
+            error = next_error;
+            squared_error = next_squared_error;
+        }
+        steps[tile_y * tiles_per_side + tile_x] = step;
+        max_error = std::max(max_error, error);
+        squared_error_sum += squared_error;
+    }
+
+    // the steps of the tiles, row by row, to simplify some of them again later without the others
+    std::vector<unsigned int> const& tileSteps() const { return steps; }
+    void setTileSteps(std::vector<unsigned int> const& _steps) { steps = _steps; }
+
+    // append the triangles of the face to indices, tile by tile in the same order as the tiles of TerrainBounds
+    // and the index count of each tile to tileIndexCounts
+    void generateIndices(std::vector<uint32_t>& indices, std::vector<uint32_t>& tileIndexCounts) const {
+        for (unsigned int tile_y = 0; tile_y < tiles_per_side; tile_y++) {
+            for (unsigned int tile_x = 0; tile_x < tiles_per_side; tile_x++) {
+                size_t first = indices.size();
+                generateTileIndices(tile_x, tile_y, indices);
+                tileIndexCounts.push_back(uint32_t(indices.size() - first));
+            }
+        }
+    }
+
+    float maxError() const { return max_error; }
+    double squaredErrorSum() const { return squared_error_sum; }
+
+   private:
+    void tileSize(unsigned int tile_x, unsigned int tile_y, unsigned int& width, unsigned int& height) const {
+        unsigned int quads_per_side = resolution - 1;
+        width = std::min(TerrainBounds::TILE_SIZE, quads_per_side - tile_x * TerrainBounds::TILE_SIZE);
+        height = std::min(TerrainBounds::TILE_SIZE, quads_per_side - tile_y * TerrainBounds::TILE_SIZE);
+    }
+
+    unsigned int tileStep(int tile_x, int tile_y) const {
+        return steps[tile_y * tiles_per_side + tile_x];
+    }
+
+    // distance between the vertices of the tile and the triangles of the cells of the given step
+    // (with the same diagonal as the full grid)
+    // stops as soon as the error goes over give_up_error, the step is rejected anyway
+    float stepError(
+        std::vector<VertexAttributes> const& vertexData,
+        unsigned int tile_x, unsigned int tile_y,
+        unsigned int width, unsigned int height,
+        unsigned int step,
+        float give_up_error,
+        double& squared_error) const {
+        float error = 0.0f;
+        unsigned int x_start = tile_x * TerrainBounds::TILE_SIZE;
+        unsigned int y_start = tile_y * TerrainBounds::TILE_SIZE;
+        for (unsigned int cell_y = y_start; cell_y < y_start + height; cell_y += step) {
+            for (unsigned int cell_x = x_start; cell_x < x_start + width; cell_x += step) {
+                glm::vec3 p00 = vertexData[face.vertexIndex(cell_x, cell_y)].position;
+                glm::vec3 p10 = vertexData[face.vertexIndex(cell_x + step, cell_y)].position;
+                glm::vec3 p01 = vertexData[face.vertexIndex(cell_x, cell_y + step)].position;
+                glm::vec3 p11 = vertexData[face.vertexIndex(cell_x + step, cell_y + step)].position;
+                // the vertices on the right and top edges are done by the next cells
+                for (unsigned int y = 0; y < step; y++) {
+                    for (unsigned int x = 0; x < step; x++) {
+                        float u = float(x) / float(step), v = float(y) / float(step);
+                        glm::vec3 interpolated = u >= v
+                                                     ? p00 + u * (p10 - p00) + v * (p11 - p10)   // (00, 10, 11)
+                                                     : p00 + v * (p01 - p00) + u * (p11 - p01);  // (00, 11, 01)
+                        float distance = glm::length(vertexData[face.vertexIndex(cell_x + x, cell_y + y)].position - interpolated);
+                        error = std::max(error, distance);
+                        squared_error += double(distance) * double(distance);
+                    }
+                }
+                if (error > give_up_error) return error;
+            }
+        }
+        return error;
+    }
+
+    // step of the vertices along the border of a tile: the finest of the 2 tiles, every vertex on a face border
+    unsigned int borderStep(unsigned int tile_x, unsigned int tile_y, int dx, int dy) const {
+        int neighbour_x = int(tile_x) + dx, neighbour_y = int(tile_y) + dy;
+        if (neighbour_x < 0 || neighbour_y < 0 || neighbour_x >= int(tiles_per_side) || neighbour_y >= int(tiles_per_side)) {
+            return 1;
+        }
+        return std::min(tileStep(tile_x, tile_y), tileStep(neighbour_x, neighbour_y));
+    }
+
+    void generateTileIndices(unsigned int tile_x, unsigned int tile_y, std::vector<uint32_t>& indices) const {
+        unsigned int width, height;
+        tileSize(tile_x, tile_y, width, height);
+        unsigned int step = tileStep(tile_x, tile_y);
+        unsigned int x_start = tile_x * TerrainBounds::TILE_SIZE;
+        unsigned int y_start = tile_y * TerrainBounds::TILE_SIZE;
+        unsigned int cells_x = width / step, cells_y = height / step;
+        unsigned int left = borderStep(tile_x, tile_y, -1, 0), right = borderStep(tile_x, tile_y, 1, 0);
+        unsigned int bottom = borderStep(tile_x, tile_y, 0, -1), top = borderStep(tile_x, tile_y, 0, 1);
+
+        // same band order as FaceGenerator::generateFaceIndices, in cells, for the post-transform cache
+        for (unsigned int band = 0; band < cells_x; band += FaceGenerator::CACHE_BAND_WIDTH) {
+            unsigned int band_end = std::min(band + FaceGenerator::CACHE_BAND_WIDTH, cells_x);
+            for (unsigned int cell_y = 0; cell_y < cells_y; cell_y++) {
+                for (unsigned int cell_x = band; cell_x < band_end; cell_x++) {
+                    // the step of each edge of the cell: finer on the borders of the tile next to a finer tile
+                    unsigned int edge_bottom = cell_y == 0 ? bottom : step;
+                    unsigned int edge_right = cell_x == cells_x - 1 ? right : step;
+                    unsigned int edge_top = cell_y == cells_y - 1 ? top : step;
+                    unsigned int edge_left = cell_x == 0 ? left : step;
+                    unsigned int x = x_start + cell_x * step, y = y_start + cell_y * step;
+                    if (edge_bottom == step && edge_right == step && edge_top == step && edge_left == step) {
+                        addCell(x, y, step, indices);
+                    } else {
+                        addFanCell(x, y, step, edge_bottom, edge_right, edge_top, edge_left, indices);
+                    }
+                }
+            }
+        }
+    }
+
+    // the 2 triangles of a cell, like the quads of the full grid
+    void addCell(unsigned int x, unsigned int y, unsigned int step, std::vector<uint32_t>& indices) const {
+        uint32_t i00 = face.vertexIndex(x, y), i10 = face.vertexIndex(x + step, y);
+        uint32_t i01 = face.vertexIndex(x, y + step), i11 = face.vertexIndex(x + step, y + step);
+        indices.insert(indices.end(), {i00, i11, i01, i00, i10, i11});
+    }
+
+    // a fan around the center of the cell, going around the border in the same direction as the grid triangles
+    // (bottom, right, top then left) with the vertices of each edge at its own step
+    void addFanCell(
+        unsigned int x, unsigned int y, unsigned int step,
+        unsigned int edge_bottom, unsigned int edge_right, unsigned int edge_top, unsigned int edge_left,
+        std::vector<uint32_t>& indices) const {
+        uint32_t center = face.vertexIndex(x + step / 2, y + step / 2);
+        auto addEdge = [&](unsigned int x0, unsigned int y0, int dx, int dy, unsigned int edge_step) {
+            for (unsigned int k = 0; k < step; k += edge_step) {
+                uint32_t a = face.vertexIndex(x0 + dx * int(k), y0 + dy * int(k));
+                uint32_t b = face.vertexIndex(x0 + dx * int(k + edge_step), y0 + dy * int(k + edge_step));
+                indices.insert(indices.end(), {center, a, b});
+            }
+        };
+        addEdge(x, y, 1, 0, edge_bottom);
+        addEdge(x + step, y, 0, 1, edge_right);
+        addEdge(x + step, y + step, -1, 0, edge_top);
+        addEdge(x, y + step, 0, -1, edge_left);
+    }
+
+    FaceGenerator const& face;
+    unsigned int resolution;
+    float target_error;
+    unsigned int min_step;
+    unsigned int tiles_per_side;
+
+    std::vector<unsigned int> steps;
+    float max_error = 0.0f;
+    double squared_error_sum = 0.0;
+};
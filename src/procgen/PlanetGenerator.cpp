@@ -1,63 +1,862 @@
 #include "procgen/PlanetGenerator.h"
 
+#include <algorithm>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+// run the function on [0, count) split in contiguous chunks, one per hardware thread
+template <typename Function>
+static void parallelFor(size_t count, Function function) {
+    size_t threadCount = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+    if (threadCount <= 1) {
+        function(size_t(0), count);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; t++) {
+        threads.emplace_back(function, count * t / threadCount, count * (t + 1) / threadCount);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
 // Generates all the resources necessary to render the planet
 // - vertex attributes
+// - bounds of the terrain
 // - later on materials ??
 void PlanetGenerator::generatePlanetData(
     std::vector<VertexAttributes> &vertexData,
     std::vector<uint32_t> &indices,
     GUISettings settings) {
+    mSettings = settings;
+    mStats.reset();
+
+    // the noise does not depend on the radius: reuse it if only the radius changed
+    bool sameGrid = mCachedResolution == settings.resolution &&
+                    mCachedTessellation == settings.tessellation &&
+                    mCachedProjection == settings.projection;
+    bool useCachedNoise = sameGrid &&
+                          mCachedFrequency == settings.frequency &&
+                          mCachedOctaves == settings.octaves;
+
+    auto start = chrono::steady_clock::now();
+    size_t firstFaceIndexCount;
+    if (settings.tessellation == Tessellation::CubeSphere) {
+        // the sculpting is lost when the grid changes
+        if (!sameGrid) {
+            mSculptOffsets.assign(6 * FaceGenerator::vertexCount(settings.resolution), 0.0f);
+        }
+        firstFaceIndexCount = generateCubeData(vertexData, indices, settings, useCachedNoise);
+    } else {
+        mSculptOffsets.clear();
+        firstFaceIndexCount = generateTessellatedData(vertexData, indices, settings, useCachedNoise);
+    }
+    generateShadowProxy(vertexData, indices, settings);
+
+    if (useCachedNoise) {
+        STATS_ADD(mStats.cacheHits, vertexData.size());
+    } else {
+        STATS_ADD(mStats.cacheMisses, vertexData.size());
+    }
+    mCachedResolution = settings.resolution;
+    mCachedFrequency = settings.frequency;
+    mCachedOctaves = settings.octaves;
+    mCachedTessellation = settings.tessellation;
+    mCachedProjection = settings.projection;
+
+    auto end = chrono::steady_clock::now();
+    STATS_ADD(mStats.totalMs, chrono::duration<double, milli>(end - start).count());
+    cout << "Time to generate planet data: "
+         << chrono::duration_cast<chrono::milliseconds>(end - start).count()
+         << " ms" << endl;
+
+#if PROCPLANETS_STATS
+    // not counted in the generation time, it is only a measure
+    measureVertexCache(indices, settings.resolution, firstFaceIndexCount);
+    measureProjections(settings);
+    measureTessellations(settings);
+#endif
+}
+
+// the cube grid of FaceGenerator, with tiles, simplification and sculpting
+// returns the index count of the first face
+size_t PlanetGenerator::generateCubeData(
+    std::vector<VertexAttributes> &vertexData,
+    std::vector<uint32_t> &indices,
+    GUISettings const &settings,
+    bool useCachedNoise) {
     // settings of the planet
     unsigned int resolution = settings.resolution;
-    ElevationGenerator elevationGenerator(
-        settings.radius,
-        settings.frequency,
-        settings.octaves);
+    std::vector<glm::vec3> const &faces = mFaces;
 
-    // define the 6 faces normals
-    auto top = glm::vec3(0.0f, 1.0f, 0.0f);
-    auto down = glm::vec3(0.0f, -1.0f, 0.0f);
-    auto left = glm::vec3(-1.0f, 0.0f, 0.0f);
-    auto right = glm::vec3(1.0f, 0.0f, 0.0f);
-    auto front = glm::vec3(0.0f, 0.0f, 1.0f);
-    auto back = glm::vec3(0.0f, 0.0f, -1.0f);
-    std::vector<glm::vec3> faces{top, down, left, right, front, back};
+    // size the vectors for all the faces at once: each face then writes in its own range
+    vertexData.resize(faces.size() * FaceGenerator::vertexCount(resolution));
+    indices.resize(faces.size() * FaceGenerator::indexCount(resolution));
+    mBounds.reset(faces.size(), resolution);
+    mNoiseCache.resize(vertexData.size());
 
-    // make sure the vectors are empty
-    vertexData.resize(0);
-    indices.resize(0);
+    // generate each face on its own thread
+    // the bounds, histogram and normals are all done in the same pass as the noise evaluation
+    std::vector<FaceGenerator> faceGenerators = makeFaceGenerators(settings);
+    std::vector<std::thread> threads;
+    for (auto &faceGenerator : faceGenerators) {
+        threads.emplace_back([&]() {
+            faceGenerator.generateFaceData(vertexData, indices, mNoiseCache, useCachedNoise, mSculptOffsets, mBounds);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
 
-    // generate each face
-    auto start = chrono::steady_clock::now();
+    // the normals are always from the full grid, only the triangles are simplified
+    std::vector<uint32_t> tileIndexCounts;
+    if (settings.simplify) {
+        simplify(vertexData, indices, faceGenerators, settings, tileIndexCounts);
+    } else {
+        tileIndexCounts = TerrainClusters::gridTileIndexCounts(faces.size(), resolution);
+    }
+    mClusters.reset(resolution, tileIndexCounts);
+    parallelFor(faceGenerators.size(), [&](size_t faceStart, size_t faceEnd) {
+        for (size_t face = faceStart; face < faceEnd; face++) {
+            faceGenerators[face].generateFaceClusters(vertexData, indices, mClusters);
+        }
+    });
+
+    // merge what each face computed
     for (uint8_t i = 0; i < faces.size(); i++) {
-        glm::vec3 face = faces[i];
-        FaceGenerator faceGenerator(face, resolution, elevationGenerator);
-        faceGenerator.generateFaceData(vertexData, indices);
+        faceGenerators[i].collectStats(mStats);
+        mBounds.planet.merge(mBounds.faces[i]);
+        auto const &histogram = faceGenerators[i].getHistogram();
+        for (unsigned int bin = 0; bin < TerrainBounds::HISTOGRAM_BINS; bin++) {
+            mBounds.histogram[bin] += histogram[bin];
+        }
     }
 
-    // compute the normals
-    // TODO: could be inproved by computing normals on the edges of the faces
-    for (uint32_t i = 0; i < indices.size(); i += 3) {
+    size_t tilesPerFace = tileIndexCounts.size() / faces.size();
+    return std::accumulate(tileIndexCounts.begin(), tileIndexCounts.begin() + tilesPerFace, size_t(0));
+}
+
+// any other tessellation: the same noise, normals and clusters, computed on the mesh of the backend
+// each patch of the backend is a single tile of the bounds, so the culling still works
+// returns the index count of the first patch
+size_t PlanetGenerator::generateTessellatedData(
+    std::vector<VertexAttributes> &vertexData,
+    std::vector<uint32_t> &indices,
+    GUISettings const &settings,
+    bool useCachedNoise) {
+    std::unique_ptr<SphereTessellation> tessellation = makeTessellation(settings);
+    std::vector<glm::vec3> points;
+    std::vector<uint32_t> patchIndexCounts;
+    StageTimer tessellationTimer;
+    tessellation->build(tessellation->subdivisions(settings.resolution), 1, points, indices, patchIndexCounts);
+    STATS_SET(mStats.tessellationMs, tessellationTimer.elapsedMs());
+
+    // one tile per patch (a resolution of 2 gives a single tile per face)
+    // reset before the noise, which fills the histogram
+    mBounds.reset(patchIndexCounts.size(), 2);
+
+    // noise and elevation, the histogram and the counters are merged at the end of each chunk
+    // (the noise time is summed over the chunks, like over the faces of the cube sphere)
+    vertexData.resize(points.size());
+    mNoiseCache.resize(points.size());
+    ElevationGenerator elevationGenerator(settings.radius, settings.frequency, settings.octaves);
+    std::mutex mergeMutex;
+    parallelFor(points.size(), [&](size_t first, size_t last) {
+        StageTimer noiseTimer;
+        ElevationGenerator generator = elevationGenerator;
+        std::array<uint32_t, TerrainBounds::HISTOGRAM_BINS> histogram{};
+        for (size_t i = first; i < last; i++) {
+            if (!useCachedNoise) {
+                mNoiseCache[i] = generator.evaluateNoise(points[i]);
+            }
+            vertexData[i] = {
+                generator.displace(points[i], mNoiseCache[i]),  // position
+                glm::vec3(0.0f),                                // normal
+                glm::vec3(0.0f),                                // color
+                glm::vec2(0.0f),                                // uv
+                glm::vec3(0.0f),                                // tangent
+                glm::vec3(0.0f),                                // bitangent
+            };
+            histogram[TerrainBounds::histogramBin(mNoiseCache[i])]++;
+        }
+        [[maybe_unused]] double chunkNoiseMs = noiseTimer.elapsedMs();
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        generator.collectStats(mStats);
+        STATS_ADD(mStats.noiseMs, chunkNoiseMs);
+        for (unsigned int bin = 0; bin < TerrainBounds::HISTOGRAM_BINS; bin++) {
+            mBounds.histogram[bin] += histogram[bin];
+        }
+    });
+
+    // same weighted normals as FaceGenerator::generateFaceData, the triangles of a vertex can be
+    // in several patches so they are accumulated on a single thread
+    StageTimer normalsTimer;
+    for (size_t i = 0; i < indices.size(); i += 3) {
         auto &v1 = vertexData[indices[i]];
         auto &v2 = vertexData[indices[i + 1]];
         auto &v3 = vertexData[indices[i + 2]];
-        auto edge1 = v2.position - v1.position;
-        auto edge2 = v3.position - v1.position;
+        glm::vec3 normal = glm::cross(v2.position - v1.position, v3.position - v1.position);
+        v1.normal += normal;
+        v2.normal += normal;
+        v3.normal += normal;
+    }
+    parallelFor(vertexData.size(), [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            vertexData[i].normal = glm::normalize(vertexData[i].normal);
+        }
+    });
+    STATS_ADD(mStats.normalsMs, normalsTimer.elapsedMs());
 
-        // DON'T normalize here, we want to keep each magnitude data information
-        auto face_normal = glm::cross(edge1, edge2);
-        v1.normal += face_normal;
-        v2.normal += face_normal;
-        v3.normal += face_normal;
+    mClusters.reset(2, patchIndexCounts);
+    std::vector<uint32_t> patchFirstIndex(patchIndexCounts.size() + 1, 0);
+    std::partial_sum(patchIndexCounts.begin(), patchIndexCounts.end(), patchFirstIndex.begin() + 1);
+    parallelFor(patchIndexCounts.size(), [&](size_t patchStart, size_t patchEnd) {
+        for (size_t patch = patchStart; patch < patchEnd; patch++) {
+            Bounds &bounds = mBounds.faces[patch];
+            for (uint32_t i = patchFirstIndex[patch]; i < patchFirstIndex[patch + 1]; i++) {
+                glm::vec3 position = vertexData[indices[i]].position;
+                bounds.add(position, glm::length(position));
+            }
+            mBounds.tiles[patch] = bounds;
+            mClusters.computeTile(patch, vertexData, indices);
+        }
+    });
+    for (Bounds const &bounds : mBounds.faces) {
+        mBounds.planet.merge(bounds);
     }
+    return patchIndexCounts.empty() ? 0 : patchIndexCounts[0];
+}
+
+// replace the indices of the full grid by the simplified triangles, face by face
+void PlanetGenerator::simplify(
+    std::vector<VertexAttributes> const &vertexData,
+    std::vector<uint32_t> &indices,
+    std::vector<FaceGenerator> const &faceGenerators,
+    GUISettings const &settings,
+    std::vector<uint32_t> &tileIndexCounts) {
+    StageTimer simplifyTimer;
+    std::vector<std::vector<uint32_t>> faceIndices(faceGenerators.size());
+    std::vector<std::vector<uint32_t>> faceTileIndexCounts(faceGenerators.size());
+    std::vector<float> faceMaxErrors(faceGenerators.size());
+    std::vector<double> faceSquaredErrors(faceGenerators.size());
+    parallelFor(faceGenerators.size(), [&](size_t faceStart, size_t faceEnd) {
+        for (size_t face = faceStart; face < faceEnd; face++) {
+            GridSimplifier simplifier(faceGenerators[face], settings.resolution, settings.simplifyError);
+            simplifier.chooseSteps(vertexData);
+            simplifier.generateIndices(faceIndices[face], faceTileIndexCounts[face]);
+            faceMaxErrors[face] = simplifier.maxError();
+            faceSquaredErrors[face] = simplifier.squaredErrorSum();
+        }
+    });
 
-    // final normalization needed
-    for (uint32_t i = 0; i < vertexData.size(); i++) {
-        vertexData[i].normal = glm::normalize(vertexData[i].normal);
+    STATS_SET(mStats.fullTriangles, indices.size() / 3);
+    indices.clear();
+    tileIndexCounts.clear();
+    float maxError = 0.0f;
+    double squaredErrors = 0.0;
+    for (size_t face = 0; face < faceGenerators.size(); face++) {
+        indices.insert(indices.end(), faceIndices[face].begin(), faceIndices[face].end());
+        tileIndexCounts.insert(tileIndexCounts.end(), faceTileIndexCounts[face].begin(), faceTileIndexCounts[face].end());
+        maxError = std::max(maxError, faceMaxErrors[face]);
+        squaredErrors += faceSquaredErrors[face];
     }
+    STATS_SET(mStats.simplifiedTriangles, indices.size() / 3);
+    STATS_SET(mStats.simplifyMaxError, maxError);
+    STATS_SET(mStats.simplifyRmsError, std::sqrt(squaredErrors / double(vertexData.size())));
+    STATS_SET(mStats.simplifyMs, simplifyTimer.elapsedMs());
+}
 
-    auto end = chrono::steady_clock::now();
-    cout << "Time to generate planet data: "
-         << chrono::duration_cast<chrono::milliseconds>(end - start).count()
-         << " ms" << endl;
+void PlanetGenerator::generateShadowProxy(
+    std::vector<VertexAttributes> const &vertexData,
+    std::vector<uint32_t> const &indices,
+    GUISettings const &settings) {
+    StageTimer shadowTimer;
+    mShadowIndices.clear();
+    mShadowLevels.clear();
+    mShadowLevelGrids.clear();
+
+    // the widest shadow cascade is a box fitted around the whole planet (see Renderer::updateShadowCascades),
+    // the first level is decimated down to its texels, and each next one for texels half as big, until the
+    // step reaches the cells of the mesh (the cascades with even smaller texels get the last level)
+    // - cells smaller than a texel of the cascade are merged whatever their error
+    // - an error under a texel moves the silhouettes by less than a texel, and every cascade has the depth
+    //   of the whole planet: an error under the depth bias can't be seen in any of them
+    float planetRadius = 1.01f * mBounds.planet.maxRadius;
+    float texelSize = 2.0f * planetRadius / float(mShadowMapSize);
+    float depthError = Renderer::SHADOW_DEPTH_BIAS * 2.0f * planetRadius;
+
+    if (settings.tessellation != Tessellation::CubeSphere) {
+        // sub-grids of the patches on the same points, their step has to divide the subdivisions
+        // (a multiple of 8, see SphereTessellation::roundSubdivisions): a level is skipped when its step is the same
+        // as the one of the previous level, and the last one is the full mesh
+        std::unique_ptr<SphereTessellation> tessellation = makeTessellation(settings);
+        unsigned int subdivisions = tessellation->subdivisions(settings.resolution);
+        // the average edge: the triangles (about twice the vertices) are close to equilateral and cover the sphere
+        float cellSize = mBounds.planet.maxRadius * std::sqrt(8.0f * CubeSphereMapping::PI / (std::sqrt(3.0f) * float(tessellation->vertexCount(subdivisions))));
+        std::vector<glm::vec3> points;
+        std::vector<uint32_t> levelIndices, patchIndexCounts;
+        unsigned int previousStep = 0;
+        for (float levelTexelSize = texelSize; previousStep != 1; levelTexelSize *= 0.5f) {
+            unsigned int maxStep = (unsigned int)std::min(levelTexelSize / cellSize, float(GridSimplifier::MAX_STEP));
+            unsigned int step = SphereTessellation::gridStep(subdivisions, maxStep);
+            if (step == previousStep) continue;
+            previousStep = step;
+
+            ShadowLevel level;
+            level.firstIndex = (uint32_t)mShadowIndices.size();
+            if (step == 1) {
+                // the full mesh, good enough for any texel
+                mShadowIndices.insert(mShadowIndices.end(), indices.begin(), indices.end());
+                level.clusters = mClusters;
+                for (Cluster &cluster : level.clusters.clusters) {
+                    cluster.firstIndex += level.firstIndex;
+                }
+            } else {
+                level.texelSize = float(step) * cellSize;
+                tessellation->build(subdivisions, step, points, levelIndices, patchIndexCounts);
+                mShadowIndices.insert(mShadowIndices.end(), levelIndices.begin(), levelIndices.end());
+                level.clusters.reset(2, patchIndexCounts, level.firstIndex);
+                parallelFor(patchIndexCounts.size(), [&](size_t patchStart, size_t patchEnd) {
+                    for (size_t patch = patchStart; patch < patchEnd; patch++) {
+                        level.clusters.computeTile(patch, vertexData, mShadowIndices);
+                    }
+                });
+            }
+            level.indexCount = (uint32_t)mShadowIndices.size() - level.firstIndex;
+            if (mShadowLevels.empty()) {
+                STATS_SET(mStats.shadowMinStep, step);
+            }
+            mShadowLevels.push_back(std::move(level));
+        }
+        STATS_SET(mStats.shadowTriangles, mShadowIndices.size() / 3);
+        STATS_SET(mStats.shadowLevels, mShadowLevels.size());
+        STATS_SET(mStats.shadowMs, shadowTimer.elapsedMs());
+        return;
+    }
+
+    unsigned int resolution = settings.resolution;
+    // the average spacing of the grid: a quarter of a great circle per face side
+    float cellSize = CubeSphereMapping::PI / 2.0f / float(resolution - 1) * mBounds.planet.maxRadius;
+    std::vector<FaceGenerator> faceGenerators = makeFaceGenerators(settings);
+    std::vector<std::vector<std::vector<uint32_t>>> levelFaceIndices;
+    for (float levelTexelSize = texelSize; mShadowLevelGrids.empty() || mShadowLevelGrids.back().minStep > 1; levelTexelSize *= 0.5f) {
+        ShadowLevelGrid grid;
+        grid.maxError = std::min(depthError, levelTexelSize);
+        while (grid.minStep * 2 <= GridSimplifier::MAX_STEP && float(grid.minStep * 2) * cellSize <= levelTexelSize) {
+            grid.minStep *= 2;
+        }
+
+        std::vector<std::vector<uint32_t>> faceIndices(faceGenerators.size());
+        std::vector<std::vector<uint32_t>> faceTileIndexCounts(faceGenerators.size());
+        std::vector<std::vector<unsigned int>> faceTileSteps(faceGenerators.size());
+        parallelFor(faceGenerators.size(), [&](size_t faceStart, size_t faceEnd) {
+            for (size_t face = faceStart; face < faceEnd; face++) {
+                GridSimplifier simplifier(faceGenerators[face], resolution, grid.maxError, grid.minStep);
+                simplifier.chooseSteps(vertexData);
+                simplifier.generateIndices(faceIndices[face], faceTileIndexCounts[face]);
+                faceTileSteps[face] = simplifier.tileSteps();
+            }
+        });
+        for (size_t face = 0; face < faceGenerators.size(); face++) {
+            grid.tileIndexCounts.insert(grid.tileIndexCounts.end(), faceTileIndexCounts[face].begin(), faceTileIndexCounts[face].end());
+            grid.tileSteps.insert(grid.tileSteps.end(), faceTileSteps[face].begin(), faceTileSteps[face].end());
+        }
+
+        ShadowLevel level;
+        level.texelSize = levelTexelSize;
+        mShadowLevels.push_back(std::move(level));
+        mShadowLevelGrids.push_back(std::move(grid));
+        levelFaceIndices.push_back(std::move(faceIndices));
+    }
+    assembleShadowLevels(vertexData, levelFaceIndices, {});
+
+    STATS_SET(mStats.shadowTriangles, mShadowIndices.size() / 3);
+    STATS_SET(mStats.shadowLevels, mShadowLevels.size());
+    STATS_SET(mStats.shadowMinStep, mShadowLevelGrids.front().minStep);
+    STATS_SET(mStats.shadowMs, shadowTimer.elapsedMs());
+}
+
+void PlanetGenerator::sculptShadowProxy(
+    std::vector<VertexAttributes> const &vertexData,
+    std::vector<FaceGenerator> const &faceGenerators,
+    std::vector<unsigned int> const &dirtyTiles) {
+    if (mShadowLevelGrids.empty()) return;
+    unsigned int resolution = mSettings.resolution;
+    unsigned int tilesPerSide = TerrainBounds::tileCountPerSide(resolution);
+    unsigned int tilesPerFace = tilesPerSide * tilesPerSide;
+
+    // the triangles change in the dirty tiles, and on the borders of their neighbours (which follow the finer step)
+    std::vector<bool> changedTiles(faceGenerators.size() * tilesPerFace, false);
+    std::vector<std::vector<unsigned int>> faceDirtyTiles(faceGenerators.size());
+    for (unsigned int tile : dirtyTiles) {
+        unsigned int face = tile / tilesPerFace;
+        unsigned int tileX = tile % tilesPerSide, tileY = tile % tilesPerFace / tilesPerSide;
+        faceDirtyTiles[face].push_back(tile);
+        changedTiles[tile] = true;
+        if (tileX > 0) changedTiles[tile - 1] = true;
+        if (tileX + 1 < tilesPerSide) changedTiles[tile + 1] = true;
+        if (tileY > 0) changedTiles[tile - tilesPerSide] = true;
+        if (tileY + 1 < tilesPerSide) changedTiles[tile + tilesPerSide] = true;
+    }
+
+    // the faces without dirty tiles keep their triangles, the others are simplified again from the steps
+    // of the last time, only the dirty tiles pick a new one
+    std::vector<std::vector<std::vector<uint32_t>>> levelFaceIndices(mShadowLevels.size());
+    for (size_t level = 0; level < mShadowLevels.size(); level++) {
+        std::vector<uint32_t> const &tileIndexCounts = mShadowLevelGrids[level].tileIndexCounts;
+        levelFaceIndices[level].resize(faceGenerators.size());
+        uint32_t first = mShadowLevels[level].firstIndex;
+        for (size_t face = 0; face < faceGenerators.size(); face++) {
+            uint32_t count = std::accumulate(tileIndexCounts.begin() + face * tilesPerFace, tileIndexCounts.begin() + (face + 1) * tilesPerFace, 0u);
+            if (faceDirtyTiles[face].empty()) {
+                levelFaceIndices[level][face].assign(mShadowIndices.begin() + first, mShadowIndices.begin() + first + count);
+            }
+            first += count;
+        }
+    }
+    parallelFor(mShadowLevels.size() * faceGenerators.size(), [&](size_t start, size_t end) {
+        for (size_t i = start; i < end; i++) {
+            size_t level = i / faceGenerators.size(), face = i % faceGenerators.size();
+            if (faceDirtyTiles[face].empty()) continue;
+            ShadowLevelGrid &grid = mShadowLevelGrids[level];
+            auto faceSteps = grid.tileSteps.begin() + face * tilesPerFace;
+            GridSimplifier simplifier(faceGenerators[face], resolution, grid.maxError, grid.minStep);
+            simplifier.setTileSteps(std::vector<unsigned int>(faceSteps, faceSteps + tilesPerFace));
+            for (unsigned int tile : faceDirtyTiles[face]) {
+                simplifier.chooseTileStep(vertexData, tile % tilesPerSide, tile % tilesPerFace / tilesPerSide);
+            }
+            std::copy(simplifier.tileSteps().begin(), simplifier.tileSteps().end(), faceSteps);
+            std::vector<uint32_t> faceTileIndexCounts;
+            simplifier.generateIndices(levelFaceIndices[level][face], faceTileIndexCounts);
+            std::copy(faceTileIndexCounts.begin(), faceTileIndexCounts.end(), grid.tileIndexCounts.begin() + face * tilesPerFace);
+        }
+    });
+    assembleShadowLevels(vertexData, levelFaceIndices, changedTiles);
+    STATS_SET(mStats.shadowTriangles, mShadowIndices.size() / 3);
+}
+
+void PlanetGenerator::assembleShadowLevels(
+    std::vector<VertexAttributes> const &vertexData,
+    std::vector<std::vector<std::vector<uint32_t>>> const &levelFaceIndices,
+    std::vector<bool> const &changedTiles) {
+    mShadowIndices.clear();
+    for (size_t level = 0; level < mShadowLevels.size(); level++) {
+        ShadowLevel &shadowLevel = mShadowLevels[level];
+        shadowLevel.firstIndex = (uint32_t)mShadowIndices.size();
+        for (std::vector<uint32_t> const &faceIndices : levelFaceIndices[level]) {
+            mShadowIndices.insert(mShadowIndices.end(), faceIndices.begin(), faceIndices.end());
+        }
+        shadowLevel.indexCount = (uint32_t)mShadowIndices.size() - shadowLevel.firstIndex;
+
+        std::vector<uint32_t> const &tileIndexCounts = mShadowLevelGrids[level].tileIndexCounts;
+        TerrainClusters previous = std::move(shadowLevel.clusters);
+        shadowLevel.clusters.reset(mSettings.resolution, tileIndexCounts, shadowLevel.firstIndex);
+        parallelFor(tileIndexCounts.size(), [&](size_t tileStart, size_t tileEnd) {
+            for (size_t tile = tileStart; tile < tileEnd; tile++) {
+                if (changedTiles.empty() || changedTiles[tile]) {
+                    shadowLevel.clusters.computeTile(tile, vertexData, mShadowIndices);
+                } else {
+                    shadowLevel.clusters.copyTile(tile, previous);
+                }
+            }
+        });
+    }
+}
+
+// replay the indices of the first face through a simulated post-transform cache,
+// and the same face in plain row by row order for comparison (all the faces have the same topology)
+void PlanetGenerator::measureVertexCache(std::vector<uint32_t> const &indices, unsigned int resolution, size_t firstFaceIndexCount) {
+    size_t faceIndexCount = FaceGenerator::indexCount(resolution);
+    VertexCacheStats cacheStats = VertexCacheStats::measure(indices, 0, firstFaceIndexCount);
+    STATS_SET(mStats.acmr, cacheStats.acmr);
+    STATS_SET(mStats.atvr, cacheStats.atvr);
+
+    std::vector<uint32_t> rowMajor;
+    rowMajor.reserve(faceIndexCount);
+    for (uint32_t y = 0; y + 1 < resolution; y++) {
+        for (uint32_t x = 0; x + 1 < resolution; x++) {
+            uint32_t i = x + y * resolution;
+            rowMajor.insert(rowMajor.end(), {i, i + resolution + 1, i + resolution, i, i + 1, i + resolution + 1});
+        }
+    }
+    STATS_SET(mStats.acmrRowMajor, VertexCacheStats::measure(rowMajor, 0, rowMajor.size()).acmr);
+}
+
+// the longest edge shrinks like 1 / (resolution - 1): measure its factor for each projection once on a
+// reference grid, then find the resolution each one needs to match the edges of the current grid
+void PlanetGenerator::measureProjections(GUISettings const &settings) {
+    const unsigned int referenceResolution = 257;
+    float minLength, maxLength;
+    double edgeFactors[3];
+    for (int projection = 0; projection < 3; projection++) {
+        CubeSphereMapping::edgeLengths(CubeProjection(projection), referenceResolution, minLength, maxLength);
+        edgeFactors[projection] = double(maxLength) * (referenceResolution - 1);
+        if (CubeProjection(projection) == settings.projection) {
+            STATS_SET(mStats.edgeLengthRatio, maxLength / minLength);
+        }
+    }
+    double maxEdge = edgeFactors[int(settings.projection)] / (settings.resolution - 1);
+    STATS_SET(mStats.maxEdgeLength, maxEdge);
+
+    uint64_t triangles[3];
+    for (int projection = 0; projection < 3; projection++) {
+        uint64_t quadsPerSide = uint64_t(std::ceil(edgeFactors[projection] / maxEdge - 1e-6));
+        triangles[projection] = mFaces.size() * quadsPerSide * quadsPerSide * 2;
+    }
+    STATS_SET(mStats.equalEdgeTrianglesNormalize, triangles[int(CubeProjection::Normalize)]);
+    STATS_SET(mStats.equalEdgeTrianglesTangent, triangles[int(CubeProjection::Tangent)]);
+    STATS_SET(mStats.equalEdgeTrianglesEqualArea, triangles[int(CubeProjection::EqualArea)]);
+}
+
+// same measure for the tessellation backends: vertices each one needs for the longest edge of the current mesh
+// (the cube uses the current projection)
+void PlanetGenerator::measureTessellations(GUISettings const &settings) {
+    const Tessellation tessellations[] = {Tessellation::CubeSphere, Tessellation::Icosphere, Tessellation::HEALPix};
+    const unsigned int referenceSubdivisions = 64;
+    double edgeFactors[3];
+    std::unique_ptr<SphereTessellation> backends[3];
+    for (int t = 0; t < 3; t++) {
+        GUISettings backendSettings = settings;
+        backendSettings.tessellation = tessellations[t];
+        backends[t] = makeTessellation(backendSettings);
+        float minLength, maxLength;
+        backends[t]->edgeLengths(referenceSubdivisions, minLength, maxLength);
+        edgeFactors[t] = double(maxLength) * referenceSubdivisions;
+        // the cube ones are already measured more finely by measureProjections
+        if (tessellations[t] == settings.tessellation && settings.tessellation != Tessellation::CubeSphere) {
+            STATS_SET(mStats.edgeLengthRatio, maxLength / minLength);
+        }
+    }
+    int current = int(settings.tessellation);
+    double maxEdge = edgeFactors[current] / backends[current]->subdivisions(settings.resolution);
+    if (settings.tessellation != Tessellation::CubeSphere) {
+        STATS_SET(mStats.maxEdgeLength, maxEdge);
+    }
+
+    uint64_t vertices[3];
+    for (int t = 0; t < 3; t++) {
+        unsigned int subdivisions = (unsigned int)std::ceil(edgeFactors[t] / maxEdge - 1e-6);
+        vertices[t] = backends[t]->vertexCount(subdivisions);
+    }
+    STATS_SET(mStats.equalEdgeVerticesCube, vertices[int(Tessellation::CubeSphere)]);
+    STATS_SET(mStats.equalEdgeVerticesIcosphere, vertices[int(Tessellation::Icosphere)]);
+    STATS_SET(mStats.equalEdgeVerticesHEALPix, vertices[int(Tessellation::HEALPix)]);
+}
+
+// points on the circle of the unit sphere at the given angle around the center
+static std::vector<glm::vec3> circleOnSphere(glm::vec3 center, float angle) {
+    glm::vec3 tangent = glm::normalize(glm::cross(center, std::abs(center.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0)));
+    glm::vec3 bitangent = glm::cross(center, tangent);
+    std::vector<glm::vec3> circle;
+    const int pointCount = 64;
+    for (int k = 0; k < pointCount; k++) {
+        float phi = 2.0f * 3.14159265f * k / float(pointCount);
+        glm::vec3 side = tangent * cos(phi) + bitangent * sin(phi);
+        circle.push_back(center * cos(angle) + side * sin(angle));
+    }
+    return circle;
+}
+
+std::vector<FaceGenerator> PlanetGenerator::makeFaceGenerators(GUISettings const &settings) const {
+    ElevationGenerator elevationGenerator(
+        settings.radius,
+        settings.frequency,
+        settings.octaves);
+    std::vector<FaceGenerator> faceGenerators;
+    for (uint8_t i = 0; i < mFaces.size(); i++) {
+        faceGenerators.emplace_back(mFaces[i], i, settings.resolution, settings.projection, elevationGenerator);
+    }
+    return faceGenerators;
+}
+
+std::unique_ptr<SphereTessellation> PlanetGenerator::makeTessellation(GUISettings const &settings) const {
+    switch (settings.tessellation) {
+        case Tessellation::Icosphere:
+            return std::make_unique<IcosphereTessellation>();
+        case Tessellation::HEALPix:
+            return std::make_unique<HealpixTessellation>();
+        case Tessellation::CubeSphere:
+        default:
+            return std::make_unique<CubeSphereTessellation>(settings.projection, mFaces);
+    }
 }
+
+bool PlanetGenerator::sculpt(
+    std::vector<VertexAttributes> &vertexData,
+    std::vector<uint32_t> const &indices,
+    glm::vec3 brushCenter,
+    GUISettings const &settings,
+    std::vector<VertexRange> &dirtyRanges) {
+    dirtyRanges.clear();
+    if (settings.brushMode == BrushMode::Off || mSculptOffsets.size() != vertexData.size()) {
+        return false;
+    }
+    StageTimer sculptTimer;
+    unsigned int resolution = mSettings.resolution;
+    std::vector<FaceGenerator> faceGenerators = makeFaceGenerators(mSettings);
+
+    // the brush covers a cap of the sphere around its center
+    brushCenter = glm::normalize(brushCenter);
+    float brushAngle = glm::clamp(settings.brushRadius / mSettings.radius, 1e-3f, 0.5f);
+    float cosBrushAngle = cos(brushAngle);
+
+    // points on the border of the cap, to find the grid rectangle it covers on each face
+    std::vector<glm::vec3> outline = circleOnSphere(brushCenter, brushAngle);
+    outline.push_back(brushCenter);
+
+    // every vertex of a face is at most this far from its normal (the cube corners)
+    const float faceMinCos = 1.0f / std::sqrt(3.0f);
+
+    // the rows of the faces covered by the brush
+    struct Row {
+        unsigned int face;
+        unsigned int y;
+        unsigned int xStart, xEnd;
+    };
+    std::vector<Row> rows;
+    for (unsigned int face = 0; face < faceGenerators.size(); face++) {
+        FaceGenerator const &faceGenerator = faceGenerators[face];
+        glm::vec2 low(FLT_MAX), high(-FLT_MAX);
+        bool projected = false, clipped = false;
+        auto addPoint = [&](glm::vec3 const &point) {
+            glm::vec2 grid;
+            if (faceGenerator.gridCoordinates(point, grid)) {
+                low = glm::min(low, grid);
+                high = glm::max(high, grid);
+                projected = true;
+            }
+        };
+        for (glm::vec3 const &point : outline) {
+            if (glm::dot(point, mFaces[face]) >= faceMinCos) {
+                addPoint(point);
+            } else {
+                clipped = true;
+            }
+        }
+        // the part of the cap outside of the face is replaced by the circle bounding the face
+        if (clipped) {
+            for (glm::vec3 const &point : circleOnSphere(mFaces[face], std::acos(faceMinCos))) {
+                if (glm::dot(point, brushCenter) >= cosBrushAngle) addPoint(point);
+            }
+        }
+        if (!projected) continue;
+        float last = float(resolution - 1);
+        // a couple of vertices of margin since the outlines are only sampled
+        low -= 2.0f;
+        high += 2.0f;
+        if (high.x < 0.0f || high.y < 0.0f || low.x > last || low.y > last) continue;
+        for (unsigned int y = (unsigned int)std::max(low.y, 0.0f); y <= (unsigned int)std::min(std::ceil(high.y), last); y++) {
+            rows.push_back({face, y, (unsigned int)std::max(low.x, 0.0f), (unsigned int)std::min(std::ceil(high.x), last)});
+        }
+    }
+
+    // compute the new elevations from the current ones before changing anything,
+    // so that the smoothing gives the same result on the duplicated vertices of the face borders
+    struct Edit {
+        unsigned int x, y;
+        glm::vec3 pointOnUnitSphere;
+        float delta;
+    };
+    std::vector<std::vector<Edit>> rowEdits(rows.size());
+    parallelFor(rows.size(), [&](size_t rowStart, size_t rowEnd) {
+        for (size_t r = rowStart; r < rowEnd; r++) {
+            Row const &row = rows[r];
+            FaceGenerator const &faceGenerator = faceGenerators[row.face];
+            unsigned int y = row.y;
+            for (unsigned int x = row.xStart; x <= row.xEnd; x++) {
+                glm::vec3 pointOnUnitSphere = faceGenerator.pointOnUnitSphere(x, y);
+                float cosAngle = glm::dot(pointOnUnitSphere, brushCenter);
+                if (cosAngle < cosBrushAngle) continue;
+                // smooth falloff, (1 - cos) is close enough to the squared angle at brush scale
+                float t2 = (1.0f - cosAngle) / (1.0f - cosBrushAngle);
+                float weight = (1.0f - t2) * (1.0f - t2);
+
+                uint32_t i = faceGenerator.vertexIndex(x, y);
+                float delta = 0.0f;
+                if (settings.brushMode == BrushMode::Raise) {
+                    delta = settings.brushStrength * weight;
+                } else if (settings.brushMode == BrushMode::Lower) {
+                    delta = -settings.brushStrength * weight;
+                } else if (settings.brushMode == BrushMode::Smooth) {
+                    // average of the neighbours in the grid
+                    // on a face border, only the neighbours along the border are shared with the other face
+                    bool borderX = x == 0 || x == resolution - 1;
+                    bool borderY = y == 0 || y == resolution - 1;
+                    if (borderX && borderY) continue;  // face corner
+                    float sum = 0.0f;
+                    int count = 0;
+                    auto addNeighbour = [&](uint32_t neighbour) {
+                        sum += mNoiseCache[neighbour] + mSculptOffsets[neighbour];
+                        count++;
+                    };
+                    if (!borderY) {
+                        addNeighbour(faceGenerator.vertexIndex(x, y - 1));
+                        addNeighbour(faceGenerator.vertexIndex(x, y + 1));
+                    }
+                    if (!borderX) {
+                        addNeighbour(faceGenerator.vertexIndex(x - 1, y));
+                        addNeighbour(faceGenerator.vertexIndex(x + 1, y));
+                    }
+                    float smoothing = glm::clamp(settings.brushStrength * 50.0f, 0.0f, 1.0f);
+                    delta = (sum / float(count) - (mNoiseCache[i] + mSculptOffsets[i])) * weight * smoothing;
+                }
+                rowEdits[r].push_back({x, y, pointOnUnitSphere, delta});
+            }
+        }
+    });
+
+    // apply the edits: elevation, histogram, position and bounds
+    // and shrink the rows to the vertices that actually moved
+    size_t editCount = 0;
+    for (size_t r = 0; r < rows.size(); r++) {
+        Row &row = rows[r];
+        if (rowEdits[r].empty()) continue;
+        FaceGenerator &faceGenerator = faceGenerators[row.face];
+        for (Edit const &edit : rowEdits[r]) {
+            uint32_t i = faceGenerator.vertexIndex(edit.x, edit.y);
+            mBounds.histogram[TerrainBounds::histogramBin(mNoiseCache[i] + mSculptOffsets[i])]--;
+            mSculptOffsets[i] += edit.delta;
+            float elevation = mNoiseCache[i] + mSculptOffsets[i];
+            mBounds.histogram[TerrainBounds::histogramBin(elevation)]++;
+            faceGenerator.moveVertex(vertexData, mBounds, edit.x, edit.y, edit.pointOnUnitSphere, elevation);
+        }
+        row.xStart = rowEdits[r].front().x;
+        row.xEnd = rowEdits[r].back().x;
+        editCount += rowEdits[r].size();
+    }
+    if (editCount == 0) {
+        return false;
+    }
+
+    // the normals change on the moved vertices and their direct neighbours
+    // (the rows are sorted by face, then y)
+    std::vector<Row> normalRows;
+    for (size_t r = 0; r < rows.size(); r++) {
+        if (rowEdits[r].empty()) continue;
+        Row const &row = rows[r];
+        unsigned int xStart = row.xStart == 0 ? 0 : row.xStart - 1;
+        unsigned int xEnd = std::min(row.xEnd + 1, resolution - 1);
+        for (unsigned int y = (row.y == 0 ? 0 : row.y - 1); y <= std::min(row.y + 1, resolution - 1); y++) {
+            // the row may already be there from the previous rows of edits (at most 2 rows back)
+            Row *existing = nullptr;
+            for (size_t n = normalRows.size(); n > 0 && n + 3 > normalRows.size(); n--) {
+                if (normalRows[n - 1].face == row.face && normalRows[n - 1].y == y) existing = &normalRows[n - 1];
+            }
+            if (existing) {
+                existing->xStart = std::min(existing->xStart, xStart);
+                existing->xEnd = std::max(existing->xEnd, xEnd);
+            } else {
+                normalRows.push_back({row.face, y, xStart, xEnd});
+            }
+        }
+    }
+    parallelFor(normalRows.size(), [&](size_t rowStart, size_t rowEnd) {
+        for (size_t r = rowStart; r < rowEnd; r++) {
+            Row const &row = normalRows[r];
+            faceGenerators[row.face].regenerateRegionNormals(vertexData, row.xStart, row.y, row.xEnd, row.y);
+        }
+    });
+
+    // the clusters of the tiles with a quad touching a moved vertex
+    std::vector<unsigned int> dirtyTiles;
+    for (Row const &row : normalRows) {
+        unsigned int quadY = std::min(row.y, resolution - 2) / TerrainBounds::TILE_SIZE;
+        unsigned int quadYBelow = (row.y == 0 ? 0 : row.y - 1) / TerrainBounds::TILE_SIZE;
+        unsigned int tileXStart = (row.xStart == 0 ? 0 : row.xStart - 1) / TerrainBounds::TILE_SIZE;
+        unsigned int tileXEnd = std::min(row.xEnd, resolution - 2) / TerrainBounds::TILE_SIZE;
+        for (unsigned int tileY = quadYBelow; tileY <= quadY; tileY++) {
+            for (unsigned int tileX = tileXStart; tileX <= tileXEnd; tileX++) {
+                dirtyTiles.push_back(mClusters.tileIndex(row.face, tileX, tileY));
+            }
+        }
+    }
+    std::sort(dirtyTiles.begin(), dirtyTiles.end());
+    dirtyTiles.erase(std::unique(dirtyTiles.begin(), dirtyTiles.end()), dirtyTiles.end());
+    parallelFor(dirtyTiles.size(), [&](size_t tileStart, size_t tileEnd) {
+        for (size_t t = tileStart; t < tileEnd; t++) {
+            mClusters.computeTile(dirtyTiles[t], vertexData, indices);
+        }
+    });
+    sculptShadowProxy(vertexData, faceGenerators, dirtyTiles);
+
+    // each row is contiguous in the vertex buffer
+    for (Row const &row : normalRows) {
+        VertexRange range = {faceGenerators[row.face].vertexIndex(row.xStart, row.y), row.xEnd - row.xStart + 1};
+        if (!dirtyRanges.empty() && dirtyRanges.back().first + dirtyRanges.back().count == range.first) {
+            dirtyRanges.back().count += range.count;
+        } else {
+            dirtyRanges.push_back(range);
+        }
+    }
+
+    STATS_SET(mStats.sculptMs, sculptTimer.elapsedMs());
+    STATS_SET(mStats.sculptVertices, editCount);
+    return true;
+}
+
+float PlanetGenerator::terrainRadius(
+    std::vector<VertexAttributes> const &vertexData,
+    std::vector<FaceGenerator> const &faceGenerators,
+    glm::vec3 direction) const {
+    // the face the direction points to is the one with the closest normal
+    unsigned int face = 0;
+    for (unsigned int i = 1; i < mFaces.size(); i++) {
+        if (glm::dot(direction, mFaces[i]) > glm::dot(direction, mFaces[face])) face = i;
+    }
+    glm::vec2 grid;
+    faceGenerators[face].gridCoordinates(direction, grid);
+    float last = float(mSettings.resolution - 1);
+    unsigned int x = (unsigned int)glm::clamp(std::round(grid.x), 0.0f, last);
+    unsigned int y = (unsigned int)glm::clamp(std::round(grid.y), 0.0f, last);
+    return glm::length(vertexData[faceGenerators[face].vertexIndex(x, y)].position);
+}
+
+bool PlanetGenerator::raycast(
+    std::vector<VertexAttributes> const &vertexData,
+    glm::vec3 origin,
+    glm::vec3 direction,
+    glm::vec3 &hit) const {
+    if (mBounds.planet.empty() || vertexData.size() != mSculptOffsets.size()) {
+        return false;
+    }
+    std::vector<FaceGenerator> faceGenerators = makeFaceGenerators(mSettings);
+    direction = glm::normalize(direction);
+
+    // only march inside the bounding sphere of the terrain
+    float boundingRadius = mBounds.planet.maxRadius;
+    float b = glm::dot(origin, direction);
+    float c = glm::dot(origin, origin) - boundingRadius * boundingRadius;
+    float discriminant = b * b - c;
+    if (discriminant < 0.0f) return false;
+    float tStart = std::max(-b - std::sqrt(discriminant), 0.0f);
+    float tEnd = -b + std::sqrt(discriminant);
+    if (tEnd <= tStart) return false;
+
+    // steps of about half the grid spacing
+    float spacing = boundingRadius * 3.14159265f * 0.5f / float(mSettings.resolution - 1);
+    float step = std::max(spacing * 0.5f, (tEnd - tStart) / 4096.0f);
+    float previous = tStart;
+    for (float t = tStart; t <= tEnd; t += step) {
+        glm::vec3 point = origin + t * direction;
+        if (glm::length(point) > terrainRadius(vertexData, faceGenerators, glm::normalize(point))) {
+            previous = t;
+            continue;
+        }
+        // refine between the last point above the terrain and this one
+        float above = previous, below = t;
+        for (int i = 0; i < 8; i++) {
+            float middle = (above + below) * 0.5f;
+            glm::vec3 middlePoint = origin + middle * direction;
+            if (glm::length(middlePoint) > terrainRadius(vertexData, faceGenerators, glm::normalize(middlePoint))) {
+                above = middle;
+            } else {
+                below = middle;
+            }
+        }
+        hit = origin + below * direction;
+        return true;
+    }
+    return false;
+}
\ No newline at end of file
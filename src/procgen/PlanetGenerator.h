@@ -1,6 +1,14 @@
 #include "procgen/FaceGenerator.hpp"
+#include "procgen/GridSimplifier.hpp"
+#include "procgen/SphereTessellation.hpp"
 #include "core/Renderer.h"
 #include "procgen/ElevationGenerator.hpp"
+#include "procgen/GenerationStats.hpp"
+#include "procgen/TerrainBounds.hpp"
+#include "procgen/TerrainClusters.hpp"
+#include "procgen/VertexCacheStats.hpp"
+
+#include <memory>
 
 class PlanetGenerator {
    public:
@@ -9,5 +17,149 @@ class PlanetGenerator {
         std::vector<uint32_t> &indices,
         GUISettings settings);
 
+    // apply one step of the sculpting brush around the given direction (from the planet center)
+    // only the vertices under the brush are regenerated, their normals are recomputed
+    // with a one vertex border, and the changed vertices are returned in dirtyRanges
+    // the clusters of the touched tiles are updated too, and their triangles in the shadow proxy
+    bool sculpt(
+        std::vector<VertexAttributes> &vertexData,
+        std::vector<uint32_t> const &indices,
+        glm::vec3 brushCenter,
+        GUISettings const &settings,
+        std::vector<VertexRange> &dirtyRanges);
+
+    // find where a ray hits the terrain of the last generated planet
+    bool raycast(
+        std::vector<VertexAttributes> const &vertexData,
+        glm::vec3 origin,
+        glm::vec3 direction,
+        glm::vec3 &hit) const;
+
+    // counters of the last generation
+    const GenerationStats &getStats() const { return mStats; };
+
+    // bounds and elevation histogram of the last generated planet
+    const TerrainBounds &getBounds() const { return mBounds; };
+
+    // clusters of the last generated planet, kept up to date by the sculpting
+    const TerrainClusters &getClusters() const { return mClusters; };
+
+    // reduced triangles of the last generated planet for the shadow pass, on the same vertices
+    // (see generateShadowProxy), a range per level of detail with their own clusters to cull them against the sun
+    const std::vector<uint32_t> &getShadowIndices() const { return mShadowIndices; };
+    const std::vector<ShadowLevel> &getShadowLevels() const { return mShadowLevels; };
+
+    // texels per side of the shadow map, the levels of the shadow proxy are decimated down to its footprint
+    void setShadowMapSize(unsigned int size) { mShadowMapSize = size; };
+
+    // the upload is done by the renderer, so it is timed from outside
+    void setUploadTime([[maybe_unused]] double uploadMs) { STATS_ADD(mStats.uploadMs, uploadMs); };
+
+    // vertices per side of the faces if the last planet is the full cube grid (that the renderer can draw
+    // without index buffer), 0 for a simplified grid or another tessellation
+    unsigned int getGridResolution() const {
+        return mSettings.tessellation == Tessellation::CubeSphere && !mSettings.simplify ? mSettings.resolution : 0;
+    }
+
    private:
+    size_t generateCubeData(
+        std::vector<VertexAttributes> &vertexData,
+        std::vector<uint32_t> &indices,
+        GUISettings const &settings,
+        bool useCachedNoise);
+
+    size_t generateTessellatedData(
+        std::vector<VertexAttributes> &vertexData,
+        std::vector<uint32_t> &indices,
+        GUISettings const &settings,
+        bool useCachedNoise);
+
+    // radius of the terrain in the given direction, read from the closest vertex
+    float terrainRadius(
+        std::vector<VertexAttributes> const &vertexData,
+        std::vector<FaceGenerator> const &faceGenerators,
+        glm::vec3 direction) const;
+
+    // fill the vertex cache efficiency counters of the stats
+    void measureVertexCache(std::vector<uint32_t> const &indices, unsigned int resolution, size_t firstFaceIndexCount);
+
+    // fill the edge length counters of the stats, comparing the cube projections
+    void measureProjections(GUISettings const &settings);
+    void measureTessellations(GUISettings const &settings);
+
+    // simplify the triangles of every face (see GridSimplifier), gives the index count of each tile
+    void simplify(
+        std::vector<VertexAttributes> const &vertexData,
+        std::vector<uint32_t> &indices,
+        std::vector<FaceGenerator> const &faceGenerators,
+        GUISettings const &settings,
+        std::vector<uint32_t> &tileIndexCounts);
+
+    // the triangles drawn in the shadow map: a texel of the map covers several cells of a fine grid,
+    // so the mesh is decimated down to the texels, a level of detail for each halving of the texel size
+    // (the cascades that follow the view have much smaller texels than the one around the whole planet)
+    // - the cube grid is simplified with a minimum step of about a texel and an error of a texel
+    // - the other tessellations are sub-grids of their patches, with a step of about a texel
+    void generateShadowProxy(
+        std::vector<VertexAttributes> const &vertexData,
+        std::vector<uint32_t> const &indices,
+        GUISettings const &settings);
+
+    // simplify the dirty tiles of every level of the cube shadow proxy again, after the sculpting moved them
+    void sculptShadowProxy(
+        std::vector<VertexAttributes> const &vertexData,
+        std::vector<FaceGenerator> const &faceGenerators,
+        std::vector<unsigned int> const &dirtyTiles);
+
+    // put the triangles of every level of the cube shadow proxy one after the other, and lay out their clusters
+    // the tiles not in changedTiles keep the bounds of their clusters (empty: all of them are computed)
+    void assembleShadowLevels(
+        std::vector<VertexAttributes> const &vertexData,
+        std::vector<std::vector<std::vector<uint32_t>>> const &levelFaceIndices,
+        std::vector<bool> const &changedTiles);
+
+    // the generators of the 6 faces, for the last generated settings
+    std::vector<FaceGenerator> makeFaceGenerators(GUISettings const &settings) const;
+
+    // the tessellation backend of the given settings
+    std::unique_ptr<SphereTessellation> makeTessellation(GUISettings const &settings) const;
+
+    // define the 6 faces normals
+    std::vector<glm::vec3> mFaces{
+        glm::vec3(0.0f, 1.0f, 0.0f),   // top
+        glm::vec3(0.0f, -1.0f, 0.0f),  // down
+        glm::vec3(-1.0f, 0.0f, 0.0f),  // left
+        glm::vec3(1.0f, 0.0f, 0.0f),   // right
+        glm::vec3(0.0f, 0.0f, 1.0f),   // front
+        glm::vec3(0.0f, 0.0f, -1.0f),  // back
+    };
+
+    GUISettings mSettings;
+    GenerationStats mStats;
+    TerrainBounds mBounds;
+    TerrainClusters mClusters;
+    std::vector<uint32_t> mShadowIndices;
+    std::vector<ShadowLevel> mShadowLevels;
+    // what the sculpting needs to simplify some tiles of a level of the cube shadow proxy again
+    struct ShadowLevelGrid {
+        float maxError = 0.0f;
+        unsigned int minStep = 1;
+        std::vector<unsigned int> tileSteps;        // see GridSimplifier, face by face
+        std::vector<uint32_t> tileIndexCounts;
+    };
+    std::vector<ShadowLevelGrid> mShadowLevelGrids;
+    unsigned int mShadowMapSize = 4096;
+
+    // raw noise of every vertex of the last generated planet
+    // it stays valid as long as the settings used to compute it are the same
+    std::vector<float> mNoiseCache;
+    int mCachedResolution = -1;
+    float mCachedFrequency = 0.0f;
+    int mCachedOctaves = 0;
+    Tessellation mCachedTessellation = Tessellation::CubeSphere;
+    CubeProjection mCachedProjection = CubeProjection::Normalize;
+
+    // elevation added by the sculpting brush on every vertex
+    // kept as long as the grid (resolution and projection) doesn't change, empty for the other tessellations
+    std::vector<float> mSculptOffsets;
 };
\ No newline at end of file
@@ -0,0 +1,336 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include "procgen/CubeProjection.hpp"
+#include "procgen/FaceGenerator.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// A tessellation backend: builds the triangles of the unit sphere, the elevation and normals are added
+// by PlanetGenerator the same way for all of them
+// the mesh is made of patches (the faces of the base polyhedron), each one a contiguous range of indices
+// emitted by bands of FaceGenerator::CACHE_BAND_WIDTH for the post-transform cache
+// the triangles are counter clockwise seen from outside, like the ones of FaceGenerator
+class SphereTessellation {
+   public:
+    virtual ~SphereTessellation() = default;
+
+    // subdivision of the base polyhedron giving about as many vertices as the cube grid of this resolution,
+    // so that the resolution setting means the same for every backend
+    virtual unsigned int subdivisions(unsigned int resolution) const = 0;
+
+    virtual size_t vertexCount(unsigned int subdivisions) const = 0;
+
+    // the points of the unit sphere (each one only once, even on the borders of the patches)
+    // and the index count of each patch
+    // with a step, the triangles only join every step-th point of the grid of each patch (step must divide
+    // subdivisions): the points are the same, so a coarser mesh can be drawn with the vertices of the full one
+    virtual void build(
+        unsigned int subdivisions,
+        unsigned int step,
+        std::vector<glm::vec3>& points,
+        std::vector<uint32_t>& indices,
+        std::vector<uint32_t>& patchIndexCounts) const = 0;
+
+    // the largest step of build up to maxStep (a divisor of subdivisions, 1 if there is none)
+    // (see roundSubdivisions)
+    static unsigned int gridStep(unsigned int subdivisions, unsigned int maxStep) {
+        for (unsigned int step = std::min(maxStep, subdivisions); step > 1; step--) {
+            if (subdivisions % step == 0) return step;
+        }
+        return 1;
+    }
+
+    // shortest and longest edges of the triangles on the unit sphere
+    void edgeLengths(unsigned int subdivisions, float& minLength, float& maxLength) const {
+        std::vector<glm::vec3> points;
+        std::vector<uint32_t> indices;
+        std::vector<uint32_t> patchIndexCounts;
+        build(subdivisions, 1, points, indices, patchIndexCounts);
+        minLength = 2.0f;
+        maxLength = 0.0f;
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (unsigned int corner = 0; corner < 3; corner++) {
+                float length = glm::length(points[indices[i + corner]] - points[indices[i + (corner + 1) % 3]]);
+                minLength = std::min(minLength, length);
+                maxLength = std::max(maxLength, length);
+            }
+        }
+    }
+
+   protected:
+    // a multiple of 8 once the mesh is fine enough, for a few percents of vertices more or less:
+    // the shadow proxy has sub-grids with steps of 2, 4 and 8 then (see PlanetGenerator::generateShadowProxy)
+    static unsigned int roundSubdivisions(double subdivisions) {
+        if (subdivisions < 16.0) return std::max(1u, (unsigned int)std::lround(subdivisions));
+        return 8 * (unsigned int)std::lround(subdivisions / 8.0);
+    }
+
+    // Adds the points of the patches one by one, each patch computes the points of its own borders
+    // so these are looked up among the points already added, to share them between the patches
+    class PointWelder {
+       public:
+        // the points of a border are computed differently by each patch, but much closer than this
+        static constexpr float TOLERANCE = 1e-5f;
+
+        explicit PointWelder(std::vector<glm::vec3>& _points) : points(_points) { points.clear(); }
+
+        uint32_t add(glm::vec3 point, bool on_border) {
+            if (!on_border) {
+                points.push_back(point);
+                return uint32_t(points.size() - 1);
+            }
+            glm::ivec3 cell = glm::ivec3(glm::floor(point / TOLERANCE));
+            // the same point can be rounded to the next cell: look around
+            for (int dz = -1; dz <= 1; dz++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        auto found = borderPoints.find(key(cell + glm::ivec3(dx, dy, dz)));
+                        if (found != borderPoints.end() && glm::length(points[found->second] - point) < TOLERANCE) {
+                            return found->second;
+                        }
+                    }
+                }
+            }
+            points.push_back(point);
+            borderPoints[key(cell)] = uint32_t(points.size() - 1);
+            return uint32_t(points.size() - 1);
+        }
+
+       private:
+        static uint64_t key(glm::ivec3 cell) {
+            // the cells of the unit sphere fit in 21 bits per axis
+            return (uint64_t(cell.x + (1 << 20)) << 42) | (uint64_t(cell.y + (1 << 20)) << 21) | uint64_t(cell.z + (1 << 20));
+        }
+
+        std::vector<glm::vec3>& points;
+        std::unordered_map<uint64_t, uint32_t> borderPoints;
+    };
+
+    // the triangles of a grid of quads, (size + 1)² vertices given row by row in ids, joining every step-th one
+    // flipped if the grid is clockwise seen from outside
+    static void addQuadGrid(
+        std::vector<glm::vec3> const& points,
+        std::vector<uint32_t> const& ids,
+        unsigned int size,
+        unsigned int step,
+        std::vector<uint32_t>& indices) {
+        unsigned int row = size + 1;
+        unsigned int cells = size / step;
+        glm::vec3 p = points[ids[0]], p_right = points[ids[step]], p_diagonal = points[ids[(row + 1) * step]];
+        bool flip = glm::dot(glm::cross(p_right - p, p_diagonal - p), p + p_right + p_diagonal) < 0.0f;
+        for (unsigned int band = 0; band < cells; band += FaceGenerator::CACHE_BAND_WIDTH) {
+            unsigned int band_end = std::min(band + FaceGenerator::CACHE_BAND_WIDTH, cells);
+            for (unsigned int y = 0; y < cells; y++) {
+                for (unsigned int x = band; x < band_end; x++) {
+                    uint32_t i = (x + y * row) * step;
+                    // same 2 triangles as FaceGenerator::generateFaceIndices
+                    addTriangle(indices, ids[i], ids[i + (row + 1) * step], ids[i + row * step], flip);
+                    addTriangle(indices, ids[i], ids[i + step], ids[i + (row + 1) * step], flip);
+                }
+            }
+        }
+    }
+
+    static void addTriangle(std::vector<uint32_t>& indices, uint32_t a, uint32_t b, uint32_t c, bool flip) {
+        if (flip) {
+            indices.insert(indices.end(), {a, c, b});
+        } else {
+            indices.insert(indices.end(), {a, b, c});
+        }
+    }
+};
+
+// The cube of FaceGenerator, with its projection (the seams are shared here, not duplicated)
+class CubeSphereTessellation : public SphereTessellation {
+   public:
+    CubeSphereTessellation(CubeProjection _projection, std::vector<glm::vec3> const& _faces)
+        : projection(_projection), faces(_faces) {}
+
+    unsigned int subdivisions(unsigned int resolution) const override { return resolution - 1; }
+
+    size_t vertexCount(unsigned int subdivisions) const override { return 6 * size_t(subdivisions) * subdivisions + 2; }
+
+    void build(
+        unsigned int subdivisions,
+        unsigned int step,
+        std::vector<glm::vec3>& points,
+        std::vector<uint32_t>& indices,
+        std::vector<uint32_t>& patchIndexCounts) const override {
+        PointWelder welder(points);
+        indices.clear();
+        patchIndexCounts.clear();
+        float last = float(subdivisions);
+        std::vector<uint32_t> ids;
+        for (glm::vec3 face_normal : faces) {
+            // same axes as FaceGenerator
+            glm::vec3 axis_a = glm::vec3(face_normal.y, face_normal.z, face_normal.x);
+            glm::vec3 axis_b = glm::cross(face_normal, axis_a);
+            ids.clear();
+            for (unsigned int y = 0; y <= subdivisions; y++) {
+                for (unsigned int x = 0; x <= subdivisions; x++) {
+                    glm::vec2 point_on_face = (2.0f * glm::vec2(x, y) - last) / last;
+                    glm::vec2 point_on_cube = CubeSphereMapping::faceToCube(projection, point_on_face);
+                    glm::vec3 point = glm::normalize(face_normal + point_on_cube.x * axis_a + point_on_cube.y * axis_b);
+                    bool on_border = x == 0 || y == 0 || x == subdivisions || y == subdivisions;
+                    ids.push_back(welder.add(point, on_border));
+                }
+            }
+            size_t first = indices.size();
+            addQuadGrid(points, ids, subdivisions, step, indices);
+            patchIndexCounts.push_back(uint32_t(indices.size() - first));
+        }
+    }
+
+   private:
+    CubeProjection projection;
+    std::vector<glm::vec3> faces;
+};
+
+// Geodesic sphere: every edge of the icosahedron is split in n, and each face in n² triangles
+// the points are projected from the center like the cube ones
+class IcosphereTessellation : public SphereTessellation {
+   public:
+    // 10 n² + 2 vertices against 6 n² + 2 for the cube
+    unsigned int subdivisions(unsigned int resolution) const override {
+        return roundSubdivisions((resolution - 1) * std::sqrt(0.6));
+    }
+
+    size_t vertexCount(unsigned int subdivisions) const override { return 10 * size_t(subdivisions) * subdivisions + 2; }
+
+    void build(
+        unsigned int subdivisions,
+        unsigned int step,
+        std::vector<glm::vec3>& points,
+        std::vector<uint32_t>& indices,
+        std::vector<uint32_t>& patchIndexCounts) const override {
+        // the 12 vertices of the icosahedron are the (0, ±1, ±phi) and their circular permutations
+        const float phi = (1.0f + std::sqrt(5.0f)) * 0.5f;
+        std::array<glm::vec3, 12> corners = {
+            glm::vec3(-1, phi, 0), glm::vec3(1, phi, 0), glm::vec3(-1, -phi, 0), glm::vec3(1, -phi, 0),
+            glm::vec3(0, -1, phi), glm::vec3(0, 1, phi), glm::vec3(0, -1, -phi), glm::vec3(0, 1, -phi),
+            glm::vec3(phi, 0, -1), glm::vec3(phi, 0, 1), glm::vec3(-phi, 0, -1), glm::vec3(-phi, 0, 1)};
+        const unsigned int icosahedron[20][3] = {
+            {0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+            {1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+            {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+            {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}};
+
+        PointWelder welder(points);
+        indices.clear();
+        patchIndexCounts.clear();
+        unsigned int n = subdivisions;
+        std::vector<uint32_t> ids;
+        for (auto const& face : icosahedron) {
+            glm::vec3 a = corners[face[0]], b = corners[face[1]], c = corners[face[2]];
+            bool flip = glm::dot(glm::cross(b - a, c - a), a + b + c) < 0.0f;
+
+            // the points of the triangular grid, row j has n + 1 - j points
+            ids.clear();
+            for (unsigned int j = 0; j <= n; j++) {
+                for (unsigned int i = 0; i + j <= n; i++) {
+                    glm::vec3 point = glm::normalize(a + (b - a) * (float(i) / n) + (c - a) * (float(j) / n));
+                    bool on_border = i == 0 || j == 0 || i + j == n;
+                    ids.push_back(welder.add(point, on_border));
+                }
+            }
+            // the rows before j have n + 1, n, ... points
+            // (i, j) on the grid of the triangles, made of every step-th point
+            auto id = [&](unsigned int i, unsigned int j) {
+                i *= step;
+                j *= step;
+                return ids[j * (n + 1) - j * (j - 1) / 2 + i];
+            };
+
+            size_t first = indices.size();
+            unsigned int m = n / step;
+            for (unsigned int band = 0; band < m; band += FaceGenerator::CACHE_BAND_WIDTH) {
+                unsigned int band_end = std::min(band + FaceGenerator::CACHE_BAND_WIDTH, m);
+                for (unsigned int j = 0; j < m; j++) {
+                    for (unsigned int i = band; i < band_end && i + j < m; i++) {
+                        // the triangle pointing up, and the one pointing down next to it
+                        addTriangle(indices, id(i, j), id(i + 1, j), id(i, j + 1), flip);
+                        if (i + j + 1 < m) {
+                            addTriangle(indices, id(i + 1, j), id(i + 1, j + 1), id(i, j + 1), flip);
+                        }
+                    }
+                }
+            }
+            patchIndexCounts.push_back(uint32_t(indices.size() - first));
+        }
+    }
+};
+
+// HEALPix (Gorski et al. 2005): the corners of the 12 n² equal area pixels, each pixel split in 2 triangles
+// the pixel corners come from the continuous coordinates of the base pixels (xyf2loc of healpix_base)
+// the poles are along y, like the up axis of the camera
+class HealpixTessellation : public SphereTessellation {
+   public:
+    // 12 n² + 2 vertices against 6 n² + 2 for the cube
+    unsigned int subdivisions(unsigned int resolution) const override {
+        return roundSubdivisions((resolution - 1) / std::sqrt(2.0));
+    }
+
+    size_t vertexCount(unsigned int subdivisions) const override { return 12 * size_t(subdivisions) * subdivisions + 2; }
+
+    void build(
+        unsigned int subdivisions,
+        unsigned int step,
+        std::vector<glm::vec3>& points,
+        std::vector<uint32_t>& indices,
+        std::vector<uint32_t>& patchIndexCounts) const override {
+        PointWelder welder(points);
+        indices.clear();
+        patchIndexCounts.clear();
+        unsigned int n = subdivisions;
+        std::vector<uint32_t> ids;
+        for (int face = 0; face < 12; face++) {
+            ids.clear();
+            for (unsigned int y = 0; y <= n; y++) {
+                for (unsigned int x = 0; x <= n; x++) {
+                    glm::vec3 point = pointOnFace(face, float(x) / n, float(y) / n);
+                    bool on_border = x == 0 || y == 0 || x == n || y == n;
+                    ids.push_back(welder.add(point, on_border));
+                }
+            }
+            size_t first = indices.size();
+            addQuadGrid(points, ids, n, step, indices);
+            patchIndexCounts.push_back(uint32_t(indices.size() - first));
+        }
+    }
+
+   private:
+    // (x, y) in [0, 1]² on the base pixel
+    static glm::vec3 pointOnFace(int face, float x, float y) {
+        static const int jrll[12] = {2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4};
+        static const int jpll[12] = {1, 3, 5, 7, 0, 2, 4, 6, 1, 3, 5, 7};
+        float jr = float(jrll[face]) - x - y;
+        float nr, z, sinTheta;
+        if (jr < 1.0f) {
+            // north polar cap
+            nr = jr;
+            float oneMinusZ = nr * nr / 3.0f;
+            z = 1.0f - oneMinusZ;
+            sinTheta = std::sqrt(oneMinusZ * (2.0f - oneMinusZ));
+        } else if (jr > 3.0f) {
+            // south polar cap
+            nr = 4.0f - jr;
+            float onePlusZ = nr * nr / 3.0f;
+            z = onePlusZ - 1.0f;
+            sinTheta = std::sqrt(onePlusZ * (2.0f - onePlusZ));
+        } else {
+            // equatorial belt
+            nr = 1.0f;
+            z = (2.0f - jr) * 2.0f / 3.0f;
+            sinTheta = std::sqrt((1.0f - z) * (1.0f + z));
+        }
+        float tmp = float(jpll[face]) * nr + x - y;
+        float phi = nr < 1e-15f ? 0.0f : CubeSphereMapping::PI / 4.0f * tmp / nr;
+        return glm::vec3(sinTheta * std::cos(phi), z, sinTheta * std::sin(phi));
+    }
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+// Bounds of a piece of terrain: axis aligned box + distance to the planet center
+struct Bounds {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+    float minRadius = FLT_MAX;
+    float maxRadius = 0.0f;
+
+    bool empty() const { return minRadius > maxRadius; }
+
+    void add(glm::vec3 point, float radius) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+        minRadius = std::min(minRadius, radius);
+        maxRadius = std::max(maxRadius, radius);
+    }
+
+    void merge(Bounds const& other) {
+        if (other.empty()) return;
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+        minRadius = std::min(minRadius, other.minRadius);
+        maxRadius = std::max(maxRadius, other.maxRadius);
+    }
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+};
+
+// Bounds and elevation statistics of the whole planet, filled while the faces are generated
+// so that the renderer can fit its frustums without going through the mesh again
+struct TerrainBounds {
+    // count of quads on the side of a tile
+    static constexpr unsigned int TILE_SIZE = 32;
+    static constexpr unsigned int HISTOGRAM_BINS = 64;
+
+    Bounds planet;
+    std::vector<Bounds> faces;
+
+    // tiles of TILE_SIZE * TILE_SIZE quads, stored face by face, row by row
+    unsigned int tilesPerSide = 0;
+    std::vector<Bounds> tiles;
+
+    // distribution of the raw elevation (the noise between 0 and 1)
+    std::array<uint32_t, HISTOGRAM_BINS> histogram{};
+
+    static unsigned int tileCountPerSide(unsigned int resolution) {
+        return (resolution - 2) / TILE_SIZE + 1;
+    }
+
+    void reset(unsigned int faceCount, unsigned int resolution) {
+        planet = Bounds();
+        faces.assign(faceCount, Bounds());
+        tilesPerSide = tileCountPerSide(resolution);
+        tiles.assign(faceCount * tilesPerSide * tilesPerSide, Bounds());
+        histogram.fill(0);
+    }
+
+    Bounds& tile(unsigned int face, unsigned int tileX, unsigned int tileY) {
+        return tiles[(face * tilesPerSide + tileY) * tilesPerSide + tileX];
+    }
+    Bounds const& tile(unsigned int face, unsigned int tileX, unsigned int tileY) const {
+        return tiles[(face * tilesPerSide + tileY) * tilesPerSide + tileX];
+    }
+
+    static unsigned int histogramBin(float elevation) {
+        int bin = int(elevation * HISTOGRAM_BINS);
+        return (unsigned int)std::clamp(bin, 0, int(HISTOGRAM_BINS) - 1);
+    }
+};
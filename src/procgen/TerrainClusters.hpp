@@ -0,0 +1,189 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include "resource/ResourceManager.h"
+#include "procgen/TerrainBounds.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using VertexAttributes = ResourceManager::VertexAttributes;
+
+// A small contiguous range of the planet index buffer, with what is needed to cull it on the CPU
+struct Cluster {
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+
+    // bounding sphere
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+
+    // cone containing the normals of all the triangles
+    // coneCutoff is the sine of the cone half angle, 1 if the cone is too wide to ever be culled
+    glm::vec3 coneAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+    float coneCutoff = 1.0f;
+
+    // true if every triangle faces away from a camera at the given position
+    bool backFacing(glm::vec3 cameraPosition) const {
+        glm::vec3 toCenter = center - cameraPosition;
+        return glm::dot(toCenter, coneAxis) >= coneCutoff * glm::length(toCenter) + radius;
+    }
+
+    // same for a light infinitely far in the given (normalized) direction: every normal is more than
+    // 90 degrees away from it, whatever the position of the triangle
+    bool backFacingDirection(glm::vec3 lightDirection) const {
+        return glm::dot(lightDirection, coneAxis) < -coneCutoff;
+    }
+};
+
+// The planet split in clusters of TRIANGLES_PER_CLUSTER triangles
+// the clusters never cross a tile of TerrainBounds: the index buffer is emitted tile by tile,
+// so the clusters of a tile are the consecutive chunks of its index range
+struct TerrainClusters {
+    static constexpr unsigned int TRIANGLES_PER_CLUSTER = 128;
+
+    std::vector<Cluster> clusters;
+    // first cluster of each tile (same order as TerrainBounds::tiles), plus the total count at the end
+    std::vector<uint32_t> tileFirstCluster;
+    unsigned int tilesPerSide = 0;
+
+    // range of the indices of a tile, relative to the first index of its face
+    static void tileIndexRange(
+        unsigned int resolution,
+        unsigned int tileX, unsigned int tileY,
+        uint32_t& first, uint32_t& count) {
+        unsigned int quadsPerSide = resolution - 1;
+        unsigned int x = tileX * TerrainBounds::TILE_SIZE;
+        unsigned int y = tileY * TerrainBounds::TILE_SIZE;
+        unsigned int width = std::min(TerrainBounds::TILE_SIZE, quadsPerSide - x);
+        unsigned int height = std::min(TerrainBounds::TILE_SIZE, quadsPerSide - y);
+        first = 6 * (y * quadsPerSide + height * x);
+        count = 6 * width * height;
+    }
+
+    // index ranges of the tiles of the full grid, in the order of TerrainBounds::tiles
+    static std::vector<uint32_t> gridTileIndexCounts(unsigned int faceCount, unsigned int resolution) {
+        unsigned int tilesPerSide = TerrainBounds::tileCountPerSide(resolution);
+        std::vector<uint32_t> counts;
+        for (unsigned int face = 0; face < faceCount; face++) {
+            for (unsigned int tileY = 0; tileY < tilesPerSide; tileY++) {
+                for (unsigned int tileX = 0; tileX < tilesPerSide; tileX++) {
+                    uint32_t first, count;
+                    tileIndexRange(resolution, tileX, tileY, first, count);
+                    counts.push_back(count);
+                }
+            }
+        }
+        return counts;
+    }
+
+    // lay out the clusters of every tile, their bounds are computed later by computeTile
+    // the tiles are consecutive in the index buffer from firstIndex, with the given index counts
+    void reset(unsigned int resolution, std::vector<uint32_t> const& tileIndexCounts, uint32_t firstIndex = 0) {
+        tilesPerSide = TerrainBounds::tileCountPerSide(resolution);
+        tileFirstCluster.clear();
+        clusters.clear();
+        uint32_t first = firstIndex;
+        for (uint32_t count : tileIndexCounts) {
+            tileFirstCluster.push_back((uint32_t)clusters.size());
+            for (uint32_t offset = 0; offset < count; offset += 3 * TRIANGLES_PER_CLUSTER) {
+                Cluster cluster;
+                cluster.firstIndex = first + offset;
+                cluster.indexCount = std::min(3 * TRIANGLES_PER_CLUSTER, count - offset);
+                clusters.push_back(cluster);
+            }
+            first += count;
+        }
+        tileFirstCluster.push_back((uint32_t)clusters.size());
+    }
+
+    unsigned int tileIndex(unsigned int face, unsigned int tileX, unsigned int tileY) const {
+        return (face * tilesPerSide + tileY) * tilesPerSide + tileX;
+    }
+
+    // compute the bounding spheres and normal cones of the clusters of a tile
+    void computeTile(
+        unsigned int tile,
+        std::vector<VertexAttributes> const& vertexData,
+        std::vector<uint32_t> const& indices) {
+        for (uint32_t c = tileFirstCluster[tile]; c < tileFirstCluster[tile + 1]; c++) {
+            computeCluster(clusters[c], vertexData, indices);
+        }
+    }
+
+    // the bounds of a tile whose triangles didn't change, only their place in the index buffer
+    // (taken from the clusters before a reset with the new index counts)
+    void copyTile(unsigned int tile, TerrainClusters const& previous) {
+        uint32_t from = previous.tileFirstCluster[tile];
+        for (uint32_t c = tileFirstCluster[tile]; c < tileFirstCluster[tile + 1]; c++, from++) {
+            uint32_t firstIndex = clusters[c].firstIndex;
+            clusters[c] = previous.clusters[from];
+            clusters[c].firstIndex = firstIndex;
+        }
+    }
+
+    static void computeCluster(
+        Cluster& cluster,
+        std::vector<VertexAttributes> const& vertexData,
+        std::vector<uint32_t> const& indices) {
+        uint32_t last = cluster.firstIndex + cluster.indexCount;
+
+        // sphere around the bounding box, and average of the triangle normals
+        glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+        glm::vec3 normalSum(0.0f);
+        for (uint32_t i = cluster.firstIndex; i < last; i += 3) {
+            glm::vec3 p1 = vertexData[indices[i]].position;
+            glm::vec3 p2 = vertexData[indices[i + 1]].position;
+            glm::vec3 p3 = vertexData[indices[i + 2]].position;
+            low = glm::min(low, glm::min(p1, glm::min(p2, p3)));
+            high = glm::max(high, glm::max(p1, glm::max(p2, p3)));
+            glm::vec3 normal = glm::cross(p2 - p1, p3 - p1);
+            float length = glm::length(normal);
+            if (length > 0.0f) normalSum += normal / length;
+        }
+        cluster.center = (low + high) * 0.5f;
+        cluster.radius = 0.0f;
+        for (uint32_t i = cluster.firstIndex; i < last; i++) {
+            cluster.radius = std::max(cluster.radius, glm::length(vertexData[indices[i]].position - cluster.center));
+        }
+
+        // the cone is as wide as the normal the furthest from the average one
+        float axisLength = glm::length(normalSum);
+        if (axisLength == 0.0f) {
+            cluster.coneCutoff = 1.0f;
+            return;
+        }
+        cluster.coneAxis = normalSum / axisLength;
+        float minDot = 1.0f;
+        for (uint32_t i = cluster.firstIndex; i < last; i += 3) {
+            glm::vec3 p1 = vertexData[indices[i]].position;
+            glm::vec3 normal = glm::cross(vertexData[indices[i + 1]].position - p1, vertexData[indices[i + 2]].position - p1);
+            float length = glm::length(normal);
+            if (length > 0.0f) minDot = std::min(minDot, glm::dot(normal / length, cluster.coneAxis));
+        }
+        // wider than a half sphere: some triangle always faces the camera
+        cluster.coneCutoff = minDot <= 0.0f ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+    }
+};
+
+// A level of detail of the shadow casters (see PlanetGenerator::generateShadowProxy)
+// all the levels are on the planet vertices, one after the other in the same index buffer, coarsest first
+struct ShadowLevel {
+    // the smallest texel of a cascade the level is detailed enough for
+    float texelSize = 0.0f;
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    // their first indices are in the whole shadow index buffer
+    TerrainClusters clusters;
+
+    // the coarsest level for a cascade with texels of the given size, the finest one for smaller texels
+    static unsigned int pick(std::vector<ShadowLevel> const& levels, float cascadeTexelSize) {
+        for (unsigned int level = 0; level < levels.size(); level++) {
+            if (levels[level].texelSize <= cascadeTexelSize) return level;
+        }
+        return levels.empty() ? 0 : (unsigned int)levels.size() - 1;
+    }
+};
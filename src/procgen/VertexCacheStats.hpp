@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Measures how well an index buffer reuses the GPU post-transform vertex cache,
+// by replaying it through a FIFO cache like the ones of most hardware
+// - ACMR: average cache miss ratio, vertex shader invocations per triangle (0.5 at best on a grid, 3 at worst)
+// - ATVR: average transform to vertex ratio, vertex shader invocations per vertex used (1 at best)
+struct VertexCacheStats {
+    static constexpr unsigned int DEFAULT_CACHE_SIZE = 32;
+
+    double acmr = 0.0;
+    double atvr = 0.0;
+
+    // replay indices[first, first + count) through a FIFO cache of cacheSize entries
+    static VertexCacheStats measure(
+        std::vector<uint32_t> const& indices,
+        size_t first,
+        size_t count,
+        unsigned int cacheSize = DEFAULT_CACHE_SIZE) {
+        VertexCacheStats stats;
+        if (count < 3) return stats;
+
+        // the position in the FIFO of every vertex that went through it, to find them without a search
+        uint32_t minIndex = UINT32_MAX, maxIndex = 0;
+        for (size_t i = first; i < first + count; i++) {
+            minIndex = std::min(minIndex, indices[i]);
+            maxIndex = std::max(maxIndex, indices[i]);
+        }
+        std::vector<uint64_t> insertedAt(maxIndex - minIndex + 1, UINT64_MAX);
+
+        uint64_t transforms = 0;
+        uint64_t uniqueVertices = 0;
+        for (size_t i = first; i < first + count; i++) {
+            uint64_t& inserted = insertedAt[indices[i] - minIndex];
+            if (inserted == UINT64_MAX) {
+                uniqueVertices++;
+            }
+            // a miss if never seen, or if cacheSize other vertices were pushed since
+            if (inserted == UINT64_MAX || transforms - inserted >= cacheSize) {
+                inserted = transforms;
+                transforms++;
+            }
+        }
+        stats.acmr = double(transforms) / double(count / 3);
+        stats.atvr = double(transforms) / double(uniqueVertices);
+        return stats;
+    }
+};
@@ -26,19 +26,32 @@
 
 #include "resource/ResourceManager.h"
 
+#include <algorithm>
+#include <array>
+#include <iostream>
+
 using namespace wgpu;
 namespace fs = std::filesystem;
 
 ShaderModule ResourceManager::loadShaderModule(const path& path, Device device) {
-    std::ifstream file(path);
-    if (!file.is_open()) {
-        return nullptr;
+    return loadShaderModule(std::vector<ResourceManager::path>{path}, device);
+}
+
+ShaderModule ResourceManager::loadShaderModule(const std::vector<path>& paths, Device device) {
+    // WGSL has no include: the files are put one after the other
+    std::string shaderSource;
+    for (const path& path : paths) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            return nullptr;
+        }
+        file.seekg(0, std::ios::end);
+        size_t size = file.tellg();
+        std::string fileSource(size, ' ');
+        file.seekg(0);
+        file.read(fileSource.data(), size);
+        shaderSource += fileSource + "\n";
     }
-    file.seekg(0, std::ios::end);
-    size_t size = file.tellg();
-    std::string shaderSource(size, ' ');
-    file.seekg(0);
-    file.read(shaderSource.data(), size);
 
     ShaderModuleWGSLDescriptor shaderCodeDesc;
     shaderCodeDesc.chain.next = nullptr;
@@ -357,3 +370,97 @@ Texture ResourceManager::loadPrefilteredCubemap(const path& rootPath, Device dev
 
     return texture;
 }
+
+// Auxiliary functions for writePng, the checksums of the chunks and of the zlib stream
+// (a byte at a time with a table, and the modulo of the sums only every 5552 bytes, when they could overflow)
+static uint32_t crc32(const std::vector<uint8_t>& data) {
+    static const std::array<uint32_t, 256> table = []() {
+        std::array<uint32_t, 256> crcs;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+            }
+            crcs[i] = crc;
+        }
+        return crcs;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (uint8_t byte : data) {
+        crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t adler32(const std::vector<uint8_t>& data) {
+    uint32_t a = 1, b = 0;
+    for (size_t start = 0; start < data.size(); start += 5552) {
+        size_t end = std::min<size_t>(start + 5552, data.size());
+        for (size_t i = start; i < end; ++i) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back((uint8_t)(value >> 24));
+    out.push_back((uint8_t)(value >> 16));
+    out.push_back((uint8_t)(value >> 8));
+    out.push_back((uint8_t)value);
+}
+
+bool ResourceManager::writePng(const path& path, uint32_t width, uint32_t height, const uint8_t* pixelData) {
+    // the rows, each one after its filter type (0 is none)
+    std::vector<uint8_t> scanlines;
+    scanlines.reserve(((size_t)4 * width + 1) * height);
+    for (uint32_t row = 0; row < height; ++row) {
+        const uint8_t* rowData = pixelData + (size_t)4 * width * row;
+        scanlines.push_back(0);
+        scanlines.insert(scanlines.end(), rowData, rowData + (size_t)4 * width);
+    }
+
+    // a zlib stream of stored deflate blocks: bigger files, but no compressor to carry around
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    size_t offset = 0;
+    do {
+        uint16_t blockSize = (uint16_t)std::min<size_t>(scanlines.size() - offset, 0xFFFF);
+        zlib.push_back(offset + blockSize == scanlines.size() ? 1 : 0);  // last block
+        zlib.push_back((uint8_t)blockSize);
+        zlib.push_back((uint8_t)(blockSize >> 8));
+        zlib.push_back((uint8_t)~blockSize);
+        zlib.push_back((uint8_t)(~blockSize >> 8));
+        zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+        offset += blockSize;
+    } while (offset < scanlines.size());
+    appendBigEndian(zlib, adler32(scanlines));
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Could not write " << path << std::endl;
+        return false;
+    }
+    // each chunk is its size, its type, its data and the CRC of its type and data
+    auto writeChunk = [&file](const char* type, const std::vector<uint8_t>& data) {
+        std::vector<uint8_t> chunk;
+        appendBigEndian(chunk, (uint32_t)data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        appendBigEndian(chunk, crc32(std::vector<uint8_t>(chunk.begin() + 4, chunk.end())));
+        file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+    };
+
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+    std::vector<uint8_t> header;
+    appendBigEndian(header, width);
+    appendBigEndian(header, height);
+    header.insert(header.end(), {8, 6, 0, 0, 0});  // 8 bits per channel, RGBA, deflate, no filter choice, no interlace
+    writeChunk("IHDR", header);
+    writeChunk("IDAT", zlib);
+    writeChunk("IEND", {});
+    return file.good();
+}
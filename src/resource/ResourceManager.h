@@ -64,6 +64,9 @@ class ResourceManager {
     // Load a shader from a WGSL file into a new shader module
     static wgpu::ShaderModule
     loadShaderModule(const path& path, wgpu::Device device);
+    // Same, from several WGSL files concatenated in the given order (to share code between shaders)
+    static wgpu::ShaderModule
+    loadShaderModule(const std::vector<path>& paths, wgpu::Device device);
 
     // Load an 3D mesh from a standard .obj file into a vertex data buffer
     static bool loadGeometryFromObj(const path& path, std::vector<VertexAttributes>& vertexData);
@@ -73,6 +76,9 @@ class ResourceManager {
     static wgpu::Texture loadTexture(const path& path, wgpu::Device device, wgpu::TextureView* pTextureView = nullptr);
     static wgpu::Texture loadPrefilteredCubemap(const path& rootPath, wgpu::Device device, wgpu::TextureView* pTextureView);
 
+    // Save RGBA8 pixels, rows from the top, in a PNG file (not compressed)
+    static bool writePng(const path& path, uint32_t width, uint32_t height, const uint8_t* pixelData);
+
    private:
     // Compute Tangent and Bitangent attributes from the normal and UVs.
     static void computeTextureFrameAttributes(std::vector<VertexAttributes>& vertexData);